@@ -0,0 +1,115 @@
+// Measures async_queue under contention: 1 to 32 producer threads emplace
+// requests while a fixed set of consumers, standing in for pooled connections,
+// take them and re-arm from an io_service exactly like connection_pool does.
+//
+// Usage: async_queue_benchmark [elements_per_run]
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "async_queue.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+constexpr size_t producer_counts[] = {1, 2, 4, 8, 16, 32};
+constexpr size_t num_consumers = 64;
+constexpr size_t highwatermark = 4096;
+
+struct element {
+  element(std::string payload, clock_type::time_point sent_at)
+      : payload{std::move(payload)}, sent_at{sent_at} {}
+  std::string payload;
+  clock_type::time_point sent_at;
+};
+
+using queue_type = riak::async_queue<element>;
+
+class contention_run {
+ public:
+  explicit contention_run(size_t num_elements)
+      : num_elements_{num_elements}, queue_{highwatermark, num_consumers} {
+    for (size_t i = 0; i < num_consumers; ++i) arm();
+  }
+
+  // Returns the number of elements per second and the mean time spent in
+  // emplace, in nanoseconds.
+  std::pair<double, double> run(size_t num_producers) {
+    auto start = clock_type::now();
+    std::atomic<int64_t> emplace_ns{0};
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i < num_producers; ++i) {
+      size_t count = num_elements_ / num_producers +
+                     (i < num_elements_ % num_producers ? 1 : 0);
+      producers.emplace_back([this, count, &emplace_ns] {
+        std::chrono::nanoseconds spent{0};
+        for (size_t j = 0; j < count; ++j) {
+          auto before = clock_type::now();
+          queue_.emplace(std::string(64, 'x'), before);
+          spent += clock_type::now() - before;
+        }
+        emplace_ns += spent.count();
+      });
+    }
+    for (auto& producer : producers) producer.join();
+
+    std::unique_lock<std::mutex> lock{done_mutex_};
+    while (consumed_ < num_elements_) done_condition_.wait(lock);
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    return {num_elements_ / elapsed.count(),
+            double(emplace_ns) / num_elements_};
+  }
+
+ private:
+  void arm() {
+    queue_.async_pop([this](element) {
+      consumer_threads_.io_service().post([this] { arm(); });
+      if (++consumed_ == num_elements_) {
+        std::lock_guard<std::mutex> lock{done_mutex_};
+        done_condition_.notify_one();
+      }
+    });
+  }
+
+  const size_t num_elements_;
+  std::atomic<size_t> consumed_{0};
+  queue_type queue_;
+
+  std::mutex done_mutex_;
+  std::condition_variable done_condition_;
+
+  // Declared last so that the consumers stop before anything they use.
+  riak::thread_pool consumer_threads_;
+};
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t num_elements =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+  if (num_elements == 0) {
+    std::fprintf(stderr, "usage: %s [elements_per_run]\n", argv[0]);
+    return 1;
+  }
+
+  std::printf("%zu elements per run, %zu consumers, highwatermark %zu\n",
+              num_elements, num_consumers, highwatermark);
+  std::printf("%9s %14s %18s\n", "producers", "elements/s",
+              "emplace mean (ns)");
+  for (auto num_producers : producer_counts) {
+    contention_run run{num_elements};
+    auto result = run.run(num_producers);
+    std::printf("%9zu %14.0f %18.0f\n", num_producers, result.first,
+                result.second);
+  }
+  return 0;
+}
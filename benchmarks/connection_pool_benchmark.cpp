@@ -0,0 +1,207 @@
+// Measures the throughput and latency of a connection_pool talking to an
+// in-process echo server over loopback, at 1, 8 and 64 connections. Only the
+// Asio engine (length_framed_connection) exists; its figures are the baseline
+// for any other Connection the pool is instantiated with.
+//
+// Usage: connection_pool_benchmark [requests_per_run] [payload_bytes]
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "byte_order.hpp"
+#include "connection_pool.hpp"
+#include "length_framed_connection.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+namespace io = boost::asio;
+using io::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+using pool_type = riak::connection_pool<riak::length_framed_connection>;
+
+constexpr size_t connection_counts[] = {1, 8, 64};
+constexpr size_t requests_in_flight_per_connection = 4;
+constexpr uint64_t deadline_ms = 10000;
+
+// Answers every length-prefixed frame with an identical frame.
+class echo_server {
+ public:
+  explicit echo_server(io::io_service& io_service)
+      : io_service_(io_service),
+        acceptor_{io_service,
+                  tcp::endpoint{io::ip::address_v4::loopback(), 0}} {
+    accept();
+  }
+
+  riak::endpoint_vector endpoints() const {
+    return {acceptor_.local_endpoint()};
+  }
+
+ private:
+  class session : public std::enable_shared_from_this<session> {
+   public:
+    explicit session(io::io_service& io_service) : socket_{io_service} {}
+
+    tcp::socket& socket() { return socket_; }
+
+    void read_frame() {
+      auto self = shared_from_this();
+      io::async_read(
+          socket_, io::buffer(&length_, sizeof(length_)),
+          [self](boost::system::error_code ec, size_t) {
+            if (ec) return;
+            self->payload_.resize(
+                riak::byte_order::network_to_host_long(self->length_));
+            io::async_read(self->socket_, io::buffer(self->payload_),
+                           [self](boost::system::error_code ec, size_t) {
+                             if (!ec) self->write_frame();
+                           });
+          });
+    }
+
+   private:
+    void write_frame() {
+      auto self = shared_from_this();
+      std::array<io::const_buffer, 2> buffers = {
+          {io::buffer(&length_, sizeof(length_)), io::buffer(payload_)}};
+      io::async_write(socket_, buffers,
+                      [self](boost::system::error_code ec, size_t) {
+                        if (!ec) self->read_frame();
+                      });
+    }
+
+    tcp::socket socket_;
+    uint32_t length_ = 0;
+    std::string payload_;
+  };
+
+  void accept() {
+    auto new_session = std::make_shared<session>(io_service_);
+    acceptor_.async_accept(new_session->socket(),
+                           [this, new_session](boost::system::error_code ec) {
+                             if (ec) return;
+                             new_session->read_frame();
+                             accept();
+                           });
+  }
+
+  io::io_service& io_service_;
+  tcp::acceptor acceptor_;
+};
+
+struct run_result {
+  double requests_per_second;
+  double p50_us;
+  double p99_us;
+  size_t errors;
+};
+
+// Keeps a fixed number of requests in flight, each completion sending the
+// next request, until 'num_requests' were answered.
+class closed_loop_run {
+ public:
+  closed_loop_run(pool_type& pool, size_t num_requests, size_t payload_bytes)
+      : pool_(pool),
+        num_requests_{num_requests},
+        payload_(payload_bytes, 'x'),
+        latencies_us_(num_requests) {}
+
+  run_result run(size_t in_flight) {
+    in_flight = std::min(in_flight, num_requests_);
+    auto start = clock_type::now();
+    sent_ = in_flight;
+    for (size_t i = 0; i < in_flight; ++i) send_one();
+
+    std::unique_lock<std::mutex> lock{done_mutex_};
+    while (!done_) done_condition_.wait(lock);
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+    std::sort(latencies_us_.begin(), latencies_us_.end());
+    return {num_requests_ / elapsed.count(),
+            double(latencies_us_[num_requests_ / 2]),
+            double(latencies_us_[num_requests_ * 99 / 100]), errors_};
+  }
+
+ private:
+  void send_one() {
+    auto start = clock_type::now();
+    pool_.async_send(
+        pool_type::request_type{payload_, deadline_ms},
+        [this, start](std::error_code ec, std::string& response) {
+          auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+              clock_type::now() - start);
+          if (ec || response.size() != payload_.size()) ++errors_;
+          latencies_us_[recorded_++] = static_cast<uint32_t>(latency.count());
+          if (sent_++ < num_requests_) send_one();
+          if (++completed_ == num_requests_) {
+            std::lock_guard<std::mutex> lock{done_mutex_};
+            done_ = true;
+            done_condition_.notify_one();
+          }
+        });
+  }
+
+  pool_type& pool_;
+  const size_t num_requests_;
+  const std::string payload_;
+  std::vector<uint32_t> latencies_us_;
+  std::atomic<size_t> sent_{0};
+  std::atomic<size_t> recorded_{0};
+  std::atomic<size_t> completed_{0};
+  std::atomic<size_t> errors_{0};
+
+  std::mutex done_mutex_;
+  std::condition_variable done_condition_;
+  bool done_ = false;
+};
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t num_requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+  size_t payload_bytes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024;
+  if (num_requests == 0) {
+    std::fprintf(stderr, "usage: %s [requests_per_run] [payload_bytes]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  riak::thread_pool server_threads{2};
+  echo_server server{server_threads.io_service()};
+
+  std::printf("%zu requests of %zu bytes per run\n", num_requests,
+              payload_bytes);
+  std::printf("%11s %12s %10s %10s %7s\n", "connections", "requests/s",
+              "p50 (us)", "p99 (us)", "errors");
+  for (auto num_connections : connection_counts) {
+    riak::thread_pool client_threads;
+    std::unique_ptr<pool_type> pool{new pool_type{
+        client_threads.io_service(), server.endpoints(),
+        riak::connection_options{}
+            .max_connections(num_connections)
+            .pipeline_depth(requests_in_flight_per_connection)}};
+
+    closed_loop_run run{*pool, num_requests, payload_bytes};
+    auto result =
+        run.run(num_connections * requests_in_flight_per_connection);
+    std::printf("%11zu %12.0f %10.0f %10.0f %7zu\n", num_connections,
+                result.requests_per_second, result.p50_us, result.p99_us,
+                result.errors);
+    pool.reset();
+  }
+  return 0;
+}
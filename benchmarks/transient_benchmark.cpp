@@ -0,0 +1,69 @@
+// Measures the cost of locking a transient, as every callback wrapped with
+// transient::wrap does, with 1 to 32 threads locking and unlocking refs to the
+// same transient at once.
+//
+// Usage: transient_benchmark [locks_per_thread]
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "transient.hpp"
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+constexpr size_t thread_counts[] = {1, 2, 4, 8, 16, 32};
+
+struct target {
+  target() : transient{*this} {}
+  std::atomic<uint64_t> calls{0};
+  riak::transient<target> transient;
+};
+
+// Returns the mean time taken by a lock and unlock, in nanoseconds.
+double run(size_t num_threads, size_t locks_per_thread) {
+  target locked_target;
+  std::atomic<bool> start{false};
+  std::atomic<int64_t> total_ns{0};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&] {
+      auto ref = locked_target.transient.ref();
+      while (!start) std::this_thread::yield();
+      auto before = clock_type::now();
+      for (size_t j = 0; j < locks_per_thread; ++j) {
+        if (auto lock = ref.lock()) {
+          lock->calls.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      clock_type::now() - before).count();
+    });
+  }
+  start = true;
+  for (auto& thread : threads) thread.join();
+  return double(total_ns) / (num_threads * locks_per_thread);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t locks_per_thread =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+  if (locks_per_thread == 0) {
+    std::fprintf(stderr, "usage: %s [locks_per_thread]\n", argv[0]);
+    return 1;
+  }
+
+  std::printf("%zu locks per thread\n", locks_per_thread);
+  std::printf("%7s %21s\n", "threads", "lock+unlock mean (ns)");
+  for (auto num_threads : thread_counts) {
+    std::printf("%7zu %21.1f\n", num_threads,
+                run(num_threads, locks_per_thread));
+  }
+  return 0;
+}
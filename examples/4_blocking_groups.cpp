@@ -16,7 +16,7 @@ int main(int argc, char* argv[]) {
   // A blocking group allows you to block until a group of handlers have been
   // called. It starts in a 'pending' state where it allows handlers to be added
   // to the group using either .wrap() or .save(), see the examples below.
-  auto blocking = riak::blocking_group{};
+  riak::blocking_group blocking;
   riak::object object{"example_bucket", "example_key"};
   std::error_code error;
 
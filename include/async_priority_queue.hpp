@@ -0,0 +1,248 @@
+#ifndef RIAKPP_ASYNC_PRIORITY_QUEUE_HPP_
+#define RIAKPP_ASYNC_PRIORITY_QUEUE_HPP_
+
+#include "async_queue.hpp"
+#include "check.hpp"
+#include "unique_function.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace riak {
+
+// An async_queue with several lanes of elements, lane 0 having the highest
+// priority. Each lane is a FIFO bounded by 'max_elements'. A waiting handler
+// takes the next element either in strict priority order or, given one weight
+// per lane, in smooth weighted round-robin order (falling back to the other
+// lanes, in priority order, when the scheduled one is empty).
+//
+// Reserved handlers (see 'async_pop_reserved') only ever take elements of lane
+// 0, so that a burst of low priority elements cannot occupy all of them.
+//
+// Elements are stored in one async_queue per lane, while a separate queue of
+// tokens, one per stored element, matches them with handlers: a handler which
+// gets a token is guaranteed to find an element in some lane.
+template <class Element>
+class async_priority_queue {
+ public:
+  using value_type = Element;
+  using handler_type = unique_function<void(Element)>;
+
+  inline async_priority_queue(size_t num_lanes, size_t max_elements,
+                              size_t max_handlers,
+                              size_t max_reserved_handlers = 0,
+                              std::vector<uint32_t> weights = {});
+
+  async_priority_queue(const async_priority_queue&) = delete;
+  async_priority_queue& operator=(const async_priority_queue&) = delete;
+
+  size_t num_lanes() const { return lanes_.size(); }
+  bool closed() const { return tokens_.closed(); }
+
+  // Number of stored elements, in all lanes; only a snapshot when used
+  // concurrently.
+  size_t size() const { return tokens_.size(); }
+
+  // Blocks while 'lane' is full. Returns false, leaving its arguments
+  // untouched, if the queue is closed.
+  template <class ...Args>
+  inline bool emplace(size_t lane, Args&& ...args);
+
+  // Returns false if 'lane' is full or the queue closed, leaving its arguments
+  // untouched.
+  template <class ...Args>
+  inline bool try_emplace(size_t lane, Args&& ...args);
+
+  // Removes the oldest element buffered in 'lane' and passes it to 'handler'.
+  // Returns false if there is none.
+  template <class Handler>
+  inline bool try_shed(size_t lane, Handler&& handler);
+
+  // Passes the next element to 'handler' straight away, in the same order as
+  // 'async_pop'. Returns false if none is stored.
+  template <class Handler>
+  inline bool try_pop(Handler&& handler);
+
+  // 'tag' identifies the handler to 'cancel'.
+  template <class HandlerConvertible>
+  inline void async_pop(HandlerConvertible&& handler, size_t tag = 0);
+
+  // Destroys the waiting handlers given 'tag' by 'async_pop' and returns how
+  // many there were. Reserved handlers cannot be cancelled.
+  size_t cancel(size_t tag) { return tokens_.cancel(tag); }
+
+  // Like 'async_pop', but the handler only ever gets an element of lane 0.
+  template <class HandlerConvertible>
+  inline void async_pop_reserved(HandlerConvertible&& handler);
+
+  inline void close();
+
+ private:
+  struct token {};
+
+  template <class Handler>
+  struct take_next {
+    void operator()(token) { queue->take(handler); }
+    async_priority_queue* queue;
+    Handler handler;
+  };
+
+  template <class Handler>
+  inline void take(Handler& handler);
+
+  static inline std::vector<size_t> make_schedule(
+      const std::vector<uint32_t>& weights);
+
+  std::vector<std::unique_ptr<async_queue<value_type>>> lanes_;
+  async_queue<token> tokens_;
+  async_queue<value_type> reserved_;
+  const bool has_reserved_;
+
+  // Lanes to try first, in order; empty for strict priority.
+  const std::vector<size_t> schedule_;
+  std::atomic<size_t> next_scheduled_{0};
+};
+
+template <class Element>
+async_priority_queue<Element>::async_priority_queue(
+    size_t num_lanes, size_t max_elements, size_t max_handlers,
+    size_t max_reserved_handlers, std::vector<uint32_t> weights)
+    : tokens_{num_lanes * max_elements, max_handlers},
+      reserved_{0, max_reserved_handlers},
+      has_reserved_{max_reserved_handlers > 0},
+      schedule_{make_schedule(weights)} {
+  RIAKPP_CHECK_GT(num_lanes, 0) << "There must be at least one lane.";
+  RIAKPP_CHECK(weights.empty() || weights.size() == num_lanes)
+      << "There must be one weight per lane.";
+  lanes_.reserve(num_lanes);
+  for (size_t lane = 0; lane < num_lanes; ++lane) {
+    lanes_.emplace_back(new async_queue<value_type>{max_elements, 0});
+  }
+}
+
+template <class Element>
+template <class ...Args>
+bool async_priority_queue<Element>::emplace(size_t lane, Args&& ...args) {
+  RIAKPP_CHECK_LT(lane, lanes_.size());
+  if (lane == 0 && has_reserved_ &&
+      reserved_.try_emplace(std::forward<Args>(args)...)) {
+    return true;
+  }
+  // The element must be stored before its token can be taken.
+  if (!lanes_[lane]->emplace(std::forward<Args>(args)...)) return false;
+  tokens_.emplace();
+  return true;
+}
+
+template <class Element>
+template <class ...Args>
+bool async_priority_queue<Element>::try_emplace(size_t lane, Args&& ...args) {
+  RIAKPP_CHECK_LT(lane, lanes_.size());
+  if (lane == 0 && has_reserved_ &&
+      reserved_.try_emplace(std::forward<Args>(args)...)) {
+    return true;
+  }
+  if (!lanes_[lane]->try_emplace(std::forward<Args>(args)...)) return false;
+  tokens_.emplace();
+  return true;
+}
+
+template <class Element>
+template <class Handler>
+bool async_priority_queue<Element>::try_shed(size_t lane, Handler&& handler) {
+  RIAKPP_CHECK_LT(lane, lanes_.size());
+  // The element's token goes too, unless all tokens are taken (in which case
+  // every buffered element is about to be popped anyway).
+  bool shed = false;
+  tokens_.try_pop([&](token) {
+    shed = lanes_[lane]->try_pop(handler);
+    if (!shed) tokens_.emplace();
+  });
+  return shed;
+}
+
+template <class Element>
+template <class Handler>
+bool async_priority_queue<Element>::try_pop(Handler&& handler) {
+  return tokens_.try_pop([&](token) { take(handler); });
+}
+
+template <class Element>
+template <class HandlerConvertible>
+void async_priority_queue<Element>::async_pop(HandlerConvertible&& handler,
+                                              size_t tag) {
+  using handler_decay = typename std::decay<HandlerConvertible>::type;
+  tokens_.async_pop(take_next<handler_decay>{
+      this, std::forward<HandlerConvertible>(handler)}, tag);
+}
+
+template <class Element>
+template <class HandlerConvertible>
+void async_priority_queue<Element>::async_pop_reserved(
+    HandlerConvertible&& handler) {
+  // A buffered lane 0 element is taken straight away, along with a token.
+  bool taken = false;
+  tokens_.try_pop([&](token) {
+    taken = lanes_[0]->try_pop(handler);
+    if (!taken) tokens_.emplace();
+  });
+  if (!taken) reserved_.async_pop(std::forward<HandlerConvertible>(handler));
+}
+
+template <class Element>
+void async_priority_queue<Element>::close() {
+  tokens_.close();
+  reserved_.close();
+  for (auto& lane : lanes_) lane->close();
+}
+
+template <class Element>
+template <class Handler>
+void async_priority_queue<Element>::take(Handler& handler) {
+  size_t first = 0;
+  if (!schedule_.empty()) {
+    first = schedule_[next_scheduled_++ % schedule_.size()];
+  }
+  internal::backoff wait;
+  while (!closed()) {
+    if (lanes_[first]->try_pop(handler)) return;
+    for (size_t lane = 0; lane < lanes_.size(); ++lane) {
+      if (lane != first && lanes_[lane]->try_pop(handler)) return;
+    }
+    // An element exists for the token, but other handlers took the ones seen
+    // on this pass; a later pass finds the one which arrived meanwhile.
+    wait();
+  }
+}
+
+template <class Element>
+std::vector<size_t> async_priority_queue<Element>::make_schedule(
+    const std::vector<uint32_t>& weights) {
+  // Smooth weighted round-robin: every step, each lane gains its weight and
+  // the lane with the highest credit is picked and loses the total weight.
+  std::vector<size_t> schedule;
+  int64_t total = 0;
+  for (auto weight : weights) {
+    RIAKPP_CHECK_GT(weight, 0) << "Lane weights must be positive.";
+    total += weight;
+  }
+  std::vector<int64_t> credit(weights.size(), 0);
+  for (int64_t step = 0; step < total; ++step) {
+    size_t best = 0;
+    for (size_t lane = 0; lane < weights.size(); ++lane) {
+      credit[lane] += weights[lane];
+      if (credit[lane] > credit[best]) best = lane;
+    }
+    credit[best] -= total;
+    schedule.push_back(best);
+  }
+  return schedule;
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_ASYNC_PRIORITY_QUEUE_HPP_
@@ -2,95 +2,460 @@
 #define RIAKPP_ASYNC_QUEUE_HPP_
 
 #include "check.hpp"
+#include "unique_function.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <mutex>
-#include <queue>
-#include <stack>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace riak {
 
+namespace internal {
+constexpr size_t cache_line_size = 64;
+
+// Waits for another thread to finish an operation it started: yields a few
+// times, then sleeps for doubling periods of up to a millisecond, so that a
+// thread preempted half-way gets the CPU back instead of its waiters spinning.
+class backoff {
+ public:
+  void operator()() {
+    if (num_yields_ < max_yields) {
+      ++num_yields_;
+      std::this_thread::yield();
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds{sleep_us_});
+    if (sleep_us_ < max_sleep_us) sleep_us_ *= 2;
+  }
+
+ private:
+  static constexpr uint32_t max_yields = 16;
+  static constexpr uint32_t max_sleep_us = 1000;
+
+  uint32_t num_yields_ = 0;
+  uint32_t sleep_us_ = 1;
+};
+
+// A bounded multi-producer multi-consumer FIFO. Every push and pop claims a
+// ticket and then waits for the matching cell, so callers must guarantee that
+// a pop is only started once a push has been committed for it and that no more
+// than 'capacity' elements are ever committed at once (async_queue does both).
+// The waits then only last while another thread is half-way through an
+// operation on the same cell; if that thread is preempted, they back off until
+// it runs again, so the ring is not lock-free.
+template <class Element>
+class ticket_ring {
+ public:
+  inline explicit ticket_ring(size_t min_capacity);
+  inline ~ticket_ring();
+
+  ticket_ring(const ticket_ring&) = delete;
+  ticket_ring& operator=(const ticket_ring&) = delete;
+
+  template <class ...Args>
+  inline void push(Args&& ...args);
+  inline Element pop();
+
+ private:
+  struct cell {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(Element), alignof(Element)>::type
+        storage;
+  };
+
+  Element* get(cell& c) { return reinterpret_cast<Element*>(&c.storage); }
+
+  const size_t mask_;
+  const std::unique_ptr<cell[]> cells_;
+
+  char before_push_padding_[cache_line_size];
+  std::atomic<size_t> push_ticket_{0};
+  char push_padding_[cache_line_size - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> pop_ticket_{0};
+  char pop_padding_[cache_line_size - sizeof(std::atomic<size_t>)];
+};
+
+// A bounded LIFO of handlers stored in preallocated slots. Both the idle list
+// and the free list are intrusive stacks threaded through the slots; their
+// heads carry a version tag to make compare-and-swap safe from ABA. Like
+// ticket_ring, pops wait (backing off) for a matching push which is known to be
+// coming.
+template <class Handler>
+class handler_stack {
+ public:
+  inline explicit handler_stack(size_t capacity);
+
+  handler_stack(const handler_stack&) = delete;
+  handler_stack& operator=(const handler_stack&) = delete;
+
+  inline void push(Handler handler);
+  inline Handler pop();
+
+ private:
+  static constexpr uint32_t no_slot = 0xffffffff;
+
+  struct slot {
+    Handler handler;
+    std::atomic<uint32_t> next{no_slot};
+  };
+
+  inline uint32_t acquire_slot(std::atomic<uint64_t>& head);
+  inline void release_slot(std::atomic<uint64_t>& head, uint32_t index);
+
+  const std::unique_ptr<slot[]> slots_;
+
+  char before_idle_padding_[cache_line_size];
+  std::atomic<uint64_t> idle_head_{no_slot};
+  char idle_padding_[cache_line_size - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> free_head_{no_slot};
+  char free_padding_[cache_line_size - sizeof(std::atomic<uint64_t>)];
+};
+}  // namespace internal
+
+// Matches elements with handlers: each element is passed to exactly one
+// handler, elements are consumed in FIFO order and waiting handlers are served
+// in LIFO order (so the most recently idle connection is reused first).
+//
+// Neither 'emplace' nor 'async_pop' takes a lock unless the queue is at its
+// limit, in which case they block until there is room (or the queue is
+// closed). A single signed counter decides whether an operation stores its
+// argument or takes the oldest element / newest handler; the storage itself is
+// a ticket_ring and a handler_stack. Their waits make it blocking rather than
+// lock-free: an operation may wait for another thread to finish publishing the
+// element or handler it claimed.
 template <class Element>
 class async_queue {
  public:
   using value_type = Element;
-  using handler_type = std::function<void(Element)>;
+  using handler_type = unique_function<void(Element)>;
+
+  inline async_queue(size_t max_elements, size_t max_handlers);
 
-  inline async_queue(size_t max_element, size_t max_handlers);
+  async_queue(const async_queue&) = delete;
+  async_queue& operator=(const async_queue&) = delete;
 
-  bool closed() const { return closed_; }
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
 
+  // Number of stored elements; only a snapshot when used concurrently.
+  size_t size() const {
+    auto balance = balance_.load(std::memory_order_relaxed);
+    return balance > 0 ? static_cast<size_t>(balance) : 0;
+  }
+
+  // Returns false, leaving its arguments untouched, if the queue is closed
+  // (possibly while blocked).
   template <class ...Args>
-  inline void emplace(Args&& ...args);
+  inline bool emplace(Args&& ...args);
 
+  // 'tag' identifies the handler to 'cancel'.
   template <class HandlerConvertible>
-  inline void async_pop(HandlerConvertible&& handler);
+  inline void async_pop(HandlerConvertible&& handler, size_t tag = 0);
+
+  // Destroys the stored handlers which were given 'tag', and returns how many
+  // there were; the others keep their order. Handlers already matched with an
+  // element are not affected, even if they have not run yet.
+  inline size_t cancel(size_t tag);
+
+  // Non-blocking variants: 'try_emplace' returns false if the queue is full or
+  // closed, leaving its arguments untouched; 'try_pop' calls 'handler' with the
+  // oldest element if there is one and returns false otherwise, without ever
+  // storing the handler.
+  template <class ...Args>
+  inline bool try_emplace(Args&& ...args);
+
+  template <class Handler>
+  inline bool try_pop(Handler&& handler);
 
   inline void close();
 
  private:
-  // TODO(cristicbz): Use ring buffer instead of heavyweight std::queue.
-  std::queue<value_type> elements_;
-  std::stack<handler_type> handlers_;
-
-  std::mutex queues_mutex_;
-  std::condition_variable elements_full_;
-  std::condition_variable handlers_full_;
-  const size_t max_elements_, max_handlers_;
-  bool closed_;
+  // Changes 'balance_' by 'delta' and returns its previous value, blocking
+  // while the result would exceed 'limit' in absolute value. Returns false if
+  // the queue was closed instead.
+  inline bool claim(int64_t delta, int64_t limit, int64_t& previous);
+
+  // Like 'claim', but fails instead of blocking.
+  inline bool try_claim(int64_t delta, int64_t limit, int64_t& previous);
+
+  inline void notify_waiters();
+
+  struct tagged_handler {
+    handler_type handler;
+    size_t tag;
+  };
+
+  const int64_t max_elements_, max_handlers_;
+
+  // Positive: number of stored elements; negative: number of stored handlers.
+  std::atomic<int64_t> balance_{0};
+  std::atomic<bool> closed_{false};
+  std::atomic<uint32_t> num_waiters_{0};
+
+  internal::ticket_ring<value_type> elements_;
+  internal::handler_stack<tagged_handler> handlers_;
+
+  std::mutex waiters_mutex_;
+  std::condition_variable has_room_;
+  std::mutex cancel_mutex_;
 };
 
 template <class Element>
-async_queue<Element>::async_queue(size_t max_element, size_t max_handlers)
-    : max_elements_{max_element}, max_handlers_{max_handlers}, closed_{false} {
+async_queue<Element>::async_queue(size_t max_elements, size_t max_handlers)
+    : max_elements_(max_elements),
+      max_handlers_(max_handlers),
+      elements_{max_elements},
+      handlers_{max_handlers} {
   RIAKPP_CHECK_GE(max_elements_, 0);
   RIAKPP_CHECK_GE(max_handlers_, 0);
 }
 
 template <class Element>
 template <class ...Args>
-inline void async_queue<Element>::emplace(Args&& ...args) {
-  // TODO(cristicbz): Remove duplication.
-  std::unique_lock<std::mutex> lock{queues_mutex_};
-  if (closed_) return;
-  if (handlers_.empty()) {
-    while (elements_.size() == max_elements_) elements_full_.wait(lock);
-    elements_.emplace(std::forward<Args>(args)...);
+bool async_queue<Element>::emplace(Args&& ...args) {
+  int64_t previous;
+  if (!claim(1, max_elements_, previous)) return false;
+  if (previous >= 0) {
+    elements_.push(std::forward<Args>(args)...);
   } else {
-    bool should_signal = handlers_.size() == max_handlers_;
-    handler_type handler = std::move(handlers_.top());
-    handlers_.pop();
-    lock.unlock();
-    if (should_signal) handlers_full_.notify_one();
+    handler_type handler = std::move(handlers_.pop().handler);
     handler(value_type{std::forward<Args>(args)...});
   }
+  return true;
+}
+
+template <class Element>
+template <class ...Args>
+bool async_queue<Element>::try_emplace(Args&& ...args) {
+  int64_t previous;
+  if (!try_claim(1, max_elements_, previous)) return false;
+  if (previous >= 0) {
+    elements_.push(std::forward<Args>(args)...);
+  } else {
+    handler_type handler = std::move(handlers_.pop().handler);
+    handler(value_type{std::forward<Args>(args)...});
+  }
+  return true;
 }
 
 template <class Element>
 template <class HandlerConvertible>
-void async_queue<Element>::async_pop(HandlerConvertible&& handler) {
-  std::unique_lock<std::mutex> lock{queues_mutex_};
-  if (closed_) return;
-  if (elements_.empty()) {
-    while (handlers_.size() == max_handlers_) handlers_full_.wait(lock);
-    handlers_.emplace(std::move(handler));
+void async_queue<Element>::async_pop(HandlerConvertible&& handler,
+                                     size_t tag) {
+  int64_t previous;
+  if (!claim(-1, max_handlers_, previous)) return;
+  if (previous <= 0) {
+    handlers_.push(tagged_handler{
+        handler_type{std::forward<HandlerConvertible>(handler)}, tag});
   } else {
-    bool should_signal = elements_.size() == max_elements_;
-    value_type element = std::move(elements_.front());
-    elements_.pop();
-    lock.unlock();
-    if (should_signal) elements_full_.notify_one();
-    handler(std::move(element));
+    handler(elements_.pop());
   }
 }
 
+template <class Element>
+size_t async_queue<Element>::cancel(size_t tag) {
+  // Takes out every stored handler, newest first, as arriving elements would,
+  // then stores back the ones to keep, oldest first; elements which arrived
+  // meanwhile go to those. Cancellations take turns, so that none misses the
+  // handlers another one has taken out.
+  std::lock_guard<std::mutex> lock{cancel_mutex_};
+  std::vector<tagged_handler> taken;
+  int64_t previous;
+  while (try_claim(1, 0, previous)) taken.emplace_back(handlers_.pop());
+
+  size_t num_cancelled = 0;
+  for (auto stored = taken.rbegin(); stored != taken.rend(); ++stored) {
+    if (stored->tag == tag) {
+      ++num_cancelled;
+    } else {
+      async_pop(std::move(stored->handler), stored->tag);
+    }
+  }
+  return num_cancelled;
+}
+
+template <class Element>
+template <class Handler>
+bool async_queue<Element>::try_pop(Handler&& handler) {
+  // Only elements are taken: the limit of zero refuses to store a handler.
+  int64_t previous;
+  if (!try_claim(-1, 0, previous)) return false;
+  handler(elements_.pop());
+  return true;
+}
+
 template <class Element>
 void async_queue<Element>::close() {
-  std::lock_guard<std::mutex> lock{queues_mutex_};
-  closed_ = true;
+  closed_.store(true, std::memory_order_release);
+  std::lock_guard<std::mutex> lock{waiters_mutex_};
+  has_room_.notify_all();
+}
+
+template <class Element>
+bool async_queue<Element>::claim(int64_t delta, int64_t limit,
+                                 int64_t& previous) {
+  if (closed()) return false;
+  previous = balance_.load();
+  while (true) {
+    if (previous * delta < limit) {
+      if (balance_.compare_exchange_weak(previous, previous + delta)) break;
+      continue;
+    }
+
+    // Slow path: the counter and 'num_waiters_' are sequentially consistent,
+    // so either this thread sees the room made by another, or the other thread
+    // sees this one waiting and notifies it under the mutex.
+    std::unique_lock<std::mutex> lock{waiters_mutex_};
+    ++num_waiters_;
+    has_room_.wait(lock, [&] {
+      previous = balance_.load();
+      return closed() || previous * delta < limit;
+    });
+    --num_waiters_;
+    if (closed()) return false;
+  }
+
+  // Taking from the other side makes room for whoever is blocked on it.
+  if (previous * delta < 0) notify_waiters();
+  return true;
+}
+
+template <class Element>
+bool async_queue<Element>::try_claim(int64_t delta, int64_t limit,
+                                     int64_t& previous) {
+  if (closed()) return false;
+  previous = balance_.load();
+  do {
+    if (previous * delta >= limit) return false;
+  } while (!balance_.compare_exchange_weak(previous, previous + delta));
+
+  if (previous * delta < 0) notify_waiters();
+  return true;
+}
+
+template <class Element>
+void async_queue<Element>::notify_waiters() {
+  if (num_waiters_.load() == 0) return;
+  std::lock_guard<std::mutex> lock{waiters_mutex_};
+  has_room_.notify_all();
+}
+
+namespace internal {
+
+template <class Element>
+ticket_ring<Element>::ticket_ring(size_t min_capacity)
+    : mask_{[min_capacity] {
+        size_t capacity = 1;
+        while (capacity < min_capacity) capacity <<= 1;
+        return capacity - 1;
+      }()},
+      cells_{new cell[mask_ + 1]} {
+  for (size_t i = 0; i <= mask_; ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <class Element>
+ticket_ring<Element>::~ticket_ring() {
+  auto pop_ticket = pop_ticket_.load(std::memory_order_relaxed);
+  auto push_ticket = push_ticket_.load(std::memory_order_relaxed);
+  for (auto ticket = pop_ticket; ticket != push_ticket; ++ticket) {
+    get(cells_[ticket & mask_])->~Element();
+  }
+}
+
+template <class Element>
+template <class ...Args>
+void ticket_ring<Element>::push(Args&& ...args) {
+  auto ticket = push_ticket_.fetch_add(1, std::memory_order_relaxed);
+  auto& c = cells_[ticket & mask_];
+  backoff wait;
+  while (c.sequence.load(std::memory_order_acquire) != ticket) wait();
+  new (&c.storage) Element(std::forward<Args>(args)...);
+  c.sequence.store(ticket + 1, std::memory_order_release);
+}
+
+template <class Element>
+Element ticket_ring<Element>::pop() {
+  auto ticket = pop_ticket_.fetch_add(1, std::memory_order_relaxed);
+  auto& c = cells_[ticket & mask_];
+  backoff wait;
+  while (c.sequence.load(std::memory_order_acquire) != ticket + 1) wait();
+  Element element(std::move(*get(c)));
+  get(c)->~Element();
+  c.sequence.store(ticket + mask_ + 1, std::memory_order_release);
+  return element;
+}
+
+template <class Handler>
+constexpr uint32_t handler_stack<Handler>::no_slot;
+
+template <class Handler>
+handler_stack<Handler>::handler_stack(size_t capacity)
+    : slots_{new slot[capacity > 0 ? capacity : 1]} {
+  RIAKPP_CHECK_LT(capacity, no_slot) << "Too many handlers.";
+  for (uint32_t i = 0; i < capacity; ++i) release_slot(free_head_, i);
+}
+
+template <class Handler>
+void handler_stack<Handler>::push(Handler handler) {
+  uint32_t index;
+  backoff wait;
+  while ((index = acquire_slot(free_head_)) == no_slot) wait();
+  slots_[index].handler = std::move(handler);
+  release_slot(idle_head_, index);
+}
+
+template <class Handler>
+Handler handler_stack<Handler>::pop() {
+  uint32_t index;
+  backoff wait;
+  while ((index = acquire_slot(idle_head_)) == no_slot) wait();
+  Handler handler = std::move(slots_[index].handler);
+  release_slot(free_head_, index);
+  return handler;
+}
+
+template <class Handler>
+uint32_t handler_stack<Handler>::acquire_slot(std::atomic<uint64_t>& head) {
+  auto old_head = head.load(std::memory_order_acquire);
+  while (true) {
+    auto index = static_cast<uint32_t>(old_head);
+    if (index == no_slot) return no_slot;
+    // A stale 'next' is harmless: the slot must have been popped since, which
+    // bumped the tag and fails the exchange.
+    auto next = slots_[index].next.load(std::memory_order_relaxed);
+    auto new_head = ((old_head >> 32) + 1) << 32 | next;
+    if (head.compare_exchange_weak(old_head, new_head,
+                                   std::memory_order_acquire)) {
+      return index;
+    }
+  }
+}
+
+template <class Handler>
+void handler_stack<Handler>::release_slot(std::atomic<uint64_t>& head,
+                                          uint32_t index) {
+  auto old_head = head.load(std::memory_order_relaxed);
+  uint64_t new_head;
+  do {
+    slots_[index].next.store(static_cast<uint32_t>(old_head),
+                             std::memory_order_relaxed);
+    new_head = ((old_head >> 32) + 1) << 32 | index;
+  } while (!head.compare_exchange_weak(old_head, new_head,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed));
 }
 
+}  // namespace internal
 }  // namespace riak
 
 #endif  // #ifndef RIAKPP_ASYNC_QUEUE_HPP_
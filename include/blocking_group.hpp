@@ -5,20 +5,86 @@
 #include "completion_group.hpp"
 #include "store_handler.hpp"
 
-#include <condition_variable>
-#include <memory>
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace riak {
+namespace internal {
+// Blocks while '*word' equals 'value', or returns spuriously.
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t value) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+          value, nullptr, nullptr, 0);
+#else
+  if (word.load() == value) {
+    std::this_thread::sleep_for(std::chrono::microseconds{100});
+  }
+#endif
+}
+
+// Wakes every thread blocked in futex_wait on 'word'. Only the address is
+// used, so 'word' may have been destroyed already.
+inline void futex_wake_all(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+          INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+}  // namespace internal
+
+// Wraps functions like a completion_group, but wait() blocks until every
+// wrapped function is destroyed instead of calling a handler. The count lives
+// in the group itself, so a blocking_group allocates nothing; since wrapped
+// functions point at it, the group cannot be moved.
 class blocking_group {
  public:
+  class ref_type {
+   public:
+    ref_type(const ref_type& other) : ref_type{other.count_} {}
+    ref_type(ref_type&& other) : count_{other.count_} {
+      other.count_ = nullptr;
+    }
+    ~ref_type() { if (count_) release(*count_); }
+
+    ref_type& operator=(ref_type other) {
+      std::swap(count_, other.count_);
+      return *this;
+    }
+
+   private:
+    friend class blocking_group;
+
+    explicit ref_type(std::atomic<uint32_t>* count) : count_{count} {
+      if (count_) count_->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void release(std::atomic<uint32_t>& count) {
+      if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        internal::futex_wake_all(count);
+      }
+    }
+
+    std::atomic<uint32_t>* count_;
+  };
+
   blocking_group() = default;
 
   blocking_group(const blocking_group&) = delete;
-  blocking_group(blocking_group&&) = default;
+  blocking_group(blocking_group&&) = delete;
 
   blocking_group& operator=(const blocking_group&) = delete;
-  blocking_group& operator=(blocking_group&&) = default;
+  blocking_group& operator=(blocking_group&&) = delete;
 
   inline ~blocking_group();
 
@@ -26,81 +92,56 @@ class blocking_group {
   inline void reset();
   inline void wait_and_reset();
 
-  bool pending() const { return group_.pending(); }
+  bool pending() const { return !active_; }
 
  private:
-  class latch_type;
-  struct handler_type {
-    inline handler_type();
-    inline void operator()();
-
-    std::shared_ptr<latch_type> latch;
-
-    ~handler_type() {}  // This definition is required to avoid a bug in g++-4.8
-  };
-
   static inline void do_nothing() {}
 
  public:
   template <typename Function>
   auto wrap(Function&& function)
-      -> decltype(basic_completion_group<handler_type>{}.wrap(
-          std::forward<Function>(function))) {
-    return group_.wrap(std::forward<Function>(function));
+      -> completion_wrapper<ref_type, typename std::decay<Function>::type> {
+    return {ref(), std::forward<Function>(function)};
   }
 
-  auto wrap_notify() -> decltype(basic_completion_group<handler_type>{}.wrap(
-      do_nothing)) {
-    return group_.wrap(do_nothing);
+  auto wrap_notify() -> completion_wrapper<ref_type, void (*)()> {
+    return {ref(), &do_nothing};
   }
 
   template <typename... Args>
-  auto save(Args&&... args)
-      -> decltype(basic_completion_group<handler_type>{}.wrap(
-          make_store_handler(std::forward<Args>(args)...))) {
-    return group_.wrap(make_store_handler(std::forward<Args>(args)...));
+  auto save(Args&&... args) -> completion_wrapper<
+      ref_type, decltype(make_store_handler(std::forward<Args>(args)...))> {
+    return {ref(), make_store_handler(std::forward<Args>(args)...)};
   }
 
  private:
-  basic_completion_group<handler_type> group_;
-};
-
-class blocking_group::latch_type {
- public:
-  void trigger() {
-    std::unique_lock<std::mutex> lock{mutex_};
-    triggered_ = true;
-    condition_.notify_all();
-    lock.unlock();
-  }
+  inline ref_type ref();
 
-  void wait() {
-    std::unique_lock<std::mutex> lock{mutex_};
-    while (!triggered_) condition_.wait(lock);
-  }
-
- private:
-  std::mutex mutex_;
-  std::condition_variable condition_;
-  bool triggered_{false};
+  // The number of live wrapped functions, plus one for the group until it is
+  // waited on.
+  std::atomic<uint32_t> count_{1};
+  bool active_ = true;
 };
 
 blocking_group::~blocking_group() {
-  RIAKPP_CHECK(group_.pending())
+  RIAKPP_CHECK(pending())
     << "blocking_group destroyed before a call to wait()";
 }
 
 void blocking_group::wait() {
-  if (!group_.pending()) {
-    auto latch = group_.handler().latch;
-    group_.notify();
-    latch->wait();
+  if (!active_) return;
+  active_ = false;
+  ref_type::release(count_);
+  uint32_t count;
+  while ((count = count_.load(std::memory_order_acquire)) != 0) {
+    internal::futex_wait(count_, count);
   }
 }
 
 void blocking_group::reset() {
-  RIAKPP_CHECK(group_.pending()) << "Called reset without waiting on group.";
-  group_.reset();
+  RIAKPP_CHECK(pending()) << "Called reset without waiting on group.";
+  active_ = true;
+  count_ = 1;
 }
 
 void blocking_group::wait_and_reset() {
@@ -108,10 +149,10 @@ void blocking_group::wait_and_reset() {
   reset();
 }
 
-blocking_group::handler_type::handler_type()
-    : latch{std::make_shared<latch_type>()} {}
-
-void blocking_group::handler_type::operator()() { latch->trigger(); }
+auto blocking_group::ref() -> ref_type {
+  // Functions wrapped after wait() do not count.
+  return ref_type{active_ ? &count_ : nullptr};
+}
 
 }  // namespace riak
 
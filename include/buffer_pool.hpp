@@ -0,0 +1,72 @@
+#ifndef RIAKPP_BUFFER_POOL_HPP_
+#define RIAKPP_BUFFER_POOL_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace riak {
+
+// A thread-safe pool of reusable string buffers, grouped in power-of-two size
+// classes. Buffers acquired from the pool are plain std::strings; giving them
+// back with release() keeps their memory around for the next acquire() of a
+// similar size.
+//
+// A pool may be split into arenas, each with an equal share of the budget and
+// its own locks. Callers name the arena explicitly: a buffer should go back
+// to the arena it came from, so that code running on different cores (or NUMA
+// nodes) neither contends on the same locks nor reuses each other's memory.
+class buffer_pool {
+ public:
+  static constexpr size_t min_class_size = 64;
+  static constexpr size_t num_classes = 15;  // Up to 1MiB.
+  static constexpr size_t default_max_pooled_bytes = 4 << 20;
+
+  explicit buffer_pool(size_t max_pooled_bytes = default_max_pooled_bytes,
+                       size_t num_arenas = 1);
+
+  buffer_pool(const buffer_pool&) = delete;
+  buffer_pool& operator=(const buffer_pool&) = delete;
+
+  // Returns an empty buffer with a capacity of at least 'min_capacity', taken
+  // from the given arena if it has one.
+  std::string acquire(size_t min_capacity, size_t arena = 0);
+
+  // Returns a buffer to the given arena. Buffers which do not fit any size
+  // class, or whose class is already full, are simply deallocated.
+  void release(std::string buffer, size_t arena = 0);
+
+  // Number of acquire() calls which did, respectively did not, allocate.
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+  // Arena indices are taken modulo this.
+  size_t num_arenas() const { return num_arenas_; }
+
+ private:
+  struct size_class {
+    std::mutex mutex;
+    std::vector<std::string> buffers;
+    size_t max_buffers = 0;
+  };
+
+  using size_classes = std::array<size_class, num_classes>;
+
+  size_classes& arena_at(size_t arena) {
+    return arenas_[num_arenas_ == 1 ? 0 : arena % num_arenas_];
+  }
+
+  const size_t num_arenas_;
+  const std::unique_ptr<size_classes[]> arenas_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_BUFFER_POOL_HPP_
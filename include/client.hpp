@@ -1,13 +1,18 @@
 #ifndef RIAKPP_CLIENT_HPP_
 #define RIAKPP_CLIENT_HPP_
 
+#include "buffer_pool.hpp"
 #include "check.hpp"
 #include "connection_options.hpp"
+#include "endpoint_vector.hpp"
+#include "load_balancer.hpp"
 #include "object.hpp"
 #include "riak_kv.pb.h"
 #include "thread_pool.hpp"
+#include "unique_function.hpp"
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <system_error>
@@ -21,7 +26,9 @@ class io_service;
 namespace riak {
 
 template <class Connection>
-class connection_pool;
+class sharded_cluster;
+
+class completion_executor;
 
 class length_framed_connection;
 
@@ -45,6 +52,29 @@ class client {
          sibling_resolver resolver = &pass_through_resolver,
          connection_options options = connection_options{});
 
+  // Connects to the given endpoints rather than resolving a hostname, e.g. to
+  // a co-located node over a Unix domain socket:
+  //   riak::client client{riak::endpoint_vector{riak::local_endpoint(path)}};
+  explicit client(endpoint_vector endpoints,
+                  sibling_resolver resolver = &pass_through_resolver,
+                  connection_options options = connection_options{});
+
+  client(boost::asio::io_service& io_service, endpoint_vector endpoints,
+         sibling_resolver resolver = &pass_through_resolver,
+         connection_options options = connection_options{});
+
+  // Spreads requests across several nodes, each with a connection pool of its
+  // own, as chosen by the 'balancing' option:
+  //   riak::client client{std::vector<riak::node_address>{
+  //       {"riak1.example.com", 8087}, {"riak2.example.com", 8087}}};
+  explicit client(std::vector<node_address> nodes,
+                  sibling_resolver resolver = &pass_through_resolver,
+                  connection_options options = connection_options{});
+
+  client(boost::asio::io_service& io_service, std::vector<node_address> nodes,
+         sibling_resolver resolver = &pass_through_resolver,
+         connection_options options = connection_options{});
+
   client(client&& rhs) = default;
   client& operator=(client&& rhs) = default;
 
@@ -56,39 +86,126 @@ class client {
   void run_managed();
   void stop_managed();
 
+  // The pool request and response payloads are recycled through; its hit and
+  // miss counters can be used to size it (see max_pooled_buffer_bytes).
+  const buffer_pool& buffers() const;
+
+  // Serialized bytes of the requests sent but not yet answered; see the
+  // 'max_buffered_bytes' option.
+  size_t buffered_bytes() const;
+
+  // Calls 'handler' once the nodes' addresses are resolved and, with the
+  // 'eager_connect' option, their connections tried to connect. It gets an
+  // error only if no node is ready.
+  void async_wait_ready(unique_function<void(std::error_code)> handler) const;
+
+  // Number of times a node's endpoint was ejected after failures or slow
+  // responses, respectively readmitted after its backoff; summed over nodes.
+  uint64_t num_ejections() const;
+  uint64_t num_readmissions() const;
+
+  // Number of duplicate fetches sent because of the 'hedge_*' options.
+  uint64_t num_hedged_requests() const;
+
+  // With the 'num_completion_threads' or 'completion_io_service' options: the
+  // number of response handlers waiting to run, respectively the most that
+  // ever waited at once. Always zero otherwise.
+  size_t completion_queue_depth() const;
+  size_t max_completion_queue_depth() const;
+
+  // Every request takes an optional priority, from 0 (the highest) to the
+  // 'num_priorities' option minus one; by default the 'default_priority'
+  // option is used.
   template <class Handler>
-  void async_fetch(std::string bucket, std::string key, Handler handler) const;
+  void async_fetch(std::string bucket, std::string key, Handler handler,
+                   size_t priority = use_default_priority) const;
 
   template <class Handler>
-  void async_fetch(riak::object object, Handler handler) const;
+  void async_fetch(riak::object object, Handler handler,
+                   size_t priority = use_default_priority) const;
 
   template <class Handler>
   void async_store(std::string bucket, std::string key, std::string value,
-             Handler handler) const;
+                   Handler handler,
+                   size_t priority = use_default_priority) const;
+
+  template <class Handler>
+  void async_store(riak::object object, Handler handler,
+                   size_t priority = use_default_priority) const;
+
+  template <class Handler>
+  void async_remove(std::string bucket, std::string key, Handler handler,
+                    size_t priority = use_default_priority) const;
+
+  template <class Handler>
+  void async_remove(riak::object object, Handler handler,
+                    size_t priority = use_default_priority) const;
+
+  // Variants of the above which never block and ignore the 'on_overflow'
+  // option: if the request buffer is full they return false straight away and
+  // the handler is never called.
+  template <class Handler>
+  bool try_async_fetch(std::string bucket, std::string key, Handler handler,
+                       size_t priority = use_default_priority) const;
+
+  template <class Handler>
+  bool try_async_fetch(riak::object object, Handler handler,
+                       size_t priority = use_default_priority) const;
 
   template <class Handler>
-  void async_store(riak::object object, Handler handler) const;
+  bool try_async_store(std::string bucket, std::string key, std::string value,
+                       Handler handler,
+                       size_t priority = use_default_priority) const;
 
   template <class Handler>
-  void async_remove(std::string bucket, std::string key, Handler handler) const;
+  bool try_async_store(riak::object object, Handler handler,
+                       size_t priority = use_default_priority) const;
 
   template <class Handler>
-  void async_remove(riak::object object, Handler handler) const;
+  bool try_async_remove(std::string bucket, std::string key, Handler handler,
+                        size_t priority = use_default_priority) const;
+
+  template <class Handler>
+  bool try_async_remove(riak::object object, Handler handler,
+                        size_t priority = use_default_priority) const;
 
   static store_resolved_sibling pass_through_resolver(riak::object& conflicted);
 
  private:
-  using connection = connection_pool<length_framed_connection>;
+  using connection = sharded_cluster<length_framed_connection>;
+
+  // With 'try_only' the request is dropped and false is returned if the
+  // request buffer is full.
+  bool send(pbc::RpbMessageCode code, const google::protobuf::Message& message,
+            unique_function<void(std::error_code, std::string&)> handler,
+            bool try_only, size_t priority) const;
+
+  template <class Handler>
+  bool fetch(std::string bucket, std::string key, Handler handler,
+             bool try_only, size_t priority) const;
 
-  void send(pbc::RpbMessageCode code, const google::protobuf::Message& message,
-            std::function<void(std::error_code, std::string&)> handler) const;
+  template <class Handler>
+  bool store(std::string bucket, std::string key, std::string value,
+             Handler handler, bool try_only, size_t priority) const;
+
+  template <class Handler>
+  bool store(riak::object object, Handler handler, bool try_only,
+             size_t priority) const;
+
+  template <class Handler>
+  bool remove(std::string bucket, std::string key, Handler handler,
+              bool try_only, size_t priority) const;
+
+  template <class Handler>
+  bool remove(riak::object object, Handler handler, bool try_only,
+              size_t priority) const;
 
   static void parse(pbc::RpbMessageCode code, const std::string& serialized,
                     google::protobuf::Message& message, std::error_code& error);
 
   template <class Handler>
   void fetch_wrapper(Handler& handler, std::string& bucket, std::string& key,
-                     std::error_code error,
+                     size_t priority, std::error_code error,
                      const std::string& serialized) const;
 
   template <class Handler>
@@ -105,6 +222,7 @@ class client {
                              const std::string& serialized);
 
   const std::unique_ptr<thread_pool> threads_;
+  const std::unique_ptr<completion_executor> completions_;
   const std::unique_ptr<connection> connection_;
   boost::asio::io_service* const io_service_{nullptr};
   const sibling_resolver resolver_;
@@ -118,7 +236,88 @@ boost::asio::io_service& client::io_service() const {
 
 template <class Handler>
 void client::async_fetch(std::string bucket, std::string key,
-                         Handler handler) const {
+                         Handler handler, size_t priority) const {
+  fetch(std::move(bucket), std::move(key), std::move(handler), false,
+        priority);
+}
+
+template <class Handler>
+void client::async_fetch(riak::object object, Handler handler,
+                         size_t priority) const {
+  async_fetch(std::move(object.bucket_), std::move(object.key_),
+              std::move(handler), priority);
+}
+
+template <class Handler>
+void client::async_store(std::string bucket, std::string key, std::string value,
+                         Handler handler, size_t priority) const {
+  store(std::move(bucket), std::move(key), std::move(value),
+        std::move(handler), false, priority);
+}
+
+template <class Handler>
+void client::async_store(riak::object object, Handler handler,
+                         size_t priority) const {
+  store(std::move(object), std::move(handler), false, priority);
+}
+
+template <class Handler>
+void client::async_remove(std::string bucket, std::string key,
+                          Handler handler, size_t priority) const {
+  remove(std::move(bucket), std::move(key), std::move(handler), false,
+         priority);
+}
+
+template <class Handler>
+void client::async_remove(riak::object object, Handler handler,
+                          size_t priority) const {
+  remove(std::move(object), std::move(handler), false, priority);
+}
+
+template <class Handler>
+bool client::try_async_fetch(std::string bucket, std::string key,
+                             Handler handler, size_t priority) const {
+  return fetch(std::move(bucket), std::move(key), std::move(handler), true,
+               priority);
+}
+
+template <class Handler>
+bool client::try_async_fetch(riak::object object, Handler handler,
+                             size_t priority) const {
+  return try_async_fetch(std::move(object.bucket_), std::move(object.key_),
+                         std::move(handler), priority);
+}
+
+template <class Handler>
+bool client::try_async_store(std::string bucket, std::string key,
+                             std::string value, Handler handler,
+                             size_t priority) const {
+  return store(std::move(bucket), std::move(key), std::move(value),
+               std::move(handler), true, priority);
+}
+
+template <class Handler>
+bool client::try_async_store(riak::object object, Handler handler,
+                             size_t priority) const {
+  return store(std::move(object), std::move(handler), true, priority);
+}
+
+template <class Handler>
+bool client::try_async_remove(std::string bucket, std::string key,
+                              Handler handler, size_t priority) const {
+  return remove(std::move(bucket), std::move(key), std::move(handler), true,
+                priority);
+}
+
+template <class Handler>
+bool client::try_async_remove(riak::object object, Handler handler,
+                              size_t priority) const {
+  return remove(std::move(object), std::move(handler), true, priority);
+}
+
+template <class Handler>
+bool client::fetch(std::string bucket, std::string key, Handler handler,
+                   bool try_only, size_t priority) const {
   namespace ph = std::placeholders;
   pbc::RpbGetReq request;
   // TODO(cristicbz): These copies can be removed by reusing the strings after
@@ -126,33 +325,31 @@ void client::async_fetch(std::string bucket, std::string key,
   *request.mutable_bucket() = bucket;
   *request.mutable_key() = key;
   request.set_deletedvclock(true);
-  request.set_timeout(deadline_ms_);
 
-  send(pbc::RpbMessageCode::GET_REQ, request,
-       std::bind(&client::fetch_wrapper<Handler>, this, std::move(handler),
-                 std::move(bucket), std::move(key), ph::_1, ph::_2));
+  return send(pbc::RpbMessageCode::GET_REQ, request,
+              std::bind(&client::fetch_wrapper<Handler>, this,
+                        std::move(handler), std::move(bucket), std::move(key),
+                        priority, ph::_1, ph::_2),
+              try_only, priority);
 }
 
 template <class Handler>
-void client::async_fetch(riak::object object, Handler handler) const {
-  async_fetch(std::move(object.bucket_), std::move(object.key_), handler);
-}
-
-template <class Handler>
-void client::async_store(std::string bucket, std::string key, std::string value,
-                         Handler handler) const {
+bool client::store(std::string bucket, std::string key, std::string value,
+                   Handler handler, bool try_only, size_t priority) const {
   namespace ph = std::placeholders;
   pbc::RpbPutReq request;
   request.mutable_bucket()->swap(bucket);
   request.mutable_key()->swap(key);
   request.mutable_content()->mutable_value()->swap(value);
-  request.set_timeout(deadline_ms_);
-  send(pbc::RpbMessageCode::PUT_REQ, request,
-       std::bind(&store_wrapper<Handler>, std::move(handler), ph::_1, ph::_2));
+  return send(
+      pbc::RpbMessageCode::PUT_REQ, request,
+      std::bind(&store_wrapper<Handler>, std::move(handler), ph::_1, ph::_2),
+      try_only, priority);
 }
 
 template <class Handler>
-void client::async_store(riak::object object, Handler handler) const {
+bool client::store(riak::object object, Handler handler, bool try_only,
+                   size_t priority) const {
   namespace ph = std::placeholders;
   pbc::RpbPutReq request;
   request.mutable_bucket()->swap(object.bucket_);
@@ -162,36 +359,43 @@ void client::async_store(riak::object object, Handler handler) const {
   request.mutable_content()->clear_deleted();
   request.mutable_content()->clear_last_mod();
   request.mutable_content()->clear_last_mod_usecs();
-  request.set_timeout(deadline_ms_);
-  send(pbc::RpbMessageCode::PUT_REQ, request,
-       std::bind(&store_wrapper<Handler>, std::move(handler), ph::_1, ph::_2));
+  return send(
+      pbc::RpbMessageCode::PUT_REQ, request,
+      std::bind(&store_wrapper<Handler>, std::move(handler), ph::_1, ph::_2),
+      try_only, priority);
 }
 
 template <class Handler>
-void client::async_remove(riak::object object, Handler handler) const {
+bool client::remove(riak::object object, Handler handler, bool try_only,
+                    size_t priority) const {
   namespace ph = std::placeholders;
   pbc::RpbDelReq request;
   *request.mutable_bucket() = std::move(object.bucket_);
   *request.mutable_key() = std::move(object.key_);
   *request.mutable_vclock() = std::move(object.vclock_);
-  send(pbc::RpbMessageCode::DEL_REQ, request,
-       std::bind(&remove_wrapper<Handler>, std::move(handler), ph::_1, ph::_2));
+  return send(
+      pbc::RpbMessageCode::DEL_REQ, request,
+      std::bind(&remove_wrapper<Handler>, std::move(handler), ph::_1, ph::_2),
+      try_only, priority);
 }
 
 template <class Handler>
-void client::async_remove(std::string bucket, std::string key,
-                          Handler handler) const {
+bool client::remove(std::string bucket, std::string key, Handler handler,
+                    bool try_only, size_t priority) const {
   namespace ph = std::placeholders;
   pbc::RpbDelReq request;
   *request.mutable_bucket() = std::move(bucket);
   *request.mutable_key() = std::move(key);
-  send(pbc::RpbMessageCode::DEL_REQ, request,
-       std::bind(&remove_wrapper<Handler>, std::move(handler), ph::_1, ph::_2));
+  return send(
+      pbc::RpbMessageCode::DEL_REQ, request,
+      std::bind(&remove_wrapper<Handler>, std::move(handler), ph::_1, ph::_2),
+      try_only, priority);
 }
 
 template <class Handler>
 void client::fetch_wrapper(Handler& handler, std::string& bucket,
-                           std::string& key, std::error_code error,
+                           std::string& key, size_t priority,
+                           std::error_code error,
                            const std::string& serialized) const {
   namespace ph = std::placeholders;
   pbc::RpbGetResp response;
@@ -217,11 +421,11 @@ void client::fetch_wrapper(Handler& handler, std::string& bucket,
         if (!fetched.exists()) {
           put_request.mutable_content()->set_deleted(true);
         }
-        put_request.set_timeout(deadline_ms_);
         put_request.set_return_head(true);
         send(pbc::RpbMessageCode::PUT_REQ, put_request,
              std::bind(&store_resolution_wrapper<Handler>, std::move(handler),
-                       std::move(fetched), ph::_1, ph::_2));
+                       std::move(fetched), ph::_1, ph::_2),
+             false, priority);
         return;
       }
     }
@@ -3,8 +3,9 @@
 
 #include "check.hpp"
 
+#include <atomic>
+#include <cstddef>
 #include <functional>
-#include <memory>
 #include <type_traits>
 #include <utility>
 
@@ -19,6 +20,12 @@ template <typename Handler>
 inline basic_completion_group<typename std::decay<Handler>::type>
     make_completion_group(Handler&& handler);
 
+// Calls a handler once the group is notified and every function wrapped with
+// it was destroyed. The group and each wrapped function hold a reference to
+// an intrusive counter, so wrapping a function and destroying it cost an
+// atomic increment and decrement respectively. The counter outlives the group,
+// which may be destroyed while wrapped functions are alive, so constructing or
+// resetting a group still allocates it on the heap.
 template <typename Handler>
 class basic_completion_group {
  public:
@@ -30,12 +37,14 @@ class basic_completion_group {
   //   https://gcc.gnu.org/bugzilla/show_bug.cgi?id=60367
   inline basic_completion_group(handler_type handler = handler_type{});
 
-  basic_completion_group(basic_completion_group&&) = default;
+  inline basic_completion_group(basic_completion_group&& other);
   basic_completion_group(const basic_completion_group&) = delete;
 
-  basic_completion_group& operator=(basic_completion_group&&) = default;
+  inline basic_completion_group& operator=(basic_completion_group&& other);
   basic_completion_group& operator=(const basic_completion_group&) = delete;
 
+  ~basic_completion_group() { notify(); }
+
   inline void when_done(handler_type handler);
 
   inline void set_handler(handler_type handler);
@@ -54,11 +63,15 @@ class basic_completion_group {
  private:
   struct trigger {
     trigger(handler_type handler) : handler{std::move(handler)} {}
-    ~trigger() { handler(); }
+
+    // Calls the handler and frees the trigger once the count drops to zero.
+    inline void release();
+
+    std::atomic<size_t> count{1};
     handler_type handler;
   };
 
-  std::shared_ptr<trigger> trigger_;
+  trigger* trigger_ = nullptr;
 };
 
 using completion_group = basic_completion_group<std::function<void(void)>>;
@@ -71,17 +84,33 @@ make_completion_group(Handler&& handler) {
 
 template <typename Handler>
 class basic_completion_group<Handler>::ref_type {
-  friend class basic_completion_group;
+ public:
+  ref_type(const ref_type& other) : ref_type{other.trigger_} {}
+  ref_type(ref_type&& other) : trigger_{other.trigger_} {
+    other.trigger_ = nullptr;
+  }
+  ~ref_type() { if (trigger_) trigger_->release(); }
+
+  ref_type& operator=(ref_type other) {
+    std::swap(trigger_, other.trigger_);
+    return *this;
+  }
+
  private:
-  ref_type(const std::shared_ptr<trigger>& trigger) : trigger_{trigger} {}
-  std::shared_ptr<const basic_completion_group::trigger> trigger_;
+  friend class basic_completion_group;
+
+  explicit ref_type(trigger* to) : trigger_{to} {
+    if (trigger_) trigger_->count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  trigger* trigger_;
 };
 
 template <class RefType, typename Function>
 class completion_wrapper {
  public:
-  completion_wrapper(const RefType& ref, Function function)
-    : ref_{ref}, function_{std::move(function)} {}
+  completion_wrapper(RefType ref, Function function)
+    : ref_{std::move(ref)}, function_{std::move(function)} {}
 
   template <typename... Args>
   auto operator()(Args&&... args) const
@@ -106,6 +135,29 @@ inline basic_completion_group<Handler>::basic_completion_group(
   reset(std::move(handler));
 }
 
+template <typename Handler>
+inline basic_completion_group<Handler>::basic_completion_group(
+    basic_completion_group&& other)
+    : trigger_{other.trigger_} {
+  other.trigger_ = nullptr;
+}
+
+template <typename Handler>
+inline auto basic_completion_group<Handler>::operator=(
+    basic_completion_group&& other) -> basic_completion_group& {
+  notify();
+  std::swap(trigger_, other.trigger_);
+  return *this;
+}
+
+template <typename Handler>
+inline void basic_completion_group<Handler>::trigger::release() {
+  if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    handler();
+    delete this;
+  }
+}
+
 template <typename Handler>
 inline void basic_completion_group<Handler>::when_done(handler_type handler) {
   set_handler(std::move(handler));
@@ -126,7 +178,10 @@ void basic_completion_group<Handler>::set_handler(handler_type handler) {
 
 template <typename Handler>
 void basic_completion_group<Handler>::notify() {
-  trigger_.reset();
+  if (!trigger_) return;
+  auto released = trigger_;
+  trigger_ = nullptr;
+  released->release();
 }
 
 template <typename Handler>
@@ -137,12 +192,12 @@ inline bool basic_completion_group<Handler>::pending() const {
 template <typename Handler>
 inline void basic_completion_group<Handler>::reset(handler_type handler) {
   RIAKPP_CHECK(pending());
-  trigger_ = std::make_shared<trigger>(std::move(handler));
+  trigger_ = new trigger{std::move(handler)};
 }
 
 template <typename Handler>
 inline auto basic_completion_group<Handler>::ref() -> ref_type {
-  return {trigger_};
+  return ref_type{trigger_};
 }
 
 template <typename Handler>
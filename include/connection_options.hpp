@@ -1,19 +1,163 @@
 #ifndef RIAKPP_CONNECTION_OPTIONS_HPP_
 #define RIAKPP_CONNECTION_OPTIONS_HPP_
 
+#include "load_balancer.hpp"
 #include "option.hpp"
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace boost {
+namespace asio {
+class io_service;
+}  // namespace asio
+}  // namespace boost
 
 namespace riak {
+// What happens to a new request while 'highwatermark' requests are buffered,
+// or when it would take the requests in the client over 'max_buffered_bytes'.
+enum class overflow_policy {
+  // Block the calling thread until there is room. Requests sent from an I/O
+  // thread (e.g. from another request's handler) can then stall the client.
+  block,
+  // Fail the new request with std::errc::no_buffer_space.
+  fail,
+  // Fail the oldest buffered request with std::errc::no_buffer_space and
+  // buffer the new one in its place.
+  shed_oldest
+};
+
+// The options' macro needs a single name for a pointer type.
+using io_service_ptr = boost::asio::io_service*;
+
+// Sends a request with the 'default_priority' of its client.
+constexpr size_t use_default_priority = static_cast<size_t>(-1);
+
 class connection_options {
  public:
   RIAKPP_DEFINE_OPTION(size_t, highwatermark, 4096)
+  RIAKPP_DEFINE_OPTION(overflow_policy, on_overflow, overflow_policy::block)
+  RIAKPP_DEFINE_OPTION(size_t, max_buffered_bytes, 0)
   RIAKPP_DEFINE_OPTION(size_t, max_connections, 8)
+
+  // The pool starts with 'min_connections' connections (all of them by
+  // default) and activates another, up to 'max_connections', whenever more than
+  // 'grow_queue_depth' requests are buffered or, if 'grow_wait_ms' is
+  // non-zero, requests are buffered and no connection took one for that long
+  // (both are checked as requests are sent). A minimum of zero is allowed: the
+  // first request then opens the first connection. Connections beyond the
+  // minimum close their socket after 'idle_timeout_ms' without requests (zero
+  // means never) and stop taking requests, until the pool grows again.
+  RIAKPP_DEFINE_OPTION(size_t, min_connections, 0)
+  RIAKPP_DEFINE_OPTION(size_t, grow_queue_depth, 0)
+  RIAKPP_DEFINE_OPTION(uint64_t, grow_wait_ms, 0)
+  RIAKPP_DEFINE_OPTION(uint64_t, idle_timeout_ms, 60000)
+
+  // With 'eager_connect', the pool connects its first 'min_connections'
+  // connections as soon as it is constructed rather than on their first
+  // request. Connections idle for 'ping_interval_ms' (zero disables it) send
+  // Riak a ping, so that a stale socket is noticed and replaced before a
+  // request needs it; a ping must be answered within 'connection_timeout_ms'.
+  RIAKPP_DEFINE_OPTION(bool, eager_connect, false)
+  RIAKPP_DEFINE_OPTION(uint64_t, ping_interval_ms, 0)
+
+  // A connection gathers the requests waiting to be written into a single
+  // write of at most 'max_write_batch' requests and 'max_write_batch_bytes'.
+  // Each connection has 'pipeline_depth' slots in the pool; a slot takes the
+  // requests buffered in the pool along with the one it is handed, up to
+  // 'max_write_batch', and is free again once all of them are answered.
+  RIAKPP_DEFINE_OPTION(size_t, pipeline_depth, 1)
+  RIAKPP_DEFINE_OPTION(size_t, max_write_batch, 32)
+  RIAKPP_DEFINE_OPTION(size_t, max_write_batch_bytes, 65536)
+  RIAKPP_DEFINE_OPTION(size_t, max_pooled_buffer_bytes, 4 << 20)
   RIAKPP_DEFINE_OPTION(uint64_t, deadline_ms, 3000)
   RIAKPP_DEFINE_OPTION(uint64_t, connection_timeout_ms, 1500)
   RIAKPP_DEFINE_OPTION(size_t, num_worker_threads, 1)
+
+  // With 'shard_per_thread', each of a client's worker threads runs an
+  // io_service of its own, with its own connections to every node. The
+  // connection limits are divided between the threads, rounding up for the
+  // first ones and giving each at least 'reserved_connections' + 1. Requests
+  // sent from a worker thread stay on its shard; other threads spread theirs
+  // across shards. Since no connection is touched by two threads, their
+  // handlers skip the strand. Only available when the client runs its own
+  // threads.
+  RIAKPP_DEFINE_OPTION(bool, shard_per_thread, false)
+
+  // Worker threads are pinned to 'worker_cpus' in turn or, if that is empty
+  // and 'worker_numa_node' is not negative, to one CPU per physical core of
+  // that NUMA node, which then also sets the default number of threads. The
+  // connections are built by the worker threads, so their memory is on the
+  // workers' node; in sharded mode, each shard's on its own thread, and
+  // pooled buffers stay with the thread that released them. Threads are named
+  // "<worker_thread_name>/<index>".
+  RIAKPP_DEFINE_OPTION(std::vector<size_t>, worker_cpus, {})
+  RIAKPP_DEFINE_OPTION(int, worker_numa_node, -1)
+  RIAKPP_DEFINE_OPTION(std::string, worker_thread_name, "riakpp")
+
+  // Response handlers, including the sibling resolver, run on the I/O threads
+  // unless the client has 'num_completion_threads' threads of its own for them
+  // (named "<worker_thread_name>-cb/<index>") or posts them to a
+  // 'completion_io_service' which the user runs, so that a slow handler does
+  // not hold up the network. The user's io_service must outlive the client.
+  RIAKPP_DEFINE_OPTION(size_t, num_completion_threads, 0)
+  RIAKPP_DEFINE_OPTION(io_service_ptr, completion_io_service, nullptr)
+
+  // Requests are queued by priority, 0 being the highest. With no weights, a
+  // free connection always takes the highest priority request; with one
+  // weight per priority, priorities are served in proportion to their weights.
+  // 'highwatermark' applies to each priority's queue separately. The first
+  // 'reserved_connections' connections only serve priority 0.
+  RIAKPP_DEFINE_OPTION(size_t, num_priorities, 1)
+  RIAKPP_DEFINE_OPTION(size_t, default_priority, 0)
+  RIAKPP_DEFINE_OPTION(std::vector<uint32_t>, priority_weights, {})
+  RIAKPP_DEFINE_OPTION(size_t, reserved_connections, 0)
+
+  // How a client of several nodes spreads requests across them. Every node
+  // gets a connection pool of its own, to which all other options apply. A
+  // custom balancer, if set, is used instead of the 'balancing' policy.
+  RIAKPP_DEFINE_OPTION(balancing_policy, balancing,
+                       balancing_policy::round_robin)
+  RIAKPP_DEFINE_OPTION(std::shared_ptr<load_balancer>, custom_balancer, nullptr)
+
+  // Fetches are hedged: if one is not answered within 'hedge_delay_ms', a
+  // duplicate is sent to another node (or over another connection) and the
+  // first successful response wins. With 'hedge_percentile', the delay is
+  // that percentile of the fetch latencies observed so far instead, but never
+  // less than 'hedge_delay_ms'. Hedges are capped at 'hedge_budget_percent' of
+  // fetches. Both delays being zero disables hedging.
+  RIAKPP_DEFINE_OPTION(uint64_t, hedge_delay_ms, 0)
+  RIAKPP_DEFINE_OPTION(uint32_t, hedge_percentile, 0)
+  RIAKPP_DEFINE_OPTION(uint32_t, hedge_budget_percent, 5)
+
+  // A pool's endpoints are ejected after 'eject_after_failures' consecutive
+  // failed connects or timed out requests (zero never ejects) or, if
+  // 'outlier_latency_factor' is non-zero, once their average latency exceeds
+  // that many times the best of the pool's other healthy endpoints. Connections
+  // prefer healthy endpoints and retry an ejected one only once its backoff,
+  // doubling from 'backoff_base_ms' up to 'backoff_max_ms' (with jitter), has
+  // elapsed; while every endpoint backs off, connecting fails straight away.
+  RIAKPP_DEFINE_OPTION(uint32_t, eject_after_failures, 3)
+  RIAKPP_DEFINE_OPTION(uint32_t, outlier_latency_factor, 0)
+  RIAKPP_DEFINE_OPTION(uint64_t, backoff_base_ms, 100)
+  RIAKPP_DEFINE_OPTION(uint64_t, backoff_max_ms, 10000)
+
+  // Socket tuning, applied to every socket once it connects. Zero values leave
+  // the system default in place. The keepalive timings, tcp_quickack and
+  // busy_poll_us are only supported on Linux and ignored elsewhere. The TCP
+  // options do not apply to Unix domain sockets.
+  RIAKPP_DEFINE_OPTION(bool, tcp_nodelay, true)
+  RIAKPP_DEFINE_OPTION(bool, keepalive, false)
+  RIAKPP_DEFINE_OPTION(uint32_t, keepalive_idle_s, 0)
+  RIAKPP_DEFINE_OPTION(uint32_t, keepalive_interval_s, 0)
+  RIAKPP_DEFINE_OPTION(uint32_t, keepalive_count, 0)
+  RIAKPP_DEFINE_OPTION(size_t, send_buffer_bytes, 0)
+  RIAKPP_DEFINE_OPTION(size_t, receive_buffer_bytes, 0)
+  RIAKPP_DEFINE_OPTION(bool, tcp_quickack, false)
+  RIAKPP_DEFINE_OPTION(uint32_t, busy_poll_us, 0)
 };
 }  // namespace riak
 
@@ -1,12 +1,32 @@
 #ifndef RIAKPP_ENDPOINT_VECTOR_HPP_
 #define RIAKPP_ENDPOINT_VECTOR_HPP_
 
+#include <string>
 #include <vector>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 
 namespace riak {
-using endpoint_vector = std::vector<boost::asio::ip::tcp::endpoint>;
+// Endpoints of any stream protocol: TCP endpoints convert implicitly, as do
+// Unix domain socket ones (see local_endpoint()).
+using endpoint_type = boost::asio::generic::stream_protocol::endpoint;
+using endpoint_vector = std::vector<endpoint_type>;
 using endpoint_iterator = endpoint_vector::const_iterator;
+
+inline bool is_tcp_endpoint(const endpoint_type& endpoint) {
+  using boost::asio::generic::stream_protocol;
+  using boost::asio::ip::tcp;
+  return endpoint.protocol() == stream_protocol{tcp::v4()} ||
+         endpoint.protocol() == stream_protocol{tcp::v6()};
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+// The endpoint of a node (or PBC proxy) listening on a Unix domain socket.
+inline endpoint_type local_endpoint(const std::string& path) {
+  return boost::asio::local::stream_protocol::endpoint{path};
+}
+#endif  // #if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
 }  // namespace riak
 
 #endif  // #ifndef RIAKPP_ENDPOINT_VECTOR_HPP_
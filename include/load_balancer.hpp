@@ -0,0 +1,95 @@
+#ifndef RIAKPP_LOAD_BALANCER_HPP_
+#define RIAKPP_LOAD_BALANCER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace riak {
+
+// A Riak node, resolved when the client is constructed.
+struct node_address {
+  std::string hostname;
+  uint16_t port;
+};
+
+// An exponentially weighted moving average of latencies, in nanoseconds; zero
+// until the first sample.
+class latency_average {
+ public:
+  uint64_t ns() const { return ns_.load(std::memory_order_relaxed); }
+
+  inline void record(std::chrono::nanoseconds latency);
+  void reset() { ns_.store(0, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> ns_{0};
+};
+
+// The load on a node, kept up to date by the node's connection pool.
+class node_load {
+ public:
+  // Requests accepted by the node's pool whose handlers were not called yet.
+  uint32_t outstanding() const {
+    return outstanding_.load(std::memory_order_relaxed);
+  }
+
+  // Average time between a request being handed to a connection and its
+  // response, in nanoseconds; zero until the first response.
+  uint64_t latency_ns() const { return latency_.ns(); }
+
+  void add_outstanding() {
+    outstanding_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void remove_outstanding() {
+    outstanding_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  void record_latency(std::chrono::nanoseconds latency) {
+    latency_.record(latency);
+  }
+
+ private:
+  std::atomic<uint32_t> outstanding_{0};
+  latency_average latency_;
+};
+
+// Picks the node each request of a multi-node client is sent to. Called
+// concurrently from every thread sending requests.
+class load_balancer {
+ public:
+  virtual ~load_balancer() {}
+  virtual size_t pick(const std::vector<const node_load*>& nodes) = 0;
+};
+
+enum class balancing_policy {
+  // Each node in turn.
+  round_robin,
+  // The node with the fewest outstanding requests.
+  least_outstanding,
+  // The better of two random nodes, by latency average times outstanding
+  // requests ("power of two choices").
+  power_of_two_latency
+};
+
+std::unique_ptr<load_balancer> make_load_balancer(balancing_policy policy);
+
+void latency_average::record(std::chrono::nanoseconds latency) {
+  // Each sample has a weight of 1/8.
+  auto sample = std::max<int64_t>(latency.count(), 1);
+  auto average = ns_.load(std::memory_order_relaxed);
+  uint64_t updated;
+  do {
+    updated = average == 0 ? sample
+                           : average + (sample - int64_t(average)) / 8;
+  } while (!ns_.compare_exchange_weak(average, updated,
+                                       std::memory_order_relaxed));
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_LOAD_BALANCER_HPP_
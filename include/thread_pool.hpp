@@ -4,29 +4,79 @@
 #include <boost/asio/io_service.hpp>
 
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
 namespace riak {
 
+// Where a pool's threads run and what they are called. Thread 'i' is pinned to
+// cpus[i % cpus.size()] (or left to the scheduler if 'cpus' is empty) and named
+// "<name>/<i>", truncated to the 15 characters Linux allows. Both are
+// best-effort and ignored where unsupported.
+struct thread_placement {
+  std::vector<size_t> cpus;
+  std::string name;
+};
+
 class thread_pool {
  public:
   static constexpr size_t use_hardware_threads = 0;
+  static constexpr size_t no_shard = static_cast<size_t>(-1);
+  static constexpr int any_numa_node = -1;
+
+  // Either every thread runs the same io_service, or each thread runs one of
+  // its own (a shard), whose handlers then never run concurrently.
+  enum class sharding { shared, per_thread };
 
   thread_pool(size_t num_threads = use_hardware_threads,
               boost::asio::io_service* io_service = nullptr);
+  thread_pool(size_t num_threads, sharding mode,
+              thread_placement placement = {});
   ~thread_pool() noexcept;
 
-  boost::asio::io_service& io_service() noexcept { return io_service_; }
+  // The first shard's io_service; the only one unless sharded per thread.
+  boost::asio::io_service& io_service() noexcept { return *shards_[0]; }
 
   const boost::asio::io_service& io_service() const noexcept {
-    return io_service_;
+    return *shards_[0];
   }
 
+  size_t num_shards() const noexcept { return shards_.size(); }
+  boost::asio::io_service& shard(size_t index) noexcept {
+    return *shards_[index];
+  }
+
+  // The index of the shard run by the calling thread, or no_shard if the
+  // thread is not one of this pool's (or the pool is not sharded).
+  size_t current_shard() const noexcept;
+
+  // Whether the calling thread is one of this pool's, sharded or not.
+  bool runs_this_thread() const noexcept;
+
+  // The shard run by the calling thread in whichever pool it belongs to, or
+  // no_shard.
+  static size_t this_thread_shard() noexcept;
+
+  // One online CPU per physical core (the first of its hyperthreads), of the
+  // given NUMA node or of every node. Empty if the topology is unknown, which
+  // is always the case outside Linux.
+  static std::vector<size_t> physical_cores(int numa_node = any_numa_node);
+
+  // Stops every io_service the pool owns.
+  void stop() noexcept;
+
+  // Blocks until every thread returns, i.e. until the pool is stopped.
+  void join() noexcept;
+
  private:
-  std::unique_ptr<boost::asio::io_service> io_service_ptr_;
-  boost::asio::io_service& io_service_;
-  boost::asio::io_service::work work_;
+  void start(size_t num_threads, bool sharded,
+             const thread_placement& placement);
+
+  std::vector<std::unique_ptr<boost::asio::io_service>> owned_;
+  std::vector<boost::asio::io_service*> shards_;
+  std::vector<std::unique_ptr<boost::asio::io_service::work>> work_;
   std::vector<std::thread> threads_;
 };
 
@@ -3,6 +3,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 
@@ -20,6 +21,9 @@ template <typename TransientRef, typename Function>
 class transient_function_wrapper;
 
 namespace internal {
+// Counts the locks taken on a transient, plus one for the transient itself,
+// which it gives up when closing. Acquiring and releasing are a single atomic
+// operation each; only closing blocks, until the count drops to zero.
 class blocking_counter {
  public:
   blocking_counter() = default;
@@ -38,12 +42,15 @@ class blocking_counter {
   inline void wait_and_close(Function&& function);
 
  private:
-  uint32_t count_{1};
-  bool closed_ = false;
+  // The highest bit of 'state_' is set once closed, the others are the count.
+  static constexpr uint32_t closed_bit = uint32_t{1} << 31;
 
-  std::mutex count_mutex_;
-  std::condition_variable zero_count_;
+  std::atomic<uint32_t> state_{1};
 
+  // Only used to wait for, respectively signal, the count dropping to zero
+  // once closed.
+  std::mutex zero_mutex_;
+  std::condition_variable zero_count_;
 };
 }  // namespace internal
 
@@ -155,34 +162,39 @@ class transient_ref {
 
 namespace internal {
 blocking_counter::~blocking_counter() {
-  RIAKPP_CHECK(closed_);
-  RIAKPP_CHECK_EQ(0, count_);
+  RIAKPP_CHECK_EQ(uint32_t{closed_bit}, state_.load());
 }
 
 template <class Function>
 void blocking_counter::wait_and_close(Function&& function) {
-  std::unique_lock<std::mutex> lock{count_mutex_};
-  RIAKPP_CHECK(!closed_);
-  RIAKPP_CHECK_GT(count_, 0);
-  closed_ = true;
-  --count_;
-  while (count_ > 0) zero_count_.wait(lock);
+  // Sets the closed bit and gives up the transient's own count at once.
+  auto previous = state_.fetch_add(closed_bit - 1);
+  RIAKPP_CHECK_EQ(0, previous & closed_bit);
+  RIAKPP_CHECK_GT(previous, 0);
+  if (previous != 1) {
+    std::unique_lock<std::mutex> lock{zero_mutex_};
+    while (state_.load() != closed_bit) zero_count_.wait(lock);
+  }
   function();
 }
 
 bool blocking_counter::try_acquire() {
-  std::lock_guard<std::mutex> lock{count_mutex_};
-  if (closed_) return false;
-  ++count_;
+  auto state = state_.load(std::memory_order_relaxed);
+  do {
+    if (state & closed_bit) return false;
+  } while (!state_.compare_exchange_weak(state, state + 1,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed));
   return true;
 }
 
 void blocking_counter::release() {
-  std::unique_lock<std::mutex> lock{count_mutex_};
-  RIAKPP_CHECK_GT(count_, 0);
-  if (--count_ == 0) {
-    RIAKPP_CHECK(closed_);
-    lock.unlock();
+  auto previous = state_.fetch_sub(1, std::memory_order_acq_rel);
+  RIAKPP_CHECK_GT(previous & ~closed_bit, 0);
+  if (previous == (closed_bit | 1)) {
+    // The closer checks the count with the mutex held before waiting, so
+    // taking it here means the notification cannot be missed.
+    std::lock_guard<std::mutex> lock{zero_mutex_};
     zero_count_.notify_one();
   }
 }
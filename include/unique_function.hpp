@@ -0,0 +1,217 @@
+#ifndef RIAKPP_UNIQUE_FUNCTION_HPP_
+#define RIAKPP_UNIQUE_FUNCTION_HPP_
+
+#include "check.hpp"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace riak {
+
+template <class Signature, size_t InlineSize = 192>
+class unique_function;
+
+// A move-only replacement for std::function. Unlike std::function it accepts
+// callables which cannot be copied (e.g. lambdas capturing a unique_ptr) and it
+// stores any callable of up to InlineSize bytes without allocating.
+template <class Result, class... Args, size_t InlineSize>
+class unique_function<Result(Args...), InlineSize> {
+ public:
+  using result_type = Result;
+  static constexpr size_t inline_size = InlineSize;
+
+  unique_function() noexcept = default;
+  unique_function(std::nullptr_t) noexcept {}
+
+  template <class Function,
+            class = typename std::enable_if<!std::is_same<
+                typename std::decay<Function>::type,
+                unique_function>::value>::type>
+  inline unique_function(Function&& function);
+
+  inline unique_function(unique_function&& rhs) noexcept;
+  inline unique_function& operator=(unique_function&& rhs) noexcept;
+
+  unique_function(const unique_function&) = delete;
+  unique_function& operator=(const unique_function&) = delete;
+
+  ~unique_function() { reset(); }
+
+  explicit operator bool() const noexcept { return operations_ != nullptr; }
+
+  inline Result operator()(Args... args);
+
+  inline void reset() noexcept;
+
+  // Whether the callable is stored in the inline buffer (as opposed to on the
+  // heap); false for an empty function.
+  inline bool stored_inline() const noexcept;
+
+ private:
+  using storage_type = typename std::aligned_storage<InlineSize>::type;
+
+  struct operations {
+    Result (*invoke)(storage_type& storage, Args&&... args);
+    // Move-constructs 'to' from 'from' and destroys 'from'.
+    void (*relocate)(storage_type& from, storage_type& to);
+    void (*destroy)(storage_type& storage);
+    bool is_inline;
+  };
+
+  template <class Function>
+  struct inline_operations;
+
+  template <class Function>
+  struct heap_operations;
+
+  template <class Function>
+  using fits_inline = std::integral_constant<
+      bool, sizeof(Function) <= sizeof(storage_type) &&
+                alignof(storage_type) % alignof(Function) == 0 &&
+                std::is_nothrow_move_constructible<Function>::value>;
+
+  template <class Function>
+  inline void construct(Function&& function, std::true_type fits);
+
+  template <class Function>
+  inline void construct(Function&& function, std::false_type fits);
+
+  const operations* operations_ = nullptr;
+  storage_type storage_;
+};
+
+
+// Template and inline implementations.
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function>
+struct unique_function<Result(Args...), InlineSize>::inline_operations {
+  static Function& get(storage_type& storage) {
+    return *reinterpret_cast<Function*>(&storage);
+  }
+
+  static Result invoke(storage_type& storage, Args&&... args) {
+    return get(storage)(std::forward<Args>(args)...);
+  }
+
+  static void relocate(storage_type& from, storage_type& to) {
+    new (&to) Function(std::move(get(from)));
+    get(from).~Function();
+  }
+
+  static void destroy(storage_type& storage) { get(storage).~Function(); }
+
+  static constexpr operations table{&invoke, &relocate, &destroy, true};
+};
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function>
+constexpr typename unique_function<Result(Args...), InlineSize>::operations
+    unique_function<Result(Args...),
+                    InlineSize>::inline_operations<Function>::table;
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function>
+struct unique_function<Result(Args...), InlineSize>::heap_operations {
+  static Function*& get(storage_type& storage) {
+    return *reinterpret_cast<Function**>(&storage);
+  }
+
+  static Result invoke(storage_type& storage, Args&&... args) {
+    return (*get(storage))(std::forward<Args>(args)...);
+  }
+
+  static void relocate(storage_type& from, storage_type& to) {
+    new (&to) Function*(get(from));
+  }
+
+  static void destroy(storage_type& storage) { delete get(storage); }
+
+  static constexpr operations table{&invoke, &relocate, &destroy, false};
+};
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function>
+constexpr typename unique_function<Result(Args...), InlineSize>::operations
+    unique_function<Result(Args...),
+                    InlineSize>::heap_operations<Function>::table;
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function, class>
+unique_function<Result(Args...), InlineSize>::unique_function(
+    Function&& function) {
+  using function_type = typename std::decay<Function>::type;
+  construct(std::forward<Function>(function), fits_inline<function_type>{});
+}
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function>
+void unique_function<Result(Args...), InlineSize>::construct(
+    Function&& function, std::true_type) {
+  using function_type = typename std::decay<Function>::type;
+  new (&storage_) function_type(std::forward<Function>(function));
+  operations_ = &inline_operations<function_type>::table;
+}
+
+template <class Result, class... Args, size_t InlineSize>
+template <class Function>
+void unique_function<Result(Args...), InlineSize>::construct(
+    Function&& function, std::false_type) {
+  using function_type = typename std::decay<Function>::type;
+  new (&storage_) function_type*(
+      new function_type(std::forward<Function>(function)));
+  operations_ = &heap_operations<function_type>::table;
+}
+
+template <class Result, class... Args, size_t InlineSize>
+unique_function<Result(Args...), InlineSize>::unique_function(
+    unique_function&& rhs) noexcept
+    : operations_{rhs.operations_} {
+  if (operations_) {
+    operations_->relocate(rhs.storage_, storage_);
+    rhs.operations_ = nullptr;
+  }
+}
+
+template <class Result, class... Args, size_t InlineSize>
+auto unique_function<Result(Args...), InlineSize>::operator=(
+    unique_function&& rhs) noexcept -> unique_function& {
+  if (this != &rhs) {
+    reset();
+    if (rhs.operations_) {
+      rhs.operations_->relocate(rhs.storage_, storage_);
+      operations_ = rhs.operations_;
+      rhs.operations_ = nullptr;
+    }
+  }
+  return *this;
+}
+
+template <class Result, class... Args, size_t InlineSize>
+Result unique_function<Result(Args...), InlineSize>::operator()(Args... args) {
+  RIAKPP_CHECK(operations_ != nullptr) << "Called an empty unique_function.";
+  return operations_->invoke(storage_, std::forward<Args>(args)...);
+}
+
+template <class Result, class... Args, size_t InlineSize>
+void unique_function<Result(Args...), InlineSize>::reset() noexcept {
+  if (operations_) {
+    operations_->destroy(storage_);
+    operations_ = nullptr;
+  }
+}
+
+template <class Result, class... Args, size_t InlineSize>
+bool unique_function<Result(Args...), InlineSize>::stored_inline() const
+    noexcept {
+  return operations_ && operations_->is_inline;
+}
+
+template <class Result, class... Args, size_t InlineSize>
+constexpr size_t unique_function<Result(Args...), InlineSize>::inline_size;
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_UNIQUE_FUNCTION_HPP_
@@ -0,0 +1,88 @@
+#include "buffer_pool.hpp"
+
+#include "check.hpp"
+
+#include <utility>
+
+namespace riak {
+
+constexpr size_t buffer_pool::min_class_size;
+constexpr size_t buffer_pool::num_classes;
+constexpr size_t buffer_pool::default_max_pooled_bytes;
+
+namespace {
+inline size_t class_size(size_t index) {
+  return buffer_pool::min_class_size << index;
+}
+
+// The smallest class whose buffers can hold 'capacity' bytes.
+inline size_t class_for_acquire(size_t capacity) {
+  size_t index = 0;
+  while (index < buffer_pool::num_classes && class_size(index) < capacity) {
+    ++index;
+  }
+  return index;
+}
+
+// The largest class that a buffer with 'capacity' bytes can be used for.
+// Buffers much larger than the largest class are not worth keeping.
+inline size_t class_for_release(size_t capacity) {
+  if (capacity < buffer_pool::min_class_size ||
+      capacity >= class_size(buffer_pool::num_classes)) {
+    return buffer_pool::num_classes;
+  }
+  size_t index = 0;
+  while (index + 1 < buffer_pool::num_classes &&
+         class_size(index + 1) <= capacity) {
+    ++index;
+  }
+  return index;
+}
+}  // namespace
+
+buffer_pool::buffer_pool(size_t max_pooled_bytes, size_t num_arenas)
+    : num_arenas_{num_arenas}, arenas_{new size_classes[num_arenas]} {
+  RIAKPP_CHECK_GT(num_arenas, 0u);
+  // Every class of every arena gets an equal share of the memory budget.
+  for (size_t i_arena = 0; i_arena < num_arenas; ++i_arena) {
+    for (size_t index = 0; index < num_classes; ++index) {
+      arenas_[i_arena][index].max_buffers =
+          max_pooled_bytes / num_arenas / num_classes / class_size(index);
+    }
+  }
+}
+
+std::string buffer_pool::acquire(size_t min_capacity, size_t arena) {
+  auto index = class_for_acquire(min_capacity);
+  std::string buffer;
+  if (index < num_classes) {
+    auto& pooled = arena_at(arena)[index];
+    std::unique_lock<std::mutex> lock{pooled.mutex};
+    if (!pooled.buffers.empty()) {
+      buffer = std::move(pooled.buffers.back());
+      pooled.buffers.pop_back();
+      lock.unlock();
+      ++hits_;
+      return buffer;
+    }
+    lock.unlock();
+    min_capacity = class_size(index);
+  }
+  ++misses_;
+  buffer.reserve(min_capacity);
+  return buffer;
+}
+
+void buffer_pool::release(std::string buffer, size_t arena) {
+  auto index = class_for_release(buffer.capacity());
+  if (index == num_classes) return;
+
+  auto& pooled = arena_at(arena)[index];
+  buffer.clear();
+  std::lock_guard<std::mutex> lock{pooled.mutex};
+  if (pooled.buffers.size() < pooled.max_buffers) {
+    pooled.buffers.emplace_back(std::move(buffer));
+  }
+}
+
+}  // namespace riak
@@ -1,50 +1,179 @@
 #include "client.hpp"
 
-#include "connection_pool.hpp"
+#include "completion_executor.hpp"
 #include "debug_log.hpp"
 #include "length_framed_connection.hpp"
+#include "sharded_cluster.hpp"
 #include "thread_pool.hpp"
 
-#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
-
 namespace riak {
+namespace {
+// The 'timeout' field of the requests which have one, or zero.
+uint32_t timeout_field(pbc::RpbMessageCode code) {
+  switch (code) {
+    case pbc::RpbMessageCode::GET_REQ:
+      return pbc::RpbGetReq::kTimeoutFieldNumber;
+    case pbc::RpbMessageCode::PUT_REQ:
+      return pbc::RpbPutReq::kTimeoutFieldNumber;
+    default:
+      return 0;
+  }
+}
+
+std::vector<endpoint_vector> single_node(endpoint_vector endpoints) {
+  std::vector<endpoint_vector> nodes;
+  nodes.emplace_back(std::move(endpoints));
+  return nodes;
+}
+
+thread_pool* make_threads(const connection_options& options) {
+  thread_placement placement{options.worker_cpus(),
+                             options.worker_thread_name()};
+  auto num_threads = options.num_worker_threads();
+  if (placement.cpus.empty() && options.worker_numa_node() >= 0) {
+    placement.cpus = thread_pool::physical_cores(options.worker_numa_node());
+    RIAKPP_CHECK(!placement.cpus.empty())
+        << "No CPUs found for NUMA node " << options.worker_numa_node() << ".";
+    if (options.defaulted_num_worker_threads()) {
+      num_threads = placement.cpus.size();
+    }
+  }
+  return new thread_pool{num_threads,
+                         options.shard_per_thread()
+                             ? thread_pool::sharding::per_thread
+                             : thread_pool::sharding::shared,
+                         std::move(placement)};
+}
+
+completion_executor* make_completions(const connection_options& options) {
+  RIAKPP_CHECK(options.num_completion_threads() == 0 ||
+               !options.completion_io_service())
+      << "Handlers run either on completion threads or on an io_service.";
+  if (options.completion_io_service()) {
+    return new completion_executor{*options.completion_io_service()};
+  }
+  if (options.num_completion_threads() == 0) return nullptr;
+  return new completion_executor{options.num_completion_threads(),
+                                 options.worker_thread_name() + "-cb"};
+}
+
+void check_unmanaged(const connection_options& options) {
+  RIAKPP_CHECK(options.defaulted_num_worker_threads())
+      << "When using an external io_service, no threads are spawned so the "
+         "number of threads cannot be specified.";
+  RIAKPP_CHECK(!options.shard_per_thread())
+      << "An external io_service cannot be sharded.";
+  RIAKPP_CHECK(options.worker_cpus().empty() && options.worker_numa_node() < 0)
+      << "When using an external io_service, no threads are spawned so they "
+         "cannot be placed.";
+}
+}  // namespace
 
 client::client(const std::string& hostname, uint16_t port,
                sibling_resolver resolver, connection_options options)
-    : threads_{new thread_pool{options.num_worker_threads()}},
-      connection_{new connection{
-          threads_->io_service(), hostname, port, options.max_connections(),
-          options.highwatermark(), options.connection_timeout_ms()}},
+    : client{std::vector<node_address>{{hostname, port}}, std::move(resolver),
+             std::move(options)} {}
+
+client::client(boost::asio::io_service& io_service, const std::string& hostname,
+               uint16_t port, sibling_resolver resolver,
+               connection_options options)
+    : client{io_service, std::vector<node_address>{{hostname, port}},
+             std::move(resolver), std::move(options)} {}
+
+client::client(std::vector<node_address> nodes, sibling_resolver resolver,
+               connection_options options)
+    : threads_{make_threads(options)},
+      completions_{make_completions(options)},
+      connection_{
+          new connection{*threads_, nodes, options, completions_.get()}},
       io_service_{&threads_->io_service()},
       resolver_{std::move(resolver)},
       deadline_ms_{options.deadline_ms()} {}
 
-client::client(boost::asio::io_service& io_service, const std::string& hostname,
-               uint16_t port, sibling_resolver resolver,
+client::client(boost::asio::io_service& io_service,
+               std::vector<node_address> nodes, sibling_resolver resolver,
                connection_options options)
-    : connection_{new connection{
-          io_service, hostname, port, options.max_connections(),
-          options.highwatermark(), options.connection_timeout_ms()}},
+    : completions_{make_completions(options)},
+      connection_{
+          new connection{io_service, nodes, options, completions_.get()}},
       io_service_{&io_service},
       resolver_{std::move(resolver)},
       deadline_ms_{options.deadline_ms()} {
-  RIAKPP_CHECK(options.defaulted_num_worker_threads())
-      << "When using an external io_service, no threads are spawned so the "
-         "number of threads cannot be specified.";
+  check_unmanaged(options);
+}
+
+client::client(endpoint_vector endpoints, sibling_resolver resolver,
+               connection_options options)
+    : threads_{make_threads(options)},
+      completions_{make_completions(options)},
+      connection_{
+          new connection{*threads_, single_node(std::move(endpoints)),
+                         options, completions_.get()}},
+      io_service_{&threads_->io_service()},
+      resolver_{std::move(resolver)},
+      deadline_ms_{options.deadline_ms()} {}
+
+client::client(boost::asio::io_service& io_service, endpoint_vector endpoints,
+               sibling_resolver resolver, connection_options options)
+    : completions_{make_completions(options)},
+      connection_{new connection{io_service, single_node(std::move(endpoints)),
+                                 options, completions_.get()}},
+      io_service_{&io_service},
+      resolver_{std::move(resolver)},
+      deadline_ms_{options.deadline_ms()} {
+  check_unmanaged(options);
 }
 
-client::~client() {}
+client::~client() {
+  // Queued handlers may send further requests: stop them before the
+  // connection goes away.
+  if (completions_) completions_->stop();
+}
 
 void client::run_managed() {
   RIAKPP_CHECK(manages_io_service())
       << "run_managed() called on client with unmanaged io_service";
-  io_service_->run();
+  // Each shard must only be run by its own thread, so just wait for them.
+  if (threads_->num_shards() > 1) {
+    threads_->join();
+  } else {
+    io_service_->run();
+  }
 }
 
 void client::stop_managed() {
   RIAKPP_CHECK(manages_io_service())
       << "stop_managed() called on client with unmanaged io_service";
-  io_service_->stop();
+  threads_->stop();
+}
+
+const buffer_pool& client::buffers() const { return connection_->buffers(); }
+
+size_t client::buffered_bytes() const { return connection_->buffered_bytes(); }
+
+void client::async_wait_ready(
+    unique_function<void(std::error_code)> handler) const {
+  connection_->async_wait_ready(std::move(handler));
+}
+
+uint64_t client::num_ejections() const {
+  return connection_->num_ejections();
+}
+
+uint64_t client::num_readmissions() const {
+  return connection_->num_readmissions();
+}
+
+uint64_t client::num_hedged_requests() const {
+  return connection_->num_hedged_requests();
+}
+
+size_t client::completion_queue_depth() const {
+  return completions_ ? completions_->queue_depth() : 0;
+}
+
+size_t client::max_completion_queue_depth() const {
+  return completions_ ? completions_->max_queue_depth() : 0;
 }
 
 store_resolved_sibling client::pass_through_resolver(object& conflicted) {
@@ -74,19 +203,42 @@ void client::parse(pbc::RpbMessageCode code, const std::string& serialized,
   }
 }
 
-void client::send(pbc::RpbMessageCode code,
+bool client::send(pbc::RpbMessageCode code,
                   const google::protobuf::Message& message,
-                  connection::handler_type handler) const {
-  static const size_t min_message_size = 64;
+                  connection::handler_type handler, bool try_only,
+                  size_t priority) const {
+  auto message_size = static_cast<size_t>(message.ByteSize());
 
-  connection::request_type new_request;
-  new_request.deadline_ms = deadline_ms_;
-  new_request.payload.reserve(min_message_size);
-  new_request.payload.push_back(static_cast<char>(code));
-  google::protobuf::io::StringOutputStream message_stream(&new_request.payload);
-  message.SerializeToZeroCopyStream(&message_stream);
+  // The deadline includes the time spent buffered; the server is sent
+  // whatever is left of it once the request is written. The payload comes
+  // from the arena of the shard which will release it.
+  auto& shard = connection_->pick();
+  connection::request_type new_request{{}, deadline_ms_};
+  new_request.timeout_field = timeout_field(code);
+  new_request.payload = shard.buffers().acquire(
+      message_size + 1 + length_framed_connection::max_timeout_field_bytes,
+      shard.buffer_arena());
+  new_request.payload.resize(message_size + 1);
+  new_request.payload[0] = static_cast<char>(code);
+  message.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(&new_request.payload[1]));
 
-  connection_->async_send(new_request, std::move(handler));
+  // Fetches are the only idempotent requests, so the only hedged ones.
+  if (code == pbc::RpbMessageCode::GET_REQ) {
+    if (try_only) {
+      return shard.try_async_send_hedged(std::move(new_request),
+                                         std::move(handler), priority);
+    }
+    shard.async_send_hedged(std::move(new_request), std::move(handler),
+                            priority);
+    return true;
+  }
+  if (try_only) {
+    return shard.try_async_send(std::move(new_request), std::move(handler),
+                                priority);
+  }
+  shard.async_send(std::move(new_request), std::move(handler), priority);
+  return true;
 }
 
 }  // namespace riak
@@ -0,0 +1,456 @@
+#ifndef RIAKPP_CLUSTER_HPP_
+#define RIAKPP_CLUSTER_HPP_
+
+#include <boost/asio/io_service.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "check.hpp"
+#include "completion_executor.hpp"
+#include "connection_options.hpp"
+#include "connection_pool.hpp"
+#include "debug_log.hpp"
+#include "endpoint_vector.hpp"
+#include "hedge_policy.hpp"
+#include "load_balancer.hpp"
+#include "timing_wheel.hpp"
+#include "transient.hpp"
+
+namespace riak {
+namespace internal {
+// Gathers the readiness of several pools into one handler, which gets an error
+// only if none of them is ready: each pool is given a copy of the functor.
+template <class Error, class Handler>
+class any_ready {
+ public:
+  any_ready(size_t num_waiting, Handler handler)
+      : state_{std::make_shared<state>()} {
+    state_->num_waiting = num_waiting;
+    state_->handler = std::move(handler);
+  }
+
+  void operator()(Error error) {
+    std::unique_lock<std::mutex> lock{state_->mutex};
+    if (error) {
+      state_->error = error;
+    } else {
+      state_->any_ready = true;
+    }
+    if (--state_->num_waiting > 0) return;
+    lock.unlock();
+    state_->handler(state_->any_ready ? Error{} : state_->error);
+  }
+
+ private:
+  struct state {
+    std::mutex mutex;
+    size_t num_waiting;
+    bool any_ready = false;
+    Error error;
+    Handler handler;
+  };
+
+  std::shared_ptr<state> state_;
+};
+}  // namespace internal
+
+// A connection_pool per Riak node, with requests spread across them by a
+// load_balancer. All pools share their payload buffers; every other option
+// applies to each node's pool separately.
+//
+// Requests sent with async_send_hedged() are duplicated to another node (or,
+// with a single node, over another connection) when they are not answered
+// within the hedge delay; the first successful response is passed on and the
+// other one ignored. See the 'hedge_*' options.
+template <class Connection>
+class cluster {
+ public:
+  using pool_type = connection_pool<Connection>;
+  using request_type = typename pool_type::request_type;
+  using handler_type = typename pool_type::handler_type;
+  using error_type = typename pool_type::error_type;
+  using response_type = typename pool_type::response_type;
+  using ready_handler_type = typename pool_type::ready_handler_type;
+
+  // Payload buffers are recycled through arena 'buffer_arena' of 'buffers',
+  // which may be shared with other clusters; if null, the cluster makes its
+  // own. Request handlers run on 'completions' if given, or else on
+  // 'io_service'.
+  cluster(boost::asio::io_service& io_service,
+          const std::vector<node_address>& nodes,
+          const connection_options& options,
+          std::shared_ptr<buffer_pool> buffers = nullptr,
+          completion_executor* completions = nullptr,
+          size_t buffer_arena = 0);
+
+  // Each node is given as the endpoints to try when connecting to it.
+  cluster(boost::asio::io_service& io_service,
+          std::vector<endpoint_vector> nodes,
+          const connection_options& options,
+          std::shared_ptr<buffer_pool> buffers = nullptr,
+          completion_executor* completions = nullptr,
+          size_t buffer_arena = 0);
+  ~cluster() { transient_.reset(); }
+
+  void async_send(request_type request, handler_type handler,
+                  size_t priority = use_default_priority) {
+    pick().async_send(std::move(request), std::move(handler), priority);
+  }
+
+  bool try_async_send(request_type request, handler_type handler,
+                      size_t priority = use_default_priority) {
+    return pick().try_async_send(std::move(request), std::move(handler),
+                                 priority);
+  }
+
+  // As above, but the request may be hedged; only idempotent requests should
+  // be. Hedges never block: if there is no room for one, it is not sent.
+  void async_send_hedged(request_type request, handler_type handler,
+                         size_t priority = use_default_priority) {
+    send_hedged(std::move(request), std::move(handler), priority, false);
+  }
+
+  bool try_async_send_hedged(request_type request, handler_type handler,
+                             size_t priority = use_default_priority) {
+    return send_hedged(std::move(request), std::move(handler), priority,
+                       true);
+  }
+
+  // Calls 'handler' once every node is ready (see
+  // connection_pool::async_wait_ready), with an error only if none is.
+  void async_wait_ready(ready_handler_type handler);
+
+  size_t num_nodes() const { return pools_.size(); }
+  const pool_type& node(size_t index) const { return *pools_[index]; }
+
+  // The sums over every node.
+  inline size_t buffered_bytes() const;
+  inline uint64_t num_ejections() const;
+  inline uint64_t num_readmissions() const;
+
+  // Number of hedges sent.
+  uint64_t num_hedged_requests() const {
+    return hedging_ ? hedging_->policy.num_hedges() : 0;
+  }
+
+  // Request payloads should be acquired from this arena of buffers().
+  buffer_pool& buffers() { return *buffers_; }
+  const buffer_pool& buffers() const { return *buffers_; }
+  size_t buffer_arena() const { return buffer_arena_; }
+
+ private:
+  // Shared with the hedged requests, which may outlive the cluster.
+  struct hedging_context {
+    hedging_context(boost::asio::io_service& io_service,
+                    completion_executor* completions,
+                    std::shared_ptr<buffer_pool> buffers, size_t buffer_arena,
+                    const connection_options& options)
+        : io_service(io_service),
+          completions{completions},
+          buffers{std::move(buffers)},
+          buffer_arena{buffer_arena},
+          policy{options},
+          deadlines{io_service} {}
+
+    boost::asio::io_service& io_service;
+    completion_executor* const completions;
+    const std::shared_ptr<buffer_pool> buffers;
+    const size_t buffer_arena;
+    hedge_policy policy;
+    timing_wheel deadlines;
+  };
+
+  // A hedged request, kept alive by the handlers of its attempts.
+  struct hedge_state {
+    ~hedge_state() {
+      context->deadlines.cancel(deadline);
+      // The duplicate is still here unless the hedge was sent.
+      context->buffers->release(std::move(duplicate.payload),
+                                context->buffer_arena);
+    }
+
+    std::shared_ptr<hedging_context> context;
+    request_type duplicate;
+    handler_type handler;
+    size_t priority;
+    size_t primary_node;
+    timing_wheel::time_point sent_at;
+    // The primary's error, if it failed; written before its attempt is
+    // released from 'attempts', and read by whichever attempt releases last.
+    error_type error;
+    // Set once the handler is called.
+    std::atomic<bool> answered{false};
+    // The attempts which may still answer.
+    std::atomic<int> attempts{1};
+    timing_wheel::deadline deadline;
+  };
+
+  struct hedge_attempt {
+    void operator()(error_type error, response_type& response);
+    std::shared_ptr<hedge_state> state;
+    bool hedge;
+  };
+
+  cluster(const connection_options& options,
+          std::shared_ptr<buffer_pool> buffers, size_t buffer_arena);
+
+  void add_pool(std::unique_ptr<pool_type> pool);
+  void enable_hedging(boost::asio::io_service& io_service,
+                      completion_executor* completions,
+                      const connection_options& options);
+  size_t pick_index();
+  pool_type& pick() { return *pools_[pick_index()]; }
+
+  bool send_hedged(request_type request, handler_type handler,
+                   size_t priority, bool try_only);
+  void send_hedge(std::shared_ptr<hedge_state> state);
+
+  const std::shared_ptr<buffer_pool> buffers_;
+  const size_t buffer_arena_;
+  std::vector<std::unique_ptr<pool_type>> pools_;
+  std::vector<const node_load*> loads_;
+  std::shared_ptr<load_balancer> balancer_;
+  std::shared_ptr<hedging_context> hedging_;
+
+  transient<cluster> transient_;
+};
+
+template <class Connection>
+cluster<Connection>::cluster(boost::asio::io_service& io_service,
+                             const std::vector<node_address>& nodes,
+                             const connection_options& options,
+                             std::shared_ptr<buffer_pool> buffers,
+                             completion_executor* completions,
+                             size_t buffer_arena)
+    : cluster{options, std::move(buffers), buffer_arena} {
+  for (const auto& node : nodes) {
+    add_pool(std::unique_ptr<pool_type>{new pool_type{
+        io_service, node.hostname, node.port, options, buffers_, completions,
+        buffer_arena}});
+  }
+  RIAKPP_CHECK(!pools_.empty()) << "A cluster needs at least one node.";
+  enable_hedging(io_service, completions, options);
+}
+
+template <class Connection>
+cluster<Connection>::cluster(boost::asio::io_service& io_service,
+                             std::vector<endpoint_vector> nodes,
+                             const connection_options& options,
+                             std::shared_ptr<buffer_pool> buffers,
+                             completion_executor* completions,
+                             size_t buffer_arena)
+    : cluster{options, std::move(buffers), buffer_arena} {
+  for (auto& endpoints : nodes) {
+    add_pool(std::unique_ptr<pool_type>{
+        new pool_type{io_service, std::move(endpoints), options, buffers_,
+                      completions, buffer_arena}});
+  }
+  RIAKPP_CHECK(!pools_.empty()) << "A cluster needs at least one node.";
+  enable_hedging(io_service, completions, options);
+}
+
+template <class Connection>
+cluster<Connection>::cluster(const connection_options& options,
+                             std::shared_ptr<buffer_pool> buffers,
+                             size_t buffer_arena)
+    : buffers_{buffers ? std::move(buffers)
+                       : std::make_shared<buffer_pool>(
+                             options.max_pooled_buffer_bytes())},
+      buffer_arena_{buffer_arena},
+      balancer_{options.custom_balancer()},
+      transient_{*this} {
+  if (!balancer_) balancer_ = make_load_balancer(options.balancing());
+}
+
+template <class Connection>
+void cluster<Connection>::async_wait_ready(ready_handler_type handler) {
+  internal::any_ready<error_type, ready_handler_type> node_ready{
+      pools_.size(), std::move(handler)};
+  for (auto& pool : pools_) pool->async_wait_ready(node_ready);
+}
+
+template <class Connection>
+size_t cluster<Connection>::buffered_bytes() const {
+  size_t total = 0;
+  for (const auto& pool : pools_) total += pool->buffered_bytes();
+  return total;
+}
+
+template <class Connection>
+uint64_t cluster<Connection>::num_ejections() const {
+  uint64_t total = 0;
+  for (const auto& pool : pools_) total += pool->health().ejections();
+  return total;
+}
+
+template <class Connection>
+uint64_t cluster<Connection>::num_readmissions() const {
+  uint64_t total = 0;
+  for (const auto& pool : pools_) total += pool->health().readmissions();
+  return total;
+}
+
+template <class Connection>
+void cluster<Connection>::add_pool(std::unique_ptr<pool_type> pool) {
+  loads_.push_back(&pool->load());
+  pools_.push_back(std::move(pool));
+}
+
+template <class Connection>
+void cluster<Connection>::enable_hedging(boost::asio::io_service& io_service,
+                                         completion_executor* completions,
+                                         const connection_options& options) {
+  auto context = std::make_shared<hedging_context>(
+      io_service, completions, buffers_, buffer_arena_, options);
+  if (context->policy.enabled()) hedging_ = std::move(context);
+}
+
+template <class Connection>
+size_t cluster<Connection>::pick_index() {
+  if (pools_.size() == 1) return 0;
+  auto index = balancer_->pick(loads_);
+  RIAKPP_CHECK_LT(index, pools_.size()) << "The balancer picked no node.";
+  // A node whose endpoints are all backing off would fail the request
+  // straight away, so the next available node takes it instead, if any.
+  auto now = timing_wheel::clock_type::now();
+  for (size_t offset = 0; offset < pools_.size(); ++offset) {
+    auto i_pool = (index + offset) % pools_.size();
+    if (pools_[i_pool]->health().available(now)) return i_pool;
+  }
+  return index;
+}
+
+template <class Connection>
+bool cluster<Connection>::send_hedged(request_type request,
+                                      handler_type handler, size_t priority,
+                                      bool try_only) {
+  if (!hedging_) {
+    if (try_only) {
+      return try_async_send(std::move(request), std::move(handler), priority);
+    }
+    async_send(std::move(request), std::move(handler), priority);
+    return true;
+  }
+
+  auto& policy = hedging_->policy;
+  auto state = std::make_shared<hedge_state>();
+  state->context = hedging_;
+  state->handler = std::move(handler);
+  state->priority = priority;
+  state->primary_node = pick_index();
+  state->sent_at = timing_wheel::clock_type::now();
+
+  // No hedge is sent before there is a delay to wait for, nor if the request
+  // would expire first.
+  auto delay = policy.delay();
+  bool hedge = delay != hedge_policy::duration::max() &&
+               request.expires_at - state->sent_at > delay;
+  timing_wheel::callback_type on_delay;
+  if (hedge) {
+    state->duplicate.payload =
+        buffers_->acquire(request.payload.size(), buffer_arena_);
+    state->duplicate.payload.assign(request.payload);
+    state->duplicate.expires_at = request.expires_at;
+    state->duplicate.timeout_field = request.timeout_field;
+    std::weak_ptr<hedge_state> weak_state{state};
+    on_delay = transient_.wrap([this, weak_state] {
+      auto locked = weak_state.lock();
+      if (locked) send_hedge(std::move(locked));
+    });
+  }
+
+  // The cluster may be destroyed by a handler as soon as the request is sent,
+  // so only the state is touched afterwards.
+  auto& pool = *pools_[state->primary_node];
+  if (try_only) {
+    if (!pool.try_async_send(std::move(request), hedge_attempt{state, false},
+                             priority)) {
+      return false;
+    }
+  } else {
+    pool.async_send(std::move(request), hedge_attempt{state, false},
+                    priority);
+  }
+  // Only requests actually sent earn hedging credit.
+  state->context->policy.on_request();
+  if (hedge && !state->answered.load()) {
+    state->context->deadlines.schedule(state->deadline, state->sent_at + delay,
+                                       std::move(on_delay));
+  }
+  return true;
+}
+
+template <class Connection>
+void cluster<Connection>::send_hedge(std::shared_ptr<hedge_state> state) {
+  auto attempts = state->attempts.load();
+  do {
+    if (attempts == 0 || state->answered.load()) return;
+  } while (!state->attempts.compare_exchange_weak(attempts, attempts + 1));
+  auto& context = *state->context;
+  if (!context.policy.try_spend()) {
+    --state->attempts;
+    return;
+  }
+
+  auto i_node = state->primary_node;
+  if (pools_.size() > 1) {
+    i_node = pick_index();
+    if (i_node == state->primary_node) i_node = (i_node + 1) % pools_.size();
+  }
+  RIAKPP_DLOG << "Hedging a request to node " << i_node << ".";
+  if (pools_[i_node]->try_async_send(std::move(state->duplicate),
+                                     hedge_attempt{state, true},
+                                     state->priority)) {
+    return;
+  }
+  context.policy.refund();
+  // The primary may have failed meanwhile, leaving its error to be delivered;
+  // not from here, since the handler may destroy the cluster.
+  if (state->attempts.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    auto deliver_error = [state] {
+      response_type response;
+      if (!state->answered.exchange(true)) {
+        state->handler(state->error, response);
+      }
+    };
+    if (context.completions) {
+      context.completions->post(std::move(deliver_error));
+    } else {
+      context.io_service.post(std::move(deliver_error));
+    }
+  }
+}
+
+template <class Connection>
+void cluster<Connection>::hedge_attempt::operator()(error_type error,
+                                                    response_type& response) {
+  if (!error) {
+    if (!hedge) {
+      state->context->policy.record_latency(timing_wheel::clock_type::now() -
+                                            state->sent_at);
+    }
+    if (!state->answered.exchange(true)) {
+      state->context->deadlines.cancel(state->deadline);
+      state->handler(error, response);
+    }
+    return;
+  }
+  // The request failed for good only once every attempt did, with the
+  // primary's error.
+  if (!hedge) state->error = error;
+  if (state->attempts.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+      !state->answered.exchange(true)) {
+    state->handler(state->error, response);
+  }
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_CLUSTER_HPP_
@@ -0,0 +1,89 @@
+#ifndef RIAKPP_COMPLETION_EXECUTOR_HPP_
+#define RIAKPP_COMPLETION_EXECUTOR_HPP_
+
+#include "move_on_copy.hpp"
+#include "thread_pool.hpp"
+
+#include <boost/asio/io_service.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace riak {
+
+// Runs handlers away from the I/O threads which complete them, either on
+// threads of its own or on an io_service run by the user, and keeps count of
+// the handlers waiting to run. See the 'num_completion_threads' and
+// 'completion_io_service' options.
+class completion_executor {
+ public:
+  inline completion_executor(size_t num_threads, std::string thread_name);
+  explicit completion_executor(boost::asio::io_service& io_service)
+      : io_service_(io_service) {}
+
+  template <class Function>
+  inline void post(Function function);
+
+  // Stops the executor's own threads and waits for them; handlers still queued
+  // are dropped. Does nothing to a user's io_service.
+  inline void stop();
+
+  // Handlers posted but not yet started, respectively the most ever queued at
+  // once.
+  size_t queue_depth() const {
+    return queue_depth_.load(std::memory_order_relaxed);
+  }
+  size_t max_queue_depth() const {
+    return max_queue_depth_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  template <class Function>
+  struct counted_function {
+    void operator()() {
+      executor.queue_depth_.fetch_sub(1, std::memory_order_relaxed);
+      function();
+    }
+
+    completion_executor& executor;
+    Function function;
+  };
+
+  const std::unique_ptr<thread_pool> threads_;
+  boost::asio::io_service& io_service_;
+  std::atomic<size_t> queue_depth_{0};
+  std::atomic<size_t> max_queue_depth_{0};
+};
+
+completion_executor::completion_executor(size_t num_threads,
+                                         std::string thread_name)
+    : threads_{new thread_pool{num_threads, thread_pool::sharding::shared,
+                               thread_placement{{}, std::move(thread_name)}}},
+      io_service_(threads_->io_service()) {}
+
+template <class Function>
+void completion_executor::post(Function function) {
+  auto depth = queue_depth_.fetch_add(1, std::memory_order_relaxed) + 1;
+  auto max_depth = max_queue_depth_.load(std::memory_order_relaxed);
+  while (depth > max_depth &&
+         !max_queue_depth_.compare_exchange_weak(max_depth, depth,
+                                                 std::memory_order_relaxed)) {
+  }
+  io_service_.post(make_move_on_copy(
+      counted_function<Function>{*this, std::move(function)}));
+}
+
+void completion_executor::stop() {
+  if (!threads_) return;
+  threads_->stop();
+  threads_->join();
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_COMPLETION_EXECUTOR_HPP_
@@ -4,14 +4,28 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/system/error_code.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <system_error>
 #include <vector>
 
-#include "async_queue.hpp"
+#include "async_priority_queue.hpp"
+#include "buffer_pool.hpp"
 #include "check.hpp"
+#include "completion_executor.hpp"
+#include "connection_options.hpp"
+#include "endpoint_health.hpp"
 #include "endpoint_vector.hpp"
+#include "load_balancer.hpp"
+#include "move_on_copy.hpp"
+#include "timing_wheel.hpp"
 #include "transient.hpp"
+#include "unique_function.hpp"
 
 namespace riak {
 
@@ -20,16 +34,73 @@ class connection_pool {
  public:
   using connection_type = Connection;
   using error_type = typename connection_type::error_type;
-  using handler_type = typename connection_type::handler_type;
   using request_type = typename connection_type::request_type;
   using response_type = typename connection_type::response_type;
+  using handler_type = unique_function<void(error_type, response_type&)>;
+  using ready_handler_type = unique_function<void(error_type)>;
 
+  // Payload buffers are recycled through arena 'buffer_arena' of 'buffers',
+  // which may be shared with other pools; if null, the pool makes its own.
+  // Request handlers run on 'completions' if given, or else on 'io_service'.
   connection_pool(boost::asio::io_service& io_service, std::string hostname,
-                  uint16_t port, size_t max_connections, size_t highwatermark,
-                  uint64_t connection_timeout_ms);
+                  uint16_t port, const connection_options& options,
+                  std::shared_ptr<buffer_pool> buffers = nullptr,
+                  completion_executor* completions = nullptr,
+                  size_t buffer_arena = 0);
+
+  // Connects to the given endpoints (TCP or Unix domain sockets) without
+  // resolving anything.
+  connection_pool(boost::asio::io_service& io_service,
+                  endpoint_vector endpoints, const connection_options& options,
+                  std::shared_ptr<buffer_pool> buffers = nullptr,
+                  completion_executor* completions = nullptr,
+                  size_t buffer_arena = 0);
   ~connection_pool();
 
-  void async_send(request_type request, handler_type handler);
+  // Requests are buffered in one queue per priority (0 being the highest, up
+  // to 'num_priorities' - 1); use_default_priority picks the
+  // 'default_priority' option. While the request's queue is full, what
+  // happens depends on the 'on_overflow' option.
+  void async_send(request_type request, handler_type handler,
+                  size_t priority = use_default_priority);
+
+  // Returns false straight away if the request buffer is full, in which case
+  // 'handler' is never called.
+  bool try_async_send(request_type request, handler_type handler,
+                      size_t priority = use_default_priority);
+
+  // The serialized size of the requests which were accepted but are not
+  // answered yet, both buffered and in flight. Once it would exceed the
+  // 'max_buffered_bytes' option, new requests are handled according to
+  // 'on_overflow', as when the request buffer is full.
+  size_t buffered_bytes() const { return buffered_bytes_.load(); }
+
+  // Connections which take requests: 'min_connections' at first, growing with
+  // the load up to 'max_connections' and shrinking back as the ones above the
+  // minimum close their socket after 'idle_timeout_ms'.
+  size_t num_active_connections() const { return num_listening_.load(); }
+
+  // Requests accepted but not completed, and how long responses take; used to
+  // balance requests between the pools of different nodes.
+  const node_load& load() const { return load_; }
+
+  // The health of the node's endpoints, with ejection and readmission counts.
+  const endpoint_health& health() const { return health_; }
+
+  // The gathered writes issued by the pool's connections so far.
+  uint64_t num_writes() const;
+
+  // Payload buffers are recycled through this pool, in the arena returned by
+  // buffer_arena(), once a request has been written and once a response
+  // handler has returned.
+  buffer_pool& buffers() { return *buffers_; }
+  const buffer_pool& buffers() const { return *buffers_; }
+  size_t buffer_arena() const { return buffer_arena_; }
+
+  // Calls 'handler' once the node's address is resolved and, with the
+  // 'eager_connect' option, the first 'min_connections' connections tried to
+  // connect; with the last error met on the way, if any.
+  void async_wait_ready(ready_handler_type handler);
 
  private:
   struct packaged_request {
@@ -39,17 +110,94 @@ class connection_pool {
     handler_type handler;
   };
 
+  // Given to the connection with a request: accounts for the response within
+  // the pool, then calls the request's handler. Requests sent together on a
+  // pipeline slot share a count of the ones left in 'batch' (null for a
+  // request sent alone); the slot is free again once it drops to zero.
+  struct response_handler {
+    void operator()(error_type error, response_type& response);
+
+    transient_ref<connection_pool> pool;
+    size_t i_conn;
+    bool reserved;
+    size_t bytes;
+    timing_wheel::time_point sent_at;
+    std::shared_ptr<std::atomic<size_t>> batch;
+    handler_type handler;
+  };
+
+  connection_pool(boost::asio::io_service& io_service,
+                  const connection_options& options,
+                  std::shared_ptr<buffer_pool> buffers,
+                  completion_executor* completions, size_t buffer_arena);
+
   void resolve(size_t max_connections, std::string hostname, uint16_t port);
   void report_resolution_error(boost::system::error_code asio_error);
+  void reject(request_type& request, handler_type handler,
+              std::errc error = std::errc::no_buffer_space);
+  bool shed_oldest(size_t priority);
+  size_t resolve_priority(size_t priority) const;
+
+  bool try_reserve_bytes(size_t bytes);
+  void reserve_bytes(size_t bytes);
+  void release_bytes(size_t bytes);
+
   void create_connections(size_t max_connections);
-  void notify_connection_ready(connection_type& connection);
-  void send_request(connection_type& connection, packaged_request packaged);
+  void on_connected(error_type error);
+  void set_ready(error_type error);
+  void grow_if_queued();
+  void grow();
+  void retire(size_t i_conn);
+  void notify_connection_ready(size_t i_conn, bool reserved);
+  void send_request(size_t i_conn, bool reserved, packaged_request packaged);
+  bool fail_if_expired(packaged_request& packaged,
+                       timing_wheel::time_point now);
+  void finish_request(size_t i_conn, bool reserved, size_t bytes,
+                      timing_wheel::time_point sent_at,
+                      std::atomic<size_t>* batch);
+
+  // Posts a call to the handler of a request which failed before reaching a
+  // connection.
+  template <class Function>
+  void deliver(Function function);
+
+  static void deliver_response(handler_type& handler, error_type error,
+                               response_type& response,
+                               std::shared_ptr<buffer_pool>& buffers,
+                               size_t buffer_arena);
 
   boost::asio::io_service& io_service_;
   std::vector<std::unique_ptr<connection_type>> connections_;
-  async_queue<packaged_request> request_queue_;
-  uint64_t connection_timeout_ms_;
+  async_priority_queue<packaged_request> request_queue_;
+  const connection_options options_;
+  const size_t min_connections_;
+  const std::shared_ptr<buffer_pool> buffers_;
+  const size_t buffer_arena_;
+  completion_executor* const completions_;
+  const std::unique_ptr<timing_wheel> deadlines_;
   endpoint_vector endpoints_;
+  endpoint_health health_;
+
+  std::atomic<size_t> buffered_bytes_{0};
+  std::atomic<uint32_t> num_budget_waiters_{0};
+  std::mutex budget_mutex_;
+  std::condition_variable budget_released_;
+
+  // 'connections_' is only filled once, then 'num_created_' is set. The
+  // connections which wait on the request queue, with their connection index
+  // as the tag, are 'listening_'; there are 'num_listening_' of them.
+  std::atomic<size_t> num_created_{0};
+  std::atomic<size_t> num_listening_{0};
+  std::unique_ptr<std::atomic<bool>[]> listening_;
+  // When a connection last took a request, as a clock_type::time_point count.
+  std::atomic<timing_wheel::clock_type::rep> last_taken_;
+  node_load load_;
+
+  std::mutex ready_mutex_;
+  bool ready_ = false;
+  error_type ready_error_;
+  size_t num_connecting_ = 0;
+  std::vector<ready_handler_type> ready_waiters_;
 
   transient<connection_pool> transient_;
 };
@@ -57,16 +205,62 @@ class connection_pool {
 template <class Connection>
 connection_pool<Connection>::connection_pool(
     boost::asio::io_service& io_service, std::string hostname, uint16_t port,
-    size_t max_connections, size_t highwatermark,
-    uint64_t connection_timeout_ms)
+    const connection_options& options, std::shared_ptr<buffer_pool> buffers,
+    completion_executor* completions, size_t buffer_arena)
+    : connection_pool{io_service, options, std::move(buffers), completions,
+                      buffer_arena} {
+  resolve(options.max_connections(), std::move(hostname), port);
+}
+
+template <class Connection>
+connection_pool<Connection>::connection_pool(
+    boost::asio::io_service& io_service, endpoint_vector endpoints,
+    const connection_options& options, std::shared_ptr<buffer_pool> buffers,
+    completion_executor* completions, size_t buffer_arena)
+    : connection_pool{io_service, options, std::move(buffers), completions,
+                      buffer_arena} {
+  endpoints_ = std::move(endpoints);
+  create_connections(options.max_connections());
+}
+
+template <class Connection>
+connection_pool<Connection>::connection_pool(
+    boost::asio::io_service& io_service, const connection_options& options,
+    std::shared_ptr<buffer_pool> buffers, completion_executor* completions,
+    size_t buffer_arena)
     : io_service_(io_service),
-      request_queue_{highwatermark, max_connections},
-      connection_timeout_ms_{connection_timeout_ms},
+      request_queue_{options.num_priorities(), options.highwatermark(),
+                     (options.max_connections() -
+                      options.reserved_connections()) *
+                         options.pipeline_depth(),
+                     options.reserved_connections() * options.pipeline_depth(),
+                     options.priority_weights()},
+      options_(options),
+      min_connections_{options.defaulted_min_connections()
+                           ? options.max_connections()
+                           : options.min_connections()},
+      buffers_{buffers ? std::move(buffers)
+                       : std::make_shared<buffer_pool>(
+                             options.max_pooled_buffer_bytes())},
+      buffer_arena_{buffer_arena},
+      completions_{completions},
+      deadlines_{new timing_wheel{io_service}},
+      health_{options},
+      last_taken_{
+          timing_wheel::clock_type::now().time_since_epoch().count()},
       transient_{*this} {
-  RIAKPP_CHECK_GE(max_connections, 0)
+  RIAKPP_CHECK_GT(options.max_connections(), 0)
       << "Number of connections must be non-zero.";
-  connections_.reserve(max_connections);
-  resolve(max_connections, std::move(hostname), port);
+  RIAKPP_CHECK_GT(options.pipeline_depth(), 0)
+      << "Pipeline depth must be non-zero.";
+  RIAKPP_CHECK_LT(options.default_priority(), options.num_priorities())
+      << "The default priority must be one of the 'num_priorities'.";
+  RIAKPP_CHECK_LE(min_connections_, options.max_connections())
+      << "The minimum number of connections is above the maximum.";
+  RIAKPP_CHECK(options.reserved_connections() == 0 ||
+               options.reserved_connections() < min_connections_)
+      << "Some connections must serve every priority.";
+  connections_.reserve(options.max_connections());
 }
 
 template <class Connection>
@@ -78,8 +272,142 @@ connection_pool<Connection>::~connection_pool() {
 
 template <class Connection>
 void connection_pool<Connection>::async_send(request_type request,
-                                             handler_type handler) {
-  request_queue_.emplace(std::move(request), std::move(handler));
+                                             handler_type handler,
+                                             size_t priority) {
+  priority = resolve_priority(priority);
+  auto bytes = request.payload.size();
+  load_.add_outstanding();
+  // Growing first may make room for this request. The pool may be destroyed
+  // by a handler as soon as the request is queued, so it is not touched after.
+  // A request which cannot be queued fails through 'reject': with
+  // no_buffer_space, or operation_canceled once the pool is being destroyed.
+  grow_if_queued();
+  switch (options_.on_overflow()) {
+    case overflow_policy::block:
+      reserve_bytes(bytes);
+      if (!request_queue_.emplace(priority, std::move(request),
+                                  std::move(handler))) {
+        release_bytes(bytes);
+        reject(request, std::move(handler), std::errc::operation_canceled);
+      }
+      break;
+
+    case overflow_policy::fail:
+      if (!try_reserve_bytes(bytes)) {
+        reject(request, std::move(handler));
+      } else if (!request_queue_.try_emplace(priority, std::move(request),
+                                             std::move(handler))) {
+        release_bytes(bytes);
+        reject(request, std::move(handler),
+               request_queue_.closed() ? std::errc::operation_canceled
+                                       : std::errc::no_buffer_space);
+      }
+      break;
+
+    case overflow_policy::shed_oldest:
+      // Only buffered requests can be shed; if the budget or the queue is
+      // taken up by requests in flight, or by ones which cannot be shed, the
+      // new request fails instead.
+      while (!try_reserve_bytes(bytes)) {
+        if (!shed_oldest(priority)) {
+          reject(request, std::move(handler));
+          return;
+        }
+      }
+      while (!request_queue_.try_emplace(priority, std::move(request),
+                                         std::move(handler))) {
+        if (request_queue_.closed()) {
+          release_bytes(bytes);
+          reject(request, std::move(handler), std::errc::operation_canceled);
+          return;
+        }
+        if (!shed_oldest(priority)) {
+          release_bytes(bytes);
+          reject(request, std::move(handler));
+          return;
+        }
+      }
+      break;
+  }
+}
+
+template <class Connection>
+bool connection_pool<Connection>::try_async_send(request_type request,
+                                                 handler_type handler,
+                                                 size_t priority) {
+  priority = resolve_priority(priority);
+  auto bytes = request.payload.size();
+  load_.add_outstanding();
+  grow_if_queued();
+  if (try_reserve_bytes(bytes)) {
+    if (request_queue_.try_emplace(priority, std::move(request),
+                                   std::move(handler))) {
+      return true;
+    }
+    release_bytes(bytes);
+  }
+  load_.remove_outstanding();
+  buffers_->release(std::move(request.payload), buffer_arena_);
+  return false;
+}
+
+template <class Connection>
+void connection_pool<Connection>::reject(request_type& request,
+                                         handler_type handler,
+                                         std::errc error) {
+  load_.remove_outstanding();
+  buffers_->release(std::move(request.payload), buffer_arena_);
+  deliver(std::bind(std::move(handler), std::make_error_code(error),
+                    response_type{}));
+}
+
+template <class Connection>
+bool connection_pool<Connection>::shed_oldest(size_t priority) {
+  return request_queue_.try_shed(priority, [this](packaged_request oldest) {
+    release_bytes(oldest.request.payload.size());
+    reject(oldest.request, std::move(oldest.handler));
+  });
+}
+
+template <class Connection>
+size_t connection_pool<Connection>::resolve_priority(size_t priority) const {
+  if (priority == use_default_priority) return options_.default_priority();
+  RIAKPP_CHECK_LT(priority, options_.num_priorities())
+      << "Priorities go from 0 to 'num_priorities' - 1.";
+  return priority;
+}
+
+template <class Connection>
+bool connection_pool<Connection>::try_reserve_bytes(size_t bytes) {
+  auto max_bytes = options_.max_buffered_bytes();
+  auto buffered = buffered_bytes_.load();
+  do {
+    // A request is always let through if nothing else is buffered, so that
+    // one larger than the whole budget does not wait forever.
+    if (max_bytes > 0 && buffered > 0 && buffered + bytes > max_bytes) {
+      return false;
+    }
+  } while (!buffered_bytes_.compare_exchange_weak(buffered, buffered + bytes));
+  return true;
+}
+
+template <class Connection>
+void connection_pool<Connection>::reserve_bytes(size_t bytes) {
+  if (try_reserve_bytes(bytes)) return;
+  // Sequentially consistent counters: either 'release_bytes' sees this thread
+  // waiting, or this thread sees the released bytes.
+  std::unique_lock<std::mutex> lock{budget_mutex_};
+  ++num_budget_waiters_;
+  budget_released_.wait(lock, [&] { return try_reserve_bytes(bytes); });
+  --num_budget_waiters_;
+}
+
+template <class Connection>
+void connection_pool<Connection>::release_bytes(size_t bytes) {
+  buffered_bytes_ -= bytes;
+  if (num_budget_waiters_.load() == 0) return;
+  std::lock_guard<std::mutex> lock{budget_mutex_};
+  budget_released_.notify_all();
 }
 
 template <class Connection>
@@ -96,9 +424,12 @@ void connection_pool<Connection>::resolve(size_t max_connections,
           boost::asio::ip::tcp::resolver::iterator endpoint_begin) {
         std::unique_ptr<resolver> resolver_destroyer{resolver_raw};
         if (ec) {
+          set_ready(error_type{ec.value(), std::generic_category()});
           report_resolution_error(ec);
         } else {
-          endpoints_.assign(endpoint_begin, decltype(endpoint_begin) {});
+          for (auto it = endpoint_begin; it != decltype(it){}; ++it) {
+            endpoints_.emplace_back(it->endpoint());
+          }
           create_connections(max_connections);
         }
       }));
@@ -109,51 +440,294 @@ void connection_pool<Connection>::report_resolution_error(
     boost::system::error_code asio_error) {
   request_queue_.async_pop(
       transient_.wrap([this, asio_error](packaged_request packaged) {
-        io_service_.post(
-            std::bind(std::move(packaged.handler),
-                      error_type{asio_error.value(), std::generic_category()},
-                      response_type{}));
+        release_bytes(packaged.request.payload.size());
+        load_.remove_outstanding();
+        deliver(std::bind(
+            std::move(packaged.handler),
+            error_type{asio_error.value(), std::generic_category()},
+            response_type{}));
         report_resolution_error(asio_error);
       }));
 }
 
+template <class Connection>
+uint64_t connection_pool<Connection>::num_writes() const {
+  uint64_t num_writes = 0;
+  auto num_created = num_created_.load(std::memory_order_acquire);
+  for (size_t i_conn = 0; i_conn < num_created; ++i_conn) {
+    num_writes += connections_[i_conn]->num_writes();
+  }
+  return num_writes;
+}
+
+template <class Connection>
+void connection_pool<Connection>::async_wait_ready(
+    ready_handler_type handler) {
+  std::unique_lock<std::mutex> lock{ready_mutex_};
+  if (!ready_) {
+    ready_waiters_.emplace_back(std::move(handler));
+    return;
+  }
+  auto error = ready_error_;
+  lock.unlock();
+  io_service_.post(
+      make_move_on_copy(std::bind(std::move(handler), error)));
+}
+
+template <class Connection>
+void connection_pool<Connection>::on_connected(error_type error) {
+  std::unique_lock<std::mutex> lock{ready_mutex_};
+  if (error) ready_error_ = error;
+  if (--num_connecting_ > 0) return;
+  error = ready_error_;
+  lock.unlock();
+  set_ready(error);
+}
+
+template <class Connection>
+void connection_pool<Connection>::set_ready(error_type error) {
+  std::vector<ready_handler_type> waiters;
+  {
+    std::lock_guard<std::mutex> lock{ready_mutex_};
+    ready_ = true;
+    ready_error_ = error;
+    waiters.swap(ready_waiters_);
+  }
+  for (auto& waiter : waiters) {
+    io_service_.post(make_move_on_copy(std::bind(std::move(waiter), error)));
+  }
+}
+
 template <class Connection>
 void connection_pool<Connection>::create_connections(size_t max_connections) {
   RIAKPP_CHECK_GE(endpoints_.size(), 0);
+  // The connections the pool never shrinks below stay open however long they
+  // are idle.
+  auto kept_open = connection_options{options_}.idle_timeout_ms(0);
+  health_.set_num_endpoints(endpoints_.size());
+  listening_.reset(new std::atomic<bool>[max_connections]);
   for (size_t i_conn = 0; i_conn < max_connections; ++i_conn) {
-    connections_.emplace_back(
-        new connection_type{io_service_, endpoints_.begin(), endpoints_.end(),
-                            connection_timeout_ms_});
+    listening_[i_conn] = i_conn < min_connections_;
+    connections_.emplace_back(new connection_type{
+        io_service_, endpoints_.begin(), endpoints_.end(),
+        i_conn < min_connections_ ? kept_open : options_, buffers_.get(),
+        deadlines_.get(), &health_, buffer_arena_});
+    if (i_conn >= min_connections_) {
+      connections_.back()->on_idle_close(
+          transient_.wrap([this, i_conn] { retire(i_conn); }));
+    }
   }
 
-  for (auto& connection_ptr : connections_) {
-    notify_connection_ready(*connection_ptr);
+  // Each connection accepts up to 'pipeline_depth' requests at once, so it
+  // waits on the queue once for every free pipeline slot. The first
+  // 'reserved_connections' only serve the highest priority.
+  for (size_t i_slot = 0; i_slot < options_.pipeline_depth(); ++i_slot) {
+    for (size_t i_conn = 0; i_conn < min_connections_; ++i_conn) {
+      notify_connection_ready(i_conn,
+                              i_conn < options_.reserved_connections());
+    }
+  }
+  num_listening_ = min_connections_;
+  num_created_ = connections_.size();
+
+  if (!options_.eager_connect() || min_connections_ == 0) {
+    set_ready({});
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{ready_mutex_};
+    num_connecting_ = min_connections_;
+  }
+  for (size_t i_conn = 0; i_conn < min_connections_; ++i_conn) {
+    connections_[i_conn]->async_connect(transient_.wrap(
+        [this](error_type error) { on_connected(error); }));
   }
 }
 
 template <class Connection>
-void connection_pool<Connection>::notify_connection_ready(
-    connection_type& connection) {
-  request_queue_.async_pop(
-      transient_.wrap([this, &connection](packaged_request packaged) {
-        send_request(connection, std::move(packaged));
-      }));
+void connection_pool<Connection>::grow_if_queued() {
+  // Called before queueing another request, which would take the number of
+  // buffered requests over the threshold.
+  auto queued = request_queue_.size();
+  if (queued == 0) {
+    // With no minimum, nothing may be waiting to take even this request.
+    if (num_listening_.load() == 0) grow();
+    return;
+  }
+  if (queued >= options_.grow_queue_depth()) {
+    grow();
+  } else if (options_.grow_wait_ms() > 0) {
+    // Requests are buffered, but no connection has taken one for a while.
+    using clock_type = timing_wheel::clock_type;
+    auto last_taken = clock_type::time_point{
+        clock_type::duration{last_taken_.load(std::memory_order_relaxed)}};
+    if (clock_type::now() - last_taken >=
+        std::chrono::milliseconds(options_.grow_wait_ms())) {
+      grow();
+    }
+  }
+}
+
+template <class Connection>
+void connection_pool<Connection>::grow() {
+  // Picks the first connection which does not listen. Reserved connections
+  // always do, so this one serves every priority.
+  auto num_created = num_created_.load();
+  for (auto i_conn = min_connections_; i_conn < num_created; ++i_conn) {
+    bool listening = false;
+    if (!listening_[i_conn].compare_exchange_strong(listening, true)) {
+      continue;
+    }
+    ++num_listening_;
+    for (size_t i_slot = 0; i_slot < options_.pipeline_depth(); ++i_slot) {
+      notify_connection_ready(i_conn, false);
+    }
+    return;
+  }
+}
+
+template <class Connection>
+void connection_pool<Connection>::retire(size_t i_conn) {
+  // The connection closed its socket for being idle, so all its pipeline slots
+  // should be waiting on the queue. If some are not, a request is on its way
+  // to the connection: it keeps listening, with the cancelled slots waiting
+  // again.
+  auto num_cancelled = request_queue_.cancel(i_conn);
+  if (num_cancelled == options_.pipeline_depth()) {
+    listening_[i_conn] = false;
+    --num_listening_;
+    return;
+  }
+  for (size_t i_slot = 0; i_slot < num_cancelled; ++i_slot) {
+    notify_connection_ready(i_conn, false);
+  }
+}
+
+template <class Connection>
+void connection_pool<Connection>::notify_connection_ready(size_t i_conn,
+                                                          bool reserved) {
+  auto send = transient_.wrap(
+      [this, i_conn, reserved](packaged_request packaged) {
+        send_request(i_conn, reserved, std::move(packaged));
+      });
+  if (reserved) {
+    request_queue_.async_pop_reserved(std::move(send));
+  } else {
+    request_queue_.async_pop(std::move(send), i_conn);
+  }
 }
 
 template <class Connection>
-void connection_pool<Connection>::send_request(connection_type& connection,
+void connection_pool<Connection>::send_request(size_t i_conn, bool reserved,
                                                packaged_request packaged) {
-  using namespace std::placeholders;
-  auto call_and_notify =
-    [this, &connection](handler_type& original_handler, error_type error,
-                        response_type& response) {
-    notify_connection_ready(connection);
-    io_service_.post(
-        std::bind(std::move(original_handler), error, std::move(response)));
+  auto now = timing_wheel::clock_type::now();
+  if (options_.grow_wait_ms() > 0) {
+    last_taken_.store(now.time_since_epoch().count(),
+                      std::memory_order_relaxed);
+  }
+  if (fail_if_expired(packaged, now)) {
+    notify_connection_ready(i_conn, reserved);
+    return;
+  }
+
+  // The requests buffered behind this one go along with it on the same slot,
+  // so that the connection gathers them into a single write. Each one is sent
+  // with 'more' set once the next is known, to hold the write back until the
+  // last.
+  auto& connection = *connections_[i_conn];
+  std::shared_ptr<std::atomic<size_t>> batch;
+  size_t batch_size = 1;
+  auto send = [&](packaged_request& sent, bool more) {
+    auto bytes = sent.request.payload.size();
+    connection.async_send(
+        std::move(sent.request),
+        response_handler{transient_.ref(), i_conn, reserved, bytes, now, batch,
+                         std::move(sent.handler)},
+        more);
   };
-  auto wrapped = transient_.wrap(std::bind(
-      std::move(call_and_notify), std::move(packaged.handler), _1, _2));
-  connection.async_send(std::move(packaged.request), std::move(wrapped));
+  while (!reserved && batch_size < options_.max_write_batch()) {
+    bool popped = request_queue_.try_pop([&](packaged_request next) {
+      if (fail_if_expired(next, now)) return;
+      if (!batch) batch = std::make_shared<std::atomic<size_t>>(1);
+      batch->fetch_add(1, std::memory_order_relaxed);
+      send(packaged, true);
+      packaged = std::move(next);
+      ++batch_size;
+    });
+    if (!popped) break;
+  }
+  send(packaged, false);
+}
+
+template <class Connection>
+bool connection_pool<Connection>::fail_if_expired(
+    packaged_request& packaged, timing_wheel::time_point now) {
+  if (packaged.request.expires_at > now) return false;
+  // The caller gave up while the request was buffered: fail it without
+  // taking up the connection.
+  release_bytes(packaged.request.payload.size());
+  load_.remove_outstanding();
+  buffers_->release(std::move(packaged.request.payload), buffer_arena_);
+  deliver(std::bind(std::move(packaged.handler),
+                    std::make_error_code(std::errc::timed_out),
+                    response_type{}));
+  return true;
+}
+
+template <class Connection>
+void connection_pool<Connection>::finish_request(
+    size_t i_conn, bool reserved, size_t bytes,
+    timing_wheel::time_point sent_at, std::atomic<size_t>* batch) {
+  release_bytes(bytes);
+  load_.remove_outstanding();
+  load_.record_latency(timing_wheel::clock_type::now() - sent_at);
+  if (!batch || batch->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    notify_connection_ready(i_conn, reserved);
+  }
+}
+
+template <class Connection>
+void connection_pool<Connection>::response_handler::operator()(
+    error_type error, response_type& response) {
+  std::shared_ptr<buffer_pool> buffers;
+  size_t buffer_arena = 0;
+  {
+    auto locked = pool.lock();
+    if (!locked) return;
+    locked->finish_request(i_conn, reserved, bytes, sent_at, batch.get());
+    if (locked->completions_) {
+      // The response buffer goes with the handler and is released on the
+      // completion thread once the handler returns.
+      locked->completions_->post(std::bind(
+          &connection_pool::deliver_response, std::move(handler), error,
+          std::move(response), locked->buffers_, locked->buffer_arena_));
+      return;
+    }
+    buffers = locked->buffers_;
+    buffer_arena = locked->buffer_arena_;
+  }
+  // The connection already posted the response to the io_service, so the
+  // handler runs straight away; outside of the lock, since it may destroy the
+  // pool.
+  deliver_response(handler, error, response, buffers, buffer_arena);
+}
+
+template <class Connection>
+template <class Function>
+void connection_pool<Connection>::deliver(Function function) {
+  if (completions_) {
+    completions_->post(std::move(function));
+  } else {
+    io_service_.post(make_move_on_copy(std::move(function)));
+  }
+}
+
+template <class Connection>
+void connection_pool<Connection>::deliver_response(
+    handler_type& handler, error_type error, response_type& response,
+    std::shared_ptr<buffer_pool>& buffers, size_t buffer_arena) {
+  handler(error, response);
+  buffers->release(std::move(response), buffer_arena);
 }
 
 }  // namespace riak
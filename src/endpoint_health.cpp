@@ -0,0 +1,159 @@
+#include "endpoint_health.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include "check.hpp"
+#include "debug_log.hpp"
+
+namespace riak {
+
+endpoint_health::endpoint_health(const connection_options& options)
+    : eject_after_failures_{options.eject_after_failures()},
+      outlier_latency_factor_{options.outlier_latency_factor()},
+      backoff_base_{options.backoff_base_ms()},
+      backoff_max_{options.backoff_max_ms()},
+      connection_timeout_{options.connection_timeout_ms()} {
+  RIAKPP_CHECK_GT(options.backoff_base_ms(), 0)
+      << "The backoff must be at least one millisecond.";
+  RIAKPP_CHECK_LE(options.backoff_base_ms(), options.backoff_max_ms())
+      << "The base backoff cannot exceed the maximum one.";
+}
+
+void endpoint_health::set_num_endpoints(size_t num_endpoints) {
+  endpoints_.reset(new endpoint_state[num_endpoints]);
+  num_endpoints_ = num_endpoints;
+}
+
+void endpoint_health::connect_order(time_point now,
+                                    std::vector<size_t>& order) {
+  order.clear();
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto num_endpoints = num_endpoints_.load();
+  for (size_t i_endpoint = 0; i_endpoint < num_endpoints; ++i_endpoint) {
+    if (!endpoints_[i_endpoint].ejected) order.push_back(i_endpoint);
+  }
+  // With no healthy endpoint left, the connection probes the ejected ones;
+  // they are held back for as long as the connect may take, so that the other
+  // connections fail straight away rather than all probing at once.
+  bool probing = order.empty();
+  for (size_t i_endpoint = 0; i_endpoint < num_endpoints; ++i_endpoint) {
+    auto& endpoint = endpoints_[i_endpoint];
+    if (endpoint.ejected && endpoint.retry_at <= now) {
+      order.push_back(i_endpoint);
+      if (probing) endpoint.retry_at = now + connection_timeout_;
+    }
+  }
+  if (probing) update_earliest_retry();
+}
+
+void endpoint_health::report_connected(size_t endpoint_index,
+                                       time_point now) {
+  auto& endpoint = endpoints_[endpoint_index];
+  if (!endpoint.ejected.load(std::memory_order_relaxed)) return;
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!endpoint.ejected) return;
+  RIAKPP_DLOG << "Readmitting endpoint " << endpoint_index << ".";
+  endpoint.ejected = false;
+  endpoint.failures = 0;
+  endpoint.latency.reset();
+  endpoint.readmitted_at = now;
+  --num_ejected_;
+  ++readmissions_;
+  update_earliest_retry();
+}
+
+void endpoint_health::report_failure(size_t endpoint_index, time_point now) {
+  auto& endpoint = endpoints_[endpoint_index];
+  auto failures = ++endpoint.failures;
+  bool ejected = endpoint.ejected.load(std::memory_order_relaxed);
+  if (!ejected &&
+      (eject_after_failures_ == 0 || failures < eject_after_failures_)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (endpoint.ejected) {
+    // A probe failed.
+    back_off(endpoint, now);
+  } else {
+    eject(endpoint, now);
+  }
+}
+
+void endpoint_health::report_response(size_t endpoint_index,
+                                      std::chrono::nanoseconds latency,
+                                      time_point now) {
+  auto& endpoint = endpoints_[endpoint_index];
+  if (endpoint.failures.load(std::memory_order_relaxed) != 0) {
+    endpoint.failures = 0;
+  }
+  if (outlier_latency_factor_ == 0) return;
+  endpoint.latency.record(latency);
+  if (endpoint.ejected.load(std::memory_order_relaxed) ||
+      !latency_outlier(endpoint_index)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!endpoint.ejected && latency_outlier(endpoint_index)) {
+    eject(endpoint, now);
+  }
+}
+
+void endpoint_health::eject(endpoint_state& endpoint, time_point now) {
+  RIAKPP_DLOG << "Ejecting endpoint " << &endpoint - endpoints_.get() << ".";
+  // An endpoint which proved healthy for a while starts over from the base
+  // backoff.
+  if (now - endpoint.readmitted_at >= backoff_max_) endpoint.num_backoffs = 0;
+  endpoint.ejected = true;
+  ++num_ejected_;
+  ++ejections_;
+  back_off(endpoint, now);
+}
+
+void endpoint_health::back_off(endpoint_state& endpoint, time_point now) {
+  auto backoff = backoff_max_;
+  if (endpoint.num_backoffs < 32 &&
+      backoff_base_ * (int64_t{1} << endpoint.num_backoffs) < backoff_max_) {
+    backoff = backoff_base_ * (int64_t{1} << endpoint.num_backoffs);
+  }
+  ++endpoint.num_backoffs;
+
+  // Jitter spreads the retries of connections which failed together over the
+  // second half of the backoff.
+  static thread_local std::minstd_rand engine{std::random_device{}()};
+  auto half = backoff.count() / 2;
+  auto jitter = std::uniform_int_distribution<int64_t>{0, half}(engine);
+  endpoint.retry_at = now + std::chrono::milliseconds{backoff.count() - half +
+                                                      jitter};
+  update_earliest_retry();
+}
+
+void endpoint_health::update_earliest_retry() {
+  auto earliest = time_point::max();
+  auto num_endpoints = num_endpoints_.load();
+  for (size_t i_endpoint = 0; i_endpoint < num_endpoints; ++i_endpoint) {
+    const auto& endpoint = endpoints_[i_endpoint];
+    if (endpoint.ejected) earliest = std::min(earliest, endpoint.retry_at);
+  }
+  earliest_retry_.store(earliest.time_since_epoch().count(),
+                        std::memory_order_relaxed);
+}
+
+bool endpoint_health::latency_outlier(size_t endpoint_index) const {
+  // Compared with the fastest other healthy endpoint; there must be one, so
+  // the last healthy endpoint is never ejected this way.
+  auto latency_ns = endpoints_[endpoint_index].latency.ns();
+  uint64_t best_ns = 0;
+  auto num_endpoints = num_endpoints_.load();
+  for (size_t i_endpoint = 0; i_endpoint < num_endpoints; ++i_endpoint) {
+    const auto& other = endpoints_[i_endpoint];
+    auto other_ns = other.latency.ns();
+    if (i_endpoint == endpoint_index || other.ejected || other_ns == 0) {
+      continue;
+    }
+    if (best_ns == 0 || other_ns < best_ns) best_ns = other_ns;
+  }
+  return best_ns > 0 && latency_ns > best_ns * outlier_latency_factor_;
+}
+
+}  // namespace riak
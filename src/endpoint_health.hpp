@@ -0,0 +1,105 @@
+#ifndef RIAKPP_ENDPOINT_HEALTH_HPP_
+#define RIAKPP_ENDPOINT_HEALTH_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "connection_options.hpp"
+#include "load_balancer.hpp"
+#include "timing_wheel.hpp"
+
+namespace riak {
+
+// The health of the endpoints shared by a pool's connections, which report
+// their connects, timeouts and responses to it and ask it which endpoints to
+// connect to. An endpoint is ejected after too many consecutive failures or
+// when its latency is an outlier (see the 'eject_after_failures' and
+// 'outlier_latency_factor' options), and readmitted once a connect to it
+// succeeds after its backoff. An endpoint which is ejected again soon after
+// being readmitted backs off for twice as long as the last time. Thread-safe.
+class endpoint_health {
+ public:
+  using time_point = timing_wheel::time_point;
+
+  explicit endpoint_health(const connection_options& options);
+
+  endpoint_health(const endpoint_health&) = delete;
+  endpoint_health& operator=(const endpoint_health&) = delete;
+
+  // Must be called once, before anything is reported.
+  void set_num_endpoints(size_t num_endpoints);
+
+  // Fills 'order' with the indices of the endpoints to try, in order: the
+  // healthy ones, then the ejected ones whose backoff has elapsed. Empty if
+  // every endpoint is still backing off.
+  void connect_order(time_point now, std::vector<size_t>& order);
+
+  void report_connected(size_t endpoint, time_point now);
+
+  // A connect to, or a request sent over, the endpoint failed.
+  void report_failure(size_t endpoint, time_point now);
+
+  // The endpoint answered a request in 'latency'.
+  void report_response(size_t endpoint, std::chrono::nanoseconds latency,
+                       time_point now);
+
+  bool ejected(size_t endpoint) const {
+    return endpoints_[endpoint].ejected.load(std::memory_order_relaxed);
+  }
+
+  // False while every endpoint is ejected and backing off.
+  bool available(time_point now) const {
+    return num_ejected_.load(std::memory_order_relaxed) <
+               num_endpoints_.load(std::memory_order_relaxed) ||
+           now.time_since_epoch().count() >=
+               earliest_retry_.load(std::memory_order_relaxed);
+  }
+
+  // Number of times an endpoint was ejected, respectively readmitted.
+  uint64_t ejections() const { return ejections_.load(); }
+  uint64_t readmissions() const { return readmissions_.load(); }
+
+ private:
+  struct endpoint_state {
+    // Read without the lock on every response.
+    std::atomic<uint32_t> failures{0};
+    std::atomic<bool> ejected{false};
+    latency_average latency;
+
+    uint32_t num_backoffs = 0;
+    time_point retry_at;
+    time_point readmitted_at;
+  };
+
+  // Called with the lock held.
+  void eject(endpoint_state& endpoint, time_point now);
+  void back_off(endpoint_state& endpoint, time_point now);
+  void update_earliest_retry();
+
+  bool latency_outlier(size_t endpoint) const;
+
+  const uint32_t eject_after_failures_;
+  const uint32_t outlier_latency_factor_;
+  const std::chrono::milliseconds backoff_base_;
+  const std::chrono::milliseconds backoff_max_;
+  const std::chrono::milliseconds connection_timeout_;
+
+  std::mutex mutex_;
+  std::unique_ptr<endpoint_state[]> endpoints_;
+  std::atomic<size_t> num_endpoints_{0};
+  std::atomic<size_t> num_ejected_{0};
+  // The earliest 'retry_at' of the ejected endpoints, as a time_point count.
+  std::atomic<timing_wheel::clock_type::rep> earliest_retry_{0};
+
+  std::atomic<uint64_t> ejections_{0};
+  std::atomic<uint64_t> readmissions_{0};
+};
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_ENDPOINT_HEALTH_HPP_
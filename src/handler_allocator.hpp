@@ -0,0 +1,117 @@
+#ifndef RIAKPP_HANDLER_ALLOCATOR_HPP_
+#define RIAKPP_HANDLER_ALLOCATOR_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/handler_invoke_hook.hpp>
+
+namespace riak {
+
+// A small arena for the handlers of a single I/O object. It holds a fixed
+// number of slots, enough for the operations the object can have outstanding
+// at the same time; allocations which do not fit fall back to the heap.
+//
+// Slots may be allocated and deallocated concurrently from different threads.
+// Handlers may outlive the I/O object they were created for (e.g. operations
+// aborted when it is destroyed), so the memory is shared with the handlers.
+class handler_memory {
+ public:
+  static constexpr size_t num_slots = 6;
+  static constexpr size_t slot_size = 1024;
+
+  handler_memory() = default;
+
+  handler_memory(const handler_memory&) = delete;
+  handler_memory& operator=(const handler_memory&) = delete;
+
+  inline void* allocate(size_t size);
+  inline void deallocate(void* pointer);
+
+ private:
+  struct slot {
+    typename std::aligned_storage<slot_size>::type storage;
+    std::atomic<bool> in_use{false};
+  };
+
+  std::array<slot, num_slots> slots_;
+};
+
+// Wraps a handler so that Asio allocates the memory for its operations from a
+// handler_memory. Invocation is forwarded to the wrapped handler's hook, so
+// wrapping a strand-wrapped handler keeps it on its strand.
+template <class Handler>
+class custom_alloc_handler {
+ public:
+  using handler_type = Handler;
+
+  template <class HandlerConv>
+  custom_alloc_handler(std::shared_ptr<handler_memory> memory,
+                       HandlerConv&& handler)
+      : memory_(std::move(memory)),
+        handler_(std::forward<HandlerConv>(handler)) {}
+
+  template <class... Args>
+  void operator()(Args&&... args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+  friend void* asio_handler_allocate(size_t size,
+                                     custom_alloc_handler* this_handler) {
+    return this_handler->memory_->allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, size_t,
+                                      custom_alloc_handler* this_handler) {
+    this_handler->memory_->deallocate(pointer);
+  }
+
+  template <class Function>
+  friend void asio_handler_invoke(Function&& function,
+                                  custom_alloc_handler* this_handler) {
+    using boost::asio::asio_handler_invoke;
+    asio_handler_invoke(function, std::addressof(this_handler->handler_));
+  }
+
+ private:
+  std::shared_ptr<handler_memory> memory_;
+  Handler handler_;
+};
+
+template <class Handler>
+inline custom_alloc_handler<typename std::decay<Handler>::type>
+make_custom_alloc_handler(std::shared_ptr<handler_memory> memory,
+                          Handler&& handler) {
+  return {std::move(memory), std::forward<Handler>(handler)};
+}
+
+void* handler_memory::allocate(size_t size) {
+  if (size <= slot_size) {
+    for (auto& current : slots_) {
+      if (!current.in_use.load(std::memory_order_relaxed) &&
+          !current.in_use.exchange(true, std::memory_order_acquire)) {
+        return &current.storage;
+      }
+    }
+  }
+  return ::operator new(size);
+}
+
+void handler_memory::deallocate(void* pointer) {
+  for (auto& current : slots_) {
+    if (pointer == &current.storage) {
+      current.in_use.store(false, std::memory_order_release);
+      return;
+    }
+  }
+  ::operator delete(pointer);
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_HANDLER_ALLOCATOR_HPP_
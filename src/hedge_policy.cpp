@@ -0,0 +1,98 @@
+#include "hedge_policy.hpp"
+
+#include <algorithm>
+
+#include "check.hpp"
+
+namespace riak {
+namespace {
+constexpr int64_t credits_per_hedge = 100;
+}  // namespace
+
+constexpr size_t hedge_policy::num_buckets;
+constexpr uint64_t hedge_policy::samples_per_update;
+constexpr int64_t hedge_policy::max_burst;
+
+hedge_policy::hedge_policy(const connection_options& options)
+    : enabled_{options.hedge_delay_ms() > 0 || options.hedge_percentile() > 0},
+      min_delay_{std::chrono::milliseconds(options.hedge_delay_ms())},
+      percentile_{options.hedge_percentile()},
+      credits_per_request_{options.hedge_budget_percent()},
+      delay_ns_{percentile_ > 0 ? duration::max().count() : min_delay_.count()},
+      credits_{max_burst * credits_per_hedge} {
+  RIAKPP_CHECK_LT(percentile_, 100) << "The hedge percentile must be < 100.";
+  for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+}
+
+void hedge_policy::record_latency(duration latency) {
+  if (percentile_ == 0) return;
+  auto microseconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  buckets_[bucket_of(std::max<int64_t>(microseconds, 0))].fetch_add(
+      1, std::memory_order_relaxed);
+  if (++num_samples_ % samples_per_update == 0) update_delay();
+}
+
+void hedge_policy::on_request() {
+  auto credits = credits_.fetch_add(credits_per_request_,
+                                    std::memory_order_relaxed);
+  // Concurrent requests may overshoot the cap slightly, which is harmless.
+  if (credits + credits_per_request_ > max_burst * credits_per_hedge) {
+    credits_.store(max_burst * credits_per_hedge, std::memory_order_relaxed);
+  }
+}
+
+bool hedge_policy::try_spend() {
+  auto credits = credits_.load(std::memory_order_relaxed);
+  do {
+    if (credits < credits_per_hedge) return false;
+  } while (!credits_.compare_exchange_weak(credits,
+                                           credits - credits_per_hedge,
+                                           std::memory_order_relaxed));
+  ++num_hedges_;
+  return true;
+}
+
+void hedge_policy::refund() {
+  credits_.fetch_add(credits_per_hedge, std::memory_order_relaxed);
+  --num_hedges_;
+}
+
+size_t hedge_policy::bucket_of(uint64_t microseconds) {
+  if (microseconds < 4) return microseconds;
+  // The highest bit picks the power of two, the two bits below it the bucket
+  // within it.
+  size_t high_bit = 63 - __builtin_clzll(microseconds);
+  auto bucket = (high_bit - 1) * 4 + ((microseconds >> (high_bit - 2)) & 3);
+  return std::min(bucket, num_buckets - 1);
+}
+
+uint64_t hedge_policy::bucket_ceiling(size_t bucket) {
+  if (bucket < 4) return bucket + 1;
+  auto shift = bucket / 4 - 1;
+  return (uint64_t{4 + bucket % 4} << shift) + (uint64_t{1} << shift);
+}
+
+void hedge_policy::update_delay() {
+  uint64_t total = 0;
+  std::array<uint64_t, num_buckets> counts;
+  for (size_t i_bucket = 0; i_bucket < num_buckets; ++i_bucket) {
+    // Halving the counts as they are read lets recent samples dominate.
+    auto count = buckets_[i_bucket].load(std::memory_order_relaxed);
+    buckets_[i_bucket].fetch_sub(count / 2, std::memory_order_relaxed);
+    counts[i_bucket] = count;
+    total += count;
+  }
+
+  auto target = total * percentile_ / 100;
+  uint64_t seen = 0;
+  size_t i_bucket = 0;
+  while (i_bucket + 1 < num_buckets && seen + counts[i_bucket] <= target) {
+    seen += counts[i_bucket++];
+  }
+  duration delay = std::chrono::microseconds(bucket_ceiling(i_bucket));
+  delay_ns_.store(std::max(delay, duration{min_delay_}).count(),
+                  std::memory_order_relaxed);
+}
+
+}  // namespace riak
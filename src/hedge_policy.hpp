@@ -0,0 +1,71 @@
+#ifndef RIAKPP_HEDGE_POLICY_HPP_
+#define RIAKPP_HEDGE_POLICY_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "connection_options.hpp"
+
+namespace riak {
+
+// Decides when, and how often, a request is duplicated to cut its tail
+// latency (see the 'hedge_*' options). The latency percentile is estimated
+// from a histogram of recent latencies with logarithmic buckets (four per
+// power of two microseconds), recomputed every 'samples_per_update' samples,
+// after which the counts are halved so that old samples fade away. The budget
+// is a token bucket: every request earns 'hedge_budget_percent' credits, a
+// hedge costs a hundred and no more than 'max_burst' hedges' worth build up.
+// Thread-safe.
+class hedge_policy {
+ public:
+  using duration = std::chrono::nanoseconds;
+
+  static constexpr size_t num_buckets = 192;
+  static constexpr uint64_t samples_per_update = 1024;
+  static constexpr int64_t max_burst = 10;
+
+  explicit hedge_policy(const connection_options& options);
+
+  bool enabled() const { return enabled_; }
+
+  // How long to wait for a response before hedging; duration::max() if
+  // requests should not be hedged yet, for lack of latency samples.
+  duration delay() const {
+    return duration{delay_ns_.load(std::memory_order_relaxed)};
+  }
+
+  void record_latency(duration latency);
+
+  // Called once per request which may be hedged, to earn its credits.
+  void on_request();
+
+  // Takes a hedge out of the budget; false if it is spent.
+  bool try_spend();
+  void refund();
+
+  // Number of hedges sent.
+  uint64_t num_hedges() const { return num_hedges_.load(); }
+
+ private:
+  static size_t bucket_of(uint64_t microseconds);
+  static uint64_t bucket_ceiling(size_t bucket);
+  void update_delay();
+
+  const bool enabled_;
+  const duration min_delay_;
+  const uint32_t percentile_;
+  const int64_t credits_per_request_;
+
+  std::array<std::atomic<uint64_t>, num_buckets> buckets_;
+  std::atomic<uint64_t> num_samples_{0};
+  std::atomic<duration::rep> delay_ns_;
+  std::atomic<int64_t> credits_;
+  std::atomic<uint64_t> num_hedges_{0};
+};
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_HEDGE_POLICY_HPP_
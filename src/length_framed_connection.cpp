@@ -1,145 +1,644 @@
 #include "length_framed_connection.hpp"
 
-#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <utility>
 
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 
 #include "byte_order.hpp"
 #include "check.hpp"
+#include "debug_log.hpp"
 #include "endpoint_vector.hpp"
+#include "move_on_copy.hpp"
 
 namespace riak {
 namespace io = boost::asio;
 using io::ip::tcp;
 
-template <class Handler>
-inline void set_timer(io::deadline_timer& timer, uint64_t milliseconds,
-                      Handler&& handler) {
-  if (milliseconds != length_framed_connection::no_deadline) {
-    timer.expires_from_now(boost::posix_time::milliseconds(milliseconds));
-    timer.async_wait(std::forward<Handler>(handler));
+namespace {
+inline timing_wheel::time_point expiry_after(uint64_t milliseconds) {
+  if (milliseconds == length_framed_connection::no_deadline) {
+    return timing_wheel::time_point::max();
+  }
+  return timing_wheel::clock_type::now() +
+         std::chrono::milliseconds(milliseconds);
+}
+
+inline void append_varint(std::string& payload, uint64_t value) {
+  while (value >= 0x80) {
+    payload.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  payload.push_back(static_cast<char>(value));
+}
+
+// Appends the time left until 'expires_at' as a varint 'field'; when parsed,
+// the last value of a non-repeated field wins. At least one millisecond is
+// sent, since zero means "no timeout" to the server.
+void append_timeout_field(std::string& payload, uint32_t field,
+                          timing_wheel::time_point expires_at,
+                          timing_wheel::time_point now) {
+  uint64_t remaining_ms = UINT32_MAX;
+  if (expires_at != timing_wheel::time_point::max()) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        expires_at - now).count();
+    remaining_ms = std::min<uint64_t>(std::max<int64_t>(remaining, 1),
+                                      UINT32_MAX);
   }
+  append_varint(payload, uint64_t{field} << 3);  // Wire type 0: varint.
+  append_varint(payload, remaining_ms);
+}
+
+// A socket option which Asio has no type for: an int at (Level, Name).
+template <int Level, int Name>
+class integer_option {
+ public:
+  explicit integer_option(int value) : value_{value} {}
+
+  template <class Protocol>
+  int level(const Protocol&) const { return Level; }
+  template <class Protocol>
+  int name(const Protocol&) const { return Name; }
+  template <class Protocol>
+  const int* data(const Protocol&) const { return &value_; }
+  template <class Protocol>
+  size_t size(const Protocol&) const { return sizeof(value_); }
+
+ private:
+  int value_;
+};
+
+// Refers to a vector of buffers without copying it, as Asio's write operations
+// would otherwise do for every write. The vector must outlive the operation.
+class buffers_view {
+ public:
+  using value_type = io::const_buffer;
+  using const_iterator = std::vector<io::const_buffer>::const_iterator;
+
+  explicit buffers_view(const std::vector<io::const_buffer>& buffers)
+      : buffers_{&buffers} {}
+
+  const_iterator begin() const { return buffers_->begin(); }
+  const_iterator end() const { return buffers_->end(); }
+
+ private:
+  const std::vector<io::const_buffer>* buffers_;
+};
+
+// Socket options are tuning only, so failing to set one is not an error.
+template <class Option>
+void try_set_option(io::generic::stream_protocol::socket& socket,
+                    const Option& option, const char* name) {
+  boost::system::error_code ec;
+  socket.set_option(option, ec);
+  if (ec) RIAKPP_DLOG << "Failed to set " << name << ": " << ec.message();
 }
+}  // namespace
+
+constexpr char length_framed_connection::ping_request_code;
 
 length_framed_connection::length_framed_connection(
     boost::asio::io_service& io_service, endpoint_iterator endpoints_begin,
-    endpoint_iterator endpoints_end, uint64_t connection_timeout_ms)
-    : strand_{io_service},
-      timer_{io_service},
+    endpoint_iterator endpoints_end, const connection_options& options,
+    buffer_pool* buffers, timing_wheel* deadlines, endpoint_health* health,
+    size_t buffer_arena)
+    : use_strand_{!options.shard_per_thread()},
+      strand_{io_service},
       socket_{io_service},
-      resolver_{io_service},
       endpoints_begin_{endpoints_begin},
       endpoints_end_{endpoints_end},
-      connection_timeout_ms_{connection_timeout_ms},
-      transient_{*this} {}
+      connection_timeout_ms_{options.connection_timeout_ms()},
+      idle_timeout_ms_{options.idle_timeout_ms()},
+      ping_interval_ms_{options.ping_interval_ms()},
+      max_write_batch_{options.max_write_batch()},
+      max_write_batch_bytes_{options.max_write_batch_bytes()},
+      socket_options_{options},
+      health_{health},
+      buffers_ptr_{buffers ? nullptr : new buffer_pool{
+                                           options.max_pooled_buffer_bytes()}},
+      buffers_(buffers_ptr_ ? *buffers_ptr_ : *buffers),
+      buffer_arena_{buffer_arena},
+      deadlines_ptr_{deadlines ? nullptr : new timing_wheel{io_service}},
+      deadlines_(deadlines_ptr_ ? *deadlines_ptr_ : *deadlines),
+      read_buffer_(receive_buffer_size),
+      transient_{*this} {
+  RIAKPP_CHECK_GT(max_write_batch_, 0) << "Write batches must be non-empty.";
+}
+
+length_framed_connection::request_type::request_type(std::string payload,
+                                                     uint64_t deadline_ms)
+    : payload(std::move(payload)), expires_at{expiry_after(deadline_ms)} {}
+
+length_framed_connection::~length_framed_connection() {
+  // No handler can reschedule the deadline once the transient is reset.
+  transient_.reset();
+  deadlines_.cancel(deadline_);
+}
 
 void length_framed_connection::async_send(request_type request,
-                                          handler_type handler) {
-  RIAKPP_CHECK(accepts_requests_.exchange(false));
-  payload_buffer_ = std::move(request.payload);
-  on_response_ = std::move(handler);
-  deadline_ms_ = request.deadline_ms;
-  strand_.dispatch(transient_.wrap([this] { connect(); }));
+                                          handler_type handler, bool more) {
+  dispatch(make_custom_alloc_handler(
+      handler_memory_,
+      transient_.wrap(make_move_on_copy(
+          std::bind(&length_framed_connection::enqueue, this,
+                    std::move(request), std::move(handler), more)))));
 }
 
-void length_framed_connection::connect() { connect_at(endpoints_begin_); }
+void length_framed_connection::async_connect(connect_handler_type handler) {
+  dispatch(make_custom_alloc_handler(
+      handler_memory_,
+      transient_.wrap(make_move_on_copy(
+          std::bind(&length_framed_connection::connect_now, this,
+                    std::move(handler))))));
+}
 
-void length_framed_connection::connect_at(endpoint_iterator current_endpoint) {
-  RIAKPP_CHECK(!accepts_requests_);
+void length_framed_connection::enqueue(request_type& request,
+                                       handler_type& handler, bool more) {
+  unsent_.emplace_back(request, handler);
+  pinged_since_request_ = false;
+  if (more || connecting_ || writing_) {
+    // The request waits, and may expire before anything else does.
+    if (unsent_.back().expires_at < armed_expires_at_) rearm_timer();
+    return;
+  }
 
   if (socket_.is_open()) {
     write_request();
-  } else if (current_endpoint == endpoints_end_) {
-    report(std::errc::connection_refused);
   } else {
-    set_timer(timer_, connection_timeout_ms_,
-              wrap([this](boost::system::error_code ec) {
-                if (!ec) {
-                  socket_.shutdown(tcp::socket::shutdown_both, ec);
-                  socket_.close();
-                }
-              }));
-    socket_.async_connect(
-        *current_endpoint,
-        wrap([this, current_endpoint](boost::system::error_code ec) {
-          if (!ec) {
-            write_request();
-          } else {
-            if (socket_.is_open()) {
-              socket_.shutdown(tcp::socket::shutdown_both, ec);
-              socket_.close();
-            }
-            connect_at(current_endpoint + 1);
+    connect();
+  }
+}
+
+void length_framed_connection::connect_now(connect_handler_type& handler) {
+  if (!connecting_ && socket_.is_open()) {
+    strand_.get_io_service().post(make_move_on_copy(
+        std::bind(std::move(handler), error_type{})));
+    return;
+  }
+  connect_waiters_.emplace_back(std::move(handler));
+  if (!connecting_) connect();
+}
+
+void length_framed_connection::notify_connected(error_type ec) {
+  for (auto& waiter : connect_waiters_) {
+    strand_.get_io_service().post(
+        make_move_on_copy(std::bind(std::move(waiter), ec)));
+  }
+  connect_waiters_.clear();
+}
+
+void length_framed_connection::connect() {
+  if (health_) {
+    health_->connect_order(timing_wheel::clock_type::now(), connect_order_);
+  } else {
+    connect_order_.clear();
+    auto num_endpoints = size_t(endpoints_end_ - endpoints_begin_);
+    for (size_t i_endpoint = 0; i_endpoint < num_endpoints; ++i_endpoint) {
+      connect_order_.push_back(i_endpoint);
+    }
+  }
+  connect_at(0);
+}
+
+void length_framed_connection::connect_at(size_t position) {
+  // Also reached straight away when every endpoint is backing off.
+  if (position == connect_order_.size()) {
+    notify_connected(std::make_error_code(std::errc::connection_refused));
+    fail_all(std::errc::connection_refused);
+    return;
+  }
+
+  endpoint_ = connect_order_[position];
+  connecting_ = true;
+  connect_expires_at_ = expiry_after(connection_timeout_ms_);
+  rearm_timer();
+  socket_.async_connect(
+      endpoints_begin_[endpoint_],
+      wrap([this, position](boost::system::error_code ec) {
+        auto now = timing_wheel::clock_type::now();
+        if (!ec) {
+          connecting_ = false;
+          tcp_ = is_tcp_endpoint(endpoints_begin_[endpoint_]);
+          if (health_) health_->report_connected(endpoint_, now);
+          notify_connected({});
+          apply_socket_options();
+          rearm_timer();
+          write_request();
+        } else {
+          if (socket_.is_open()) {
+            socket_.shutdown(io::socket_base::shutdown_both, ec);
+            socket_.close();
           }
-        }));
+          if (health_) health_->report_failure(endpoint_, now);
+          connect_at(position + 1);
+        }
+      }));
+}
+
+void length_framed_connection::apply_socket_options() {
+  const auto& options = socket_options_;
+  if (tcp_) {
+    try_set_option(socket_, tcp::no_delay{options.tcp_nodelay()},
+                   "TCP_NODELAY");
+  }
+  if (tcp_ && options.keepalive()) {
+    try_set_option(socket_, io::socket_base::keep_alive{true}, "SO_KEEPALIVE");
+#if defined(__linux__)
+    if (options.keepalive_idle_s() > 0) {
+      try_set_option(socket_, integer_option<IPPROTO_TCP, TCP_KEEPIDLE>{
+                                  int(options.keepalive_idle_s())},
+                     "TCP_KEEPIDLE");
+    }
+    if (options.keepalive_interval_s() > 0) {
+      try_set_option(socket_, integer_option<IPPROTO_TCP, TCP_KEEPINTVL>{
+                                  int(options.keepalive_interval_s())},
+                     "TCP_KEEPINTVL");
+    }
+    if (options.keepalive_count() > 0) {
+      try_set_option(socket_, integer_option<IPPROTO_TCP, TCP_KEEPCNT>{
+                                  int(options.keepalive_count())},
+                     "TCP_KEEPCNT");
+    }
+#endif
+  }
+  if (options.send_buffer_bytes() > 0) {
+    try_set_option(socket_, io::socket_base::send_buffer_size{
+                                int(options.send_buffer_bytes())},
+                   "SO_SNDBUF");
+  }
+  if (options.receive_buffer_bytes() > 0) {
+    try_set_option(socket_, io::socket_base::receive_buffer_size{
+                                int(options.receive_buffer_bytes())},
+                   "SO_RCVBUF");
+  }
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+  if (options.busy_poll_us() > 0) {
+    try_set_option(socket_, integer_option<SOL_SOCKET, SO_BUSY_POLL>{
+                                int(options.busy_poll_us())},
+                   "SO_BUSY_POLL");
+  }
+#endif
+  set_quickack();
+}
+
+void length_framed_connection::set_quickack() {
+#if defined(__linux__) && defined(TCP_QUICKACK)
+  if (tcp_ && socket_options_.tcp_quickack()) {
+    try_set_option(socket_, integer_option<IPPROTO_TCP, TCP_QUICKACK>{1},
+                   "TCP_QUICKACK");
   }
+#endif
 }
 
 void length_framed_connection::write_request() {
-  RIAKPP_CHECK(!accepts_requests_);
-
-  length_buffer_ = byte_order::host_to_network_long(payload_buffer_.size());
-  std::array<io::const_buffer, 2> buffers = {
-      {io::buffer(&length_buffer_, sizeof(length_buffer_)),
-       io::buffer(payload_buffer_, payload_buffer_.size())}};
-
-  io::async_write(socket_, std::move(buffers),
-                  wrap([this](boost::system::error_code ec, size_t) {
-                    if (!ec) {
-                      read_response();
-                      set_timer(timer_, deadline_ms_,
-                                wrap([this](boost::system::error_code ec) {
-                                  if (!ec) report(std::errc::timed_out);
-                                }));
-                    } else {
-                      report(ec);
+  if (unsent_.empty()) {
+    writing_ = false;
+    return;
+  }
+
+  // Gather as many queued requests as the batch limits allow (but at least
+  // one) into a single write. The requests are considered in flight as soon
+  // as they start being written, since the server may reply before the write
+  // handler gets to run. Requests which expired while waiting are failed
+  // without being written.
+  bool was_idle = in_flight_.empty();
+  auto now = timing_wheel::clock_type::now();
+  size_t batch_bytes = 0;
+  write_payloads_.clear();
+  write_lengths_.clear();
+  while (!unsent_.empty() && write_payloads_.size() < max_write_batch_) {
+    auto& request = unsent_.front();
+    if (request.expires_at <= now) {
+      if (request.ping) ping_in_flight_ = false;
+      buffers_.release(std::move(request.payload), buffer_arena_);
+      report(request.handler, std::errc::timed_out, {});
+      unsent_.pop_front();
+      continue;
+    }
+    // The batch limit counts the timeout field too; a request which does not
+    // fit is put back as it was.
+    auto unframed_size = request.payload.size();
+    if (request.timeout_field != 0) {
+      append_timeout_field(request.payload, request.timeout_field,
+                           request.expires_at, now);
+    }
+    auto request_bytes = sizeof(uint32_t) + request.payload.size();
+    if (!write_payloads_.empty() &&
+        batch_bytes + request_bytes > max_write_batch_bytes_) {
+      request.payload.resize(unframed_size);
+      break;
+    }
+    batch_bytes += request_bytes;
+    request.written_at = now;
+    write_lengths_.push_back(
+        byte_order::host_to_network_long(request.payload.size()));
+    write_payloads_.emplace_back(std::move(request.payload));
+    in_flight_.emplace_back(std::move(request));
+    unsent_.pop_front();
+  }
+  // A request written behind a ping is watched from now on.
+  bool rearm = was_idle || first_expiry(in_flight_) < armed_expires_at_;
+  if (write_payloads_.empty()) {
+    writing_ = false;
+    if (rearm) rearm_timer();
+    return;
+  }
+  writing_ = true;
+  if (rearm) rearm_timer();
+
+  write_buffers_.clear();
+  for (size_t i_request = 0; i_request < write_payloads_.size(); ++i_request) {
+    write_buffers_.push_back(
+        io::buffer(&write_lengths_[i_request], sizeof(uint32_t)));
+    write_buffers_.push_back(io::buffer(write_payloads_[i_request]));
+  }
+
+  num_writes_.fetch_add(1, std::memory_order_relaxed);
+  auto generation = socket_generation_;
+  io::async_write(socket_, buffers_view{write_buffers_},
+                  wrap([this, generation](boost::system::error_code ec,
+                                          size_t) {
+                    if (generation != socket_generation_) return;
+                    if (ec) {
+                      fail_all(ec);
+                      return;
+                    }
+                    for (auto& payload : write_payloads_) {
+                      buffers_.release(std::move(payload), buffer_arena_);
                     }
+                    if (!reading_ && !in_flight_.empty()) read_response();
+                    write_request();
                   }));
 }
 
 void length_framed_connection::read_response() {
-  RIAKPP_CHECK(!accepts_requests_);
-  io::async_read(
-      socket_, io::buffer(&length_buffer_, sizeof(length_buffer_)),
-      wrap([this](boost::system::error_code ec, size_t) {
+  RIAKPP_CHECK(!in_flight_.empty());
+  reading_ = true;
+
+  // Whatever is left in the buffer is the beginning of a partial frame: move it
+  // to the front and, if its header was received, make sure it fits.
+  if (read_begin_ > 0) {
+    std::memmove(&read_buffer_[0], &read_buffer_[read_begin_],
+                 read_end_ - read_begin_);
+    read_end_ -= read_begin_;
+    read_begin_ = 0;
+  }
+  uint32_t length = 0;
+  if (read_end_ >= sizeof(length)) {
+    std::memcpy(&length, &read_buffer_[0], sizeof(length));
+    length = byte_order::network_to_host_long(length);
+    if (sizeof(length) + length > read_buffer_.size()) {
+      read_buffer_.resize(sizeof(length) + length);
+    }
+  }
+
+  auto generation = socket_generation_;
+  socket_.async_read_some(
+      io::buffer(&read_buffer_[read_end_], read_buffer_.size() - read_end_),
+      wrap([this, generation](boost::system::error_code ec, size_t length) {
+        if (generation != socket_generation_) return;
         if (ec) {
-          if (ec.value() != io::error::operation_aborted) report(ec);
+          fail_all(ec);
           return;
         }
-        length_buffer_ = byte_order::network_to_host_long(length_buffer_);
-        payload_buffer_.resize(length_buffer_);
-        io::async_read(socket_, io::buffer(&payload_buffer_[0], length_buffer_),
-                       wrap([this](boost::system::error_code ec, size_t) {
-                         if (ec.value() != io::error::operation_aborted) {
-                           report(ec);
-                         }
-                       }));
+        read_end_ += length;
+        reading_ = false;
+        // Linux drops out of quick ack mode on its own, so it is re-entered
+        // after every read.
+        set_quickack();
+        decode_responses();
+        if (!in_flight_.empty() && !reading_) read_response();
       }));
 }
 
-void length_framed_connection::report(std::errc ec) {
-  auto error_code = std::make_error_code(ec);
-  if (error_code) {
-    payload_buffer_.clear();
-    if (socket_.is_open()) socket_.close();
+void length_framed_connection::decode_responses() {
+  bool answered_any = false;
+  timing_wheel::time_point last_written_at;
+  uint32_t length = 0;
+  while (read_end_ - read_begin_ >= sizeof(length)) {
+    std::memcpy(&length, &read_buffer_[read_begin_], sizeof(length));
+    length = byte_order::network_to_host_long(length);
+    if (read_end_ - read_begin_ - sizeof(length) < length) break;
+
+    if (in_flight_.empty()) {
+      fail_all(std::errc::protocol_error);
+      return;
+    }
+    auto answered = std::move(in_flight_.front());
+    in_flight_.pop_front();
+    last_written_at = answered.written_at;
+    answered_any = true;
+    if (answered.ping) {
+      // Any answer will do: the connection is alive.
+      ping_in_flight_ = false;
+      read_begin_ += sizeof(length) + length;
+      continue;
+    }
+    auto payload = buffers_.acquire(length, buffer_arena_);
+    payload.assign(&read_buffer_[read_begin_ + sizeof(length)], length);
+    read_begin_ += sizeof(length) + length;
+    report(answered.handler, static_cast<std::errc>(0), std::move(payload));
+  }
+
+  if (read_begin_ == read_end_) {
+    read_begin_ = read_end_ = 0;
+    // Release the memory used by an unusually large response.
+    if (read_buffer_.size() > receive_buffer_size) {
+      std::vector<char>(receive_buffer_size).swap(read_buffer_);
+    }
+  }
+  if (!answered_any) return;
+  if (health_) {
+    // One latency sample per read is plenty.
+    auto now = timing_wheel::clock_type::now();
+    health_->report_response(endpoint_, now - last_written_at, now);
+    if (health_->ejected(endpoint_) && in_flight_.empty() && unsent_.empty() &&
+        !writing_) {
+      // The endpoint was ejected as a latency outlier: move to a healthy one
+      // before the next request, just like an idle connection would.
+      RIAKPP_DLOG << "Leaving ejected endpoint.";
+      fail_all(std::errc::not_connected);
+      return;
+    }
+  }
+  rearm_timer();
+}
+
+timing_wheel::time_point length_framed_connection::first_expiry(
+    ring_queue<pending_request>& requests) {
+  // A ping does not hide the deadline of the request behind it.
+  auto expires_at = timing_wheel::time_point::max();
+  for (size_t i = 0; i < requests.size(); ++i) {
+    expires_at = std::min(expires_at, requests[i].expires_at);
+    if (!requests[i].ping) break;
+  }
+  return expires_at;
+}
+
+bool length_framed_connection::fail_expired_unsent(
+    timing_wheel::time_point now) {
+  size_t num_expired = 0;
+  for (size_t i = 0; i < unsent_.size(); ++i) {
+    if (unsent_[i].expires_at <= now) ++num_expired;
+  }
+  if (num_expired == 0) return false;
+
+  // Rotates the queue once, keeping the live requests in order.
+  for (auto num_left = unsent_.size(); num_left > 0; --num_left) {
+    auto request = std::move(unsent_.front());
+    unsent_.pop_front();
+    if (request.expires_at > now) {
+      unsent_.emplace_back(std::move(request));
+      continue;
+    }
+    if (request.ping) ping_in_flight_ = false;
+    buffers_.release(std::move(request.payload), buffer_arena_);
+    report(request.handler, std::errc::timed_out, {});
+  }
+  return true;
+}
+
+void length_framed_connection::rearm_timer() {
+  // Requests waiting to be written expire too, during a slow connect or
+  // behind a long write.
+  auto expires_at = first_expiry(unsent_);
+  if (connecting_) {
+    expires_at = std::min(expires_at, connect_expires_at_);
+  } else if (!in_flight_.empty()) {
+    expires_at = std::min(expires_at, first_expiry(in_flight_));
+  } else if (unsent_.empty() && socket_.is_open()) {
+    if (idle_timeout_ms_ > 0 && !pinged_since_request_) {
+      idle_expires_at_ = expiry_after(idle_timeout_ms_);
+    }
+    if (ping_interval_ms_ > 0) {
+      ping_expires_at_ = expiry_after(ping_interval_ms_);
+    }
+    if (idle_timeout_ms_ > 0) expires_at = idle_expires_at_;
+    if (ping_interval_ms_ > 0) {
+      expires_at = std::min(expires_at, ping_expires_at_);
+    }
+  }
+
+  armed_expires_at_ = expires_at;
+  if (expires_at == timing_wheel::time_point::max()) {
+    deadlines_.cancel(deadline_);
+    return;
+  }
+  // The wheel calls back from outside the strand.
+  deadlines_.schedule(deadline_, expires_at, transient_.wrap([this] {
+    dispatch(make_custom_alloc_handler(
+        handler_memory_, transient_.wrap([this] { on_deadline(); })));
+  }));
+}
+
+void length_framed_connection::on_deadline() {
+  // The deadline may have fired just before it was moved, so check against the
+  // current expiry rather than trusting the notification.
+  auto now = timing_wheel::clock_type::now();
+  bool failed_unsent = fail_expired_unsent(now);
+  if (connecting_) {
+    if (now >= connect_expires_at_ && socket_.is_open()) {
+      boost::system::error_code ignored;
+      socket_.shutdown(io::socket_base::shutdown_both, ignored);
+      socket_.close(ignored);
+      return;
+    }
+  } else if (!in_flight_.empty()) {
+    if (now >= first_expiry(in_flight_)) {
+      if (health_) health_->report_failure(endpoint_, now);
+      fail_all(std::errc::timed_out);
+      return;
+    }
+  } else if (unsent_.empty() && socket_.is_open() && !failed_unsent) {
+    if (idle_timeout_ms_ > 0 && now >= idle_expires_at_) {
+      // Nothing to fail: this just closes the socket, and the next request
+      // reconnects.
+      RIAKPP_DLOG << "Closing idle connection.";
+      fail_all(std::errc::not_connected);
+      if (idle_handler_) idle_handler_();
+    } else if (ping_interval_ms_ > 0 && now >= ping_expires_at_) {
+      send_ping();
+    }
+    return;
+  }
+  // Watch whichever deadline is now the earliest: requests may have moved
+  // from the unsent queue to the in-flight one since the timer was armed.
+  rearm_timer();
+}
+
+void length_framed_connection::send_ping() {
+  // Answered within 'connection_timeout_ms' or the socket is replaced.
+  auto payload = buffers_.acquire(1, buffer_arena_);
+  payload.push_back(ping_request_code);
+  request_type ping{std::move(payload), connection_timeout_ms_};
+  handler_type ignore = [](error_type, response_type&) {};
+  unsent_.emplace_back(ping, ignore);
+  unsent_.back().ping = true;
+  ping_in_flight_ = pinged_since_request_ = true;
+  write_request();
+}
+
+void length_framed_connection::report(handler_type& handler, std::errc ec,
+                                      std::string payload) {
+  auto postable_handler = std::bind(std::move(handler),
+                                    std::make_error_code(ec),
+                                    std::move(payload));
+  strand_.get_io_service().post(make_custom_alloc_handler(
+      handler_memory_, make_move_on_copy(std::move(postable_handler))));
+}
+
+void length_framed_connection::fail_all(std::errc ec) {
+  // A failed ping means the socket went stale while idle: it is replaced
+  // before a request needs it.
+  bool reconnect = ping_in_flight_;
+  ping_in_flight_ = false;
+  ++socket_generation_;
+  if (socket_.is_open()) {
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+  }
+  connecting_ = writing_ = reading_ = false;
+  read_begin_ = read_end_ = 0;
+  deadlines_.cancel(deadline_);
+  armed_expires_at_ = timing_wheel::time_point::max();
+
+  // Payloads go back to the pool: those of a write cut short, and those of
+  // requests never written.
+  for (auto& payload : write_payloads_) {
+    buffers_.release(std::move(payload), buffer_arena_);
+  }
+  write_payloads_.clear();
+  for (size_t i = 0; i < in_flight_.size(); ++i) {
+    report(in_flight_[i].handler, ec, {});
+  }
+  for (size_t i = 0; i < unsent_.size(); ++i) {
+    buffers_.release(std::move(unsent_[i].payload), buffer_arena_);
+    report(unsent_[i].handler, ec, {});
   }
-  auto postable_handler = std::bind(std::move(on_response_), error_code,
-                                    std::move(payload_buffer_));
-  accepts_requests_.store(true);
-  timer_.cancel();
-  strand_.get_io_service().post(std::move(postable_handler));
+  in_flight_.clear();
+  unsent_.clear();
+  if (reconnect) connect();
 }
 
-inline void length_framed_connection::report(boost::system::error_code ec) {
+inline void length_framed_connection::fail_all(boost::system::error_code ec) {
   switch (ec.value()) {
     case io::error::eof:
-      report(std::errc::not_connected);
+      fail_all(std::errc::not_connected);
       break;
     default:
-      report(static_cast<std::errc>(ec.value()));
+      fail_all(static_cast<std::errc>(ec.value()));
       break;
   }
 }
@@ -4,16 +4,23 @@
 #include <atomic>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <system_error>
 #include <vector>
 
-#include <boost/asio/deadline_timer.hpp>
-#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/strand.hpp>
 
+#include "buffer_pool.hpp"
+#include "connection_options.hpp"
+#include "endpoint_health.hpp"
 #include "endpoint_vector.hpp"
+#include "handler_allocator.hpp"
+#include "ring_queue.hpp"
+#include "timing_wheel.hpp"
 #include "transient.hpp"
+#include "unique_function.hpp"
 
 namespace boost {
 namespace system {
@@ -30,61 +37,246 @@ class length_framed_connection {
  public:
   using response_type = std::string;
   using error_type = std::error_code;
-  using handler_type = std::function<void(error_type, response_type&)>;
+  // Roomier than a connection_pool handler, so that one still fits inline
+  // once the pool wraps it.
+  using handler_type =
+      unique_function<void(error_type, response_type&), 256>;
+  using connect_handler_type = unique_function<void(error_type)>;
+  using idle_handler_type = unique_function<void()>;
 
   static constexpr uint64_t no_deadline = -1;
-  static constexpr uint64_t default_connection_timeout = 1500;
+  static constexpr size_t receive_buffer_size = 8192;
+  // The most bytes a 'timeout_field' adds to the end of a payload.
+  static constexpr size_t max_timeout_field_bytes = 10;
+  // The message code of an RpbPingReq, sent over a connection left idle for
+  // 'ping_interval_ms'.
+  static constexpr char ping_request_code = 1;
 
   struct request_type {
     request_type() = default;
     explicit request_type(std::string payload) : payload(std::move(payload)) {}
-    request_type(std::string payload, uint64_t deadline_ms)
-        : payload(std::move(payload)), deadline_ms{deadline_ms} {}
+    // The deadline starts counting on construction, so time spent waiting to
+    // be written counts against it.
+    request_type(std::string payload, uint64_t deadline_ms);
 
     std::string payload;
-    uint64_t deadline_ms = no_deadline;
+    timing_wheel::time_point expires_at = timing_wheel::time_point::max();
+
+    // If non-zero, the number of a uint32 field of the protobuf message which
+    // follows the payload's first byte. The milliseconds left until
+    // 'expires_at' are appended to the payload as that field when it is
+    // written, overriding any value serialized earlier.
+    uint32_t timeout_field = 0;
   };
 
+  // The endpoints are tried in order and may be TCP or Unix domain sockets.
+  // Request payloads are returned to, and response payloads are acquired from,
+  // arena 'buffer_arena' of 'buffers'; request and connect deadlines are kept
+  // in 'deadlines'. If either is null, the connection uses one of its own. If
+  // 'health' is given, it tracks the endpoints (in the same order) and picks
+  // the ones to try.
   length_framed_connection(
       boost::asio::io_service& io_service, endpoint_iterator endpoints_begin,
       endpoint_iterator endpoints_end,
-      uint64_t connection_timeout_ms = default_connection_timeout);
+      const connection_options& options = connection_options{},
+      buffer_pool* buffers = nullptr, timing_wheel* deadlines = nullptr,
+      endpoint_health* health = nullptr, size_t buffer_arena = 0);
+  ~length_framed_connection();
+
+  // Requests may be sent before the previous ones were answered. They are
+  // written back-to-back and matched to responses in FIFO order. Requests
+  // waiting while a connect or write is in progress are gathered into a single
+  // write, up to 'max_write_batch' of them and 'max_write_batch_bytes' bytes.
+  // With 'more', the caller is about to send another request and this one
+  // waits to be written along with it.
+  void async_send(request_type request, handler_type handler,
+                  bool more = false);
 
-  void async_send(request_type request, handler_type handler);
+  // The gathered writes issued so far: fewer than the requests written when
+  // batches formed.
+  uint64_t num_writes() const {
+    return num_writes_.load(std::memory_order_relaxed);
+  }
 
-  bool accepts_request() const { return accepts_requests_; }
+  // Connects without waiting for a request, then calls 'handler' with the
+  // outcome; straight away if already connected. A connection which fails a
+  // ping reconnects straight away too.
+  void async_connect(connect_handler_type handler);
+
+  // Calls 'handler' whenever the socket is closed after 'idle_timeout_ms'
+  // without requests. Must be set before the first request is sent.
+  void on_idle_close(idle_handler_type handler) {
+    idle_handler_ = std::move(handler);
+  }
 
  private:
+  struct pending_request {
+    pending_request(request_type& request, handler_type& handler)
+        : payload{std::move(request.payload)},
+          expires_at{request.expires_at},
+          timeout_field{request.timeout_field},
+          handler{std::move(handler)} {}
+
+    std::string payload;
+    timing_wheel::time_point expires_at;
+    uint32_t timeout_field;
+    handler_type handler;
+    timing_wheel::time_point written_at;
+    bool ping = false;
+  };
+
+  void enqueue(request_type& request, handler_type& handler, bool more);
+  void connect_now(connect_handler_type& handler);
+  void notify_connected(error_type ec);
+  void send_ping();
   void connect();
-  void connect_at(endpoint_iterator current_endpoint);
+  void connect_at(size_t position);
+  void apply_socket_options();
+  void set_quickack();
   void write_request();
   void read_response();
-  void report(std::errc ec);
+  void decode_responses();
+  static timing_wheel::time_point first_expiry(
+      ring_queue<pending_request>& requests);
+  bool fail_expired_unsent(timing_wheel::time_point now);
+  void rearm_timer();
+  void on_deadline();
+  void report(handler_type& handler, std::errc ec, std::string payload);
+  void fail_all(std::errc ec);
+
+  inline void fail_all(boost::system::error_code ec);
+
+  // Calls the handler through the strand or, when the connection's io_service
+  // is run by a single thread (see 'shard_per_thread'), straight away. The
+  // strand is held by value, since the handler may outlive the connection.
+  // The strand's own operation is allocated from the handler memory too.
+  template <class Handler>
+  class serialized_handler {
+   public:
+    serialized_handler(const boost::asio::strand& strand, bool use_strand,
+                       std::shared_ptr<handler_memory> memory,
+                       Handler handler)
+        : strand_{strand},
+          use_strand_{use_strand},
+          memory_(std::move(memory)),
+          handler_(std::move(handler)) {}
+
+    template <class... Args>
+    void operator()(Args&&... args) {
+      if (use_strand_) {
+        strand_.dispatch(make_custom_alloc_handler(
+            std::move(memory_),
+            std::bind(std::move(handler_), std::forward<Args>(args)...)));
+      } else {
+        handler_(std::forward<Args>(args)...);
+      }
+    }
+
+   private:
+    boost::asio::strand strand_;
+    bool use_strand_;
+    std::shared_ptr<handler_memory> memory_;
+    Handler handler_;
+  };
 
-  inline void report(boost::system::error_code ec);
+  template <class Handler>
+  using wrapped_handler = custom_alloc_handler<serialized_handler<
+      transient_function_wrapper<transient_ref<length_framed_connection>,
+                                 typename std::decay<Handler>::type>>>;
 
   template <class Handler>
-  auto wrap(Handler&& handler)
-      -> decltype(std::declval<transient<length_framed_connection>>().wrap(
-          std::declval<boost::asio::strand>().wrap(handler))) {
-    return transient_.wrap(strand_.wrap(handler));
+  wrapped_handler<Handler> wrap(Handler&& handler) {
+    // The transient goes inside the strand: a handler queued behind another
+    // one must still be skipped if the connection is destroyed meanwhile.
+    return {handler_memory_,
+            typename wrapped_handler<Handler>::handler_type{
+                strand_, use_strand_, handler_memory_,
+                transient_.wrap(std::forward<Handler>(handler))}};
   }
 
+  template <class Handler>
+  void dispatch(Handler&& handler) {
+    if (use_strand_) {
+      strand_.dispatch(std::forward<Handler>(handler));
+    } else {
+      strand_.get_io_service().dispatch(std::forward<Handler>(handler));
+    }
+  }
+
+  const bool use_strand_;
   boost::asio::strand strand_;
-  boost::asio::deadline_timer timer_;
-  boost::asio::ip::tcp::socket socket_;
-  boost::asio::ip::tcp::resolver resolver_;
+  boost::asio::generic::stream_protocol::socket socket_;
 
-  std::atomic<bool> accepts_requests_{true};
   const endpoint_iterator endpoints_begin_;
   const endpoint_iterator endpoints_end_;
   const uint64_t connection_timeout_ms_ = 0;
+  const uint64_t idle_timeout_ms_ = 0;
+  const uint64_t ping_interval_ms_ = 0;
+  const size_t max_write_batch_ = 0;
+  const size_t max_write_batch_bytes_ = 0;
+  const connection_options socket_options_;
+  endpoint_health* const health_;
+
+  std::unique_ptr<buffer_pool> buffers_ptr_;
+  buffer_pool& buffers_;
+  const size_t buffer_arena_;
+
+  // Holds the earliest of the connect deadline, the first in-flight request's
+  // deadline and the first unsent request's deadline (pings aside) or, with
+  // nothing to do, the idle timeout or next ping.
+  std::unique_ptr<timing_wheel> deadlines_ptr_;
+  timing_wheel& deadlines_;
+  timing_wheel::deadline deadline_;
+  timing_wheel::time_point armed_expires_at_ = timing_wheel::time_point::max();
+
+  // Requests waiting to be written and requests written but not yet answered.
+  // Only accessed from within the strand, or the only thread running the
+  // io_service.
+  ring_queue<pending_request> unsent_;
+  ring_queue<pending_request> in_flight_;
+  bool connecting_ = false;
+  bool writing_ = false;
+  bool reading_ = false;
+  // Whether the socket is connected over TCP, rather than a Unix socket.
+  bool tcp_ = false;
+
+  // The indices of the endpoints to try on this connect, and of the one being
+  // tried or connected to.
+  std::vector<size_t> connect_order_;
+  size_t endpoint_ = 0;
+  std::vector<connect_handler_type> connect_waiters_;
+
+  // A ping is in flight; and a ping was sent since the last request, which
+  // must not push back the idle timeout.
+  bool ping_in_flight_ = false;
+  bool pinged_since_request_ = false;
+
+  // Incremented whenever the socket is closed, so that handlers of operations
+  // on a previous socket can tell they are stale.
+  uint64_t socket_generation_ = 0;
+
+  idle_handler_type idle_handler_;
+
+  timing_wheel::time_point connect_expires_at_;
+  timing_wheel::time_point idle_expires_at_ = timing_wheel::time_point::max();
+  timing_wheel::time_point ping_expires_at_ = timing_wheel::time_point::max();
+
+  // Bytes received but not yet decoded are kept in
+  // [read_buffer_ + read_begin_, read_buffer_ + read_end_).
+  std::vector<char> read_buffer_;
+  size_t read_begin_ = 0;
+  size_t read_end_ = 0;
 
-  handler_type on_response_;
-  std::string payload_buffer_;
-  uint32_t length_buffer_ = 0;
-  uint64_t deadline_ms_ = 0;
+  // The batch of requests currently being written in a single gathered write.
+  std::vector<std::string> write_payloads_;
+  std::vector<uint32_t> write_lengths_;
+  std::vector<boost::asio::const_buffer> write_buffers_;
+  std::atomic<uint64_t> num_writes_{0};
 
+  // Memory for the handlers of the operations on the strand, socket and timer,
+  // and for the responses posted to request handlers.
+  const std::shared_ptr<handler_memory> handler_memory_ =
+      std::make_shared<handler_memory>();
   transient<length_framed_connection> transient_;
 };
 
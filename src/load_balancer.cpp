@@ -0,0 +1,79 @@
+#include "load_balancer.hpp"
+
+#include <atomic>
+#include <random>
+
+#include "check.hpp"
+
+namespace riak {
+namespace {
+class round_robin_balancer : public load_balancer {
+ public:
+  size_t pick(const std::vector<const node_load*>& nodes) override {
+    return next_.fetch_add(1, std::memory_order_relaxed) % nodes.size();
+  }
+
+ private:
+  std::atomic<size_t> next_{0};
+};
+
+class least_outstanding_balancer : public load_balancer {
+ public:
+  size_t pick(const std::vector<const node_load*>& nodes) override {
+    // The scan starts at a different node every time, so that ties do not all
+    // go to the first node.
+    auto num_nodes = nodes.size();
+    auto start = next_.fetch_add(1, std::memory_order_relaxed) % num_nodes;
+    auto best = start;
+    auto best_outstanding = nodes[start]->outstanding();
+    for (size_t offset = 1; offset < num_nodes && best_outstanding > 0;
+         ++offset) {
+      auto i_node = (start + offset) % num_nodes;
+      auto outstanding = nodes[i_node]->outstanding();
+      if (outstanding < best_outstanding) {
+        best = i_node;
+        best_outstanding = outstanding;
+      }
+    }
+    return best;
+  }
+
+ private:
+  std::atomic<size_t> next_{0};
+};
+
+class power_of_two_latency_balancer : public load_balancer {
+ public:
+  size_t pick(const std::vector<const node_load*>& nodes) override {
+    auto num_nodes = nodes.size();
+    if (num_nodes == 1) return 0;
+    // Thread-local, so that concurrent senders do not contend on the state.
+    static thread_local std::minstd_rand engine{std::random_device{}()};
+    size_t first = engine() % num_nodes;
+    size_t second = engine() % (num_nodes - 1);
+    if (second >= first) ++second;
+    return cost(*nodes[second]) < cost(*nodes[first]) ? second : first;
+  }
+
+ private:
+  // Nodes without a latency average yet look free, so that they are tried.
+  static double cost(const node_load& node) {
+    return double(node.latency_ns()) * (node.outstanding() + 1);
+  }
+};
+}  // namespace
+
+std::unique_ptr<load_balancer> make_load_balancer(balancing_policy policy) {
+  switch (policy) {
+    case balancing_policy::round_robin:
+      return std::unique_ptr<load_balancer>{new round_robin_balancer};
+    case balancing_policy::least_outstanding:
+      return std::unique_ptr<load_balancer>{new least_outstanding_balancer};
+    case balancing_policy::power_of_two_latency:
+      return std::unique_ptr<load_balancer>{new power_of_two_latency_balancer};
+  }
+  RIAKPP_CHECK(false) << "Unknown balancing policy.";
+  return nullptr;
+}
+
+}  // namespace riak
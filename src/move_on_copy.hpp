@@ -0,0 +1,44 @@
+#ifndef RIAKPP_MOVE_ON_COPY_HPP_
+#define RIAKPP_MOVE_ON_COPY_HPP_
+
+#include <type_traits>
+#include <utility>
+
+namespace riak {
+
+// Asio's io_service::post() and strand::dispatch() insist on CopyConstructible
+// handlers, even though they only ever move them. This adapts a move-only
+// handler so it can be handed to them: copying it steals the wrapped handler.
+// The copy must not be made from a handler which is used afterwards.
+template <class Handler>
+class move_on_copy {
+ public:
+  template <class HandlerConv>
+  explicit move_on_copy(HandlerConv&& handler)
+      : handler_(std::forward<HandlerConv>(handler)) {}
+
+  move_on_copy(const move_on_copy& rhs) : handler_(std::move(rhs.handler_)) {}
+  move_on_copy(move_on_copy&& rhs) : handler_(std::move(rhs.handler_)) {}
+
+  move_on_copy& operator=(const move_on_copy&) = delete;
+  move_on_copy& operator=(move_on_copy&&) = delete;
+
+  template <class... Args>
+  void operator()(Args&&... args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+ private:
+  mutable Handler handler_;
+};
+
+template <class Handler>
+inline move_on_copy<typename std::decay<Handler>::type> make_move_on_copy(
+    Handler&& handler) {
+  return move_on_copy<typename std::decay<Handler>::type>{
+      std::forward<Handler>(handler)};
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_MOVE_ON_COPY_HPP_
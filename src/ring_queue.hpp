@@ -0,0 +1,95 @@
+#ifndef RIAKPP_RING_QUEUE_HPP_
+#define RIAKPP_RING_QUEUE_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace riak {
+
+// A FIFO queue in a growable ring buffer. Unlike std::deque, which frees and
+// allocates a block as elements come and go, it keeps its capacity: once it
+// has grown to its working size, pushing and popping never allocate.
+template <class Value>
+class ring_queue {
+ public:
+  using value_type = Value;
+
+  ring_queue() = default;
+  ~ring_queue() { clear(); }
+
+  ring_queue(const ring_queue&) = delete;
+  ring_queue& operator=(const ring_queue&) = delete;
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+
+  // Elements are indexed from the front.
+  value_type& operator[](size_t index) { return at(index); }
+  value_type& front() { return at(0); }
+  value_type& back() { return at(size_ - 1); }
+
+  template <class... Args>
+  inline void emplace_back(Args&&... args);
+  inline void pop_front();
+  inline void clear();
+
+ private:
+  using storage_type =
+      typename std::aligned_storage<sizeof(value_type),
+                                    alignof(value_type)>::type;
+
+  value_type& at(size_t index) {
+    return *reinterpret_cast<value_type*>(
+        &storage_[(head_ + index) & (capacity_ - 1)]);
+  }
+
+  inline void grow();
+
+  // The capacity is zero or a power of two.
+  std::unique_ptr<storage_type[]> storage_;
+  size_t capacity_ = 0;
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+template <class Value>
+template <class... Args>
+void ring_queue<Value>::emplace_back(Args&&... args) {
+  if (size_ == capacity_) grow();
+  new (&storage_[(head_ + size_) & (capacity_ - 1)])
+      value_type(std::forward<Args>(args)...);
+  ++size_;
+}
+
+template <class Value>
+void ring_queue<Value>::pop_front() {
+  front().~value_type();
+  head_ = (head_ + 1) & (capacity_ - 1);
+  --size_;
+}
+
+template <class Value>
+void ring_queue<Value>::clear() {
+  while (!empty()) pop_front();
+}
+
+template <class Value>
+void ring_queue<Value>::grow() {
+  auto capacity = capacity_ == 0 ? 4 : capacity_ * 2;
+  std::unique_ptr<storage_type[]> storage{new storage_type[capacity]};
+  for (size_t index = 0; index < size_; ++index) {
+    new (&storage[index]) value_type(std::move(at(index)));
+    at(index).~value_type();
+  }
+  storage_ = std::move(storage);
+  capacity_ = capacity;
+  head_ = 0;
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_RING_QUEUE_HPP_
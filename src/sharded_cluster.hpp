@@ -0,0 +1,228 @@
+#ifndef RIAKPP_SHARDED_CLUSTER_HPP_
+#define RIAKPP_SHARDED_CLUSTER_HPP_
+
+#include <boost/asio/io_service.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "cluster.hpp"
+#include "connection_options.hpp"
+#include "move_on_copy.hpp"
+#include "thread_pool.hpp"
+
+namespace riak {
+
+// A cluster per shard of a thread_pool (see the 'shard_per_thread' option),
+// all sharing one buffer_pool with an arena per shard. Requests sent from a
+// shard's thread go to that shard's cluster; requests from any other thread
+// are spread across the shards in turn. With a single io_service there is a
+// single shard.
+//
+// The 'min_connections' and 'max_connections' options are divided between the
+// shards, so that they still bound the connections to each node as a whole.
+// The first shards take one more connection each when the limits do not
+// divide evenly, and every shard gets at least 'reserved_connections' + 1.
+//
+// Each shard's cluster is constructed on the shard's own thread (on any of the
+// pool's threads when there is a single shard), so that the memory its
+// connections keep, such as read buffers and handler memory, is first touched,
+// and so placed by Linux, on that thread's NUMA node.
+//
+// Callers which acquire request payloads from buffers() should pick() the
+// shard first and use its buffer arena, since the shard releases them there.
+template <class Connection>
+class sharded_cluster {
+ public:
+  using cluster_type = cluster<Connection>;
+  using request_type = typename cluster_type::request_type;
+  using handler_type = typename cluster_type::handler_type;
+  using error_type = typename cluster_type::error_type;
+  using ready_handler_type = typename cluster_type::ready_handler_type;
+
+  // 'Nodes' is either a std::vector<node_address> or a
+  // std::vector<endpoint_vector>, as taken by cluster. Request handlers run
+  // on 'completions' if given, or else on the shard's thread.
+  template <class Nodes>
+  sharded_cluster(thread_pool& threads, const Nodes& nodes,
+                  const connection_options& options,
+                  completion_executor* completions = nullptr);
+
+  template <class Nodes>
+  sharded_cluster(boost::asio::io_service& io_service, const Nodes& nodes,
+                  const connection_options& options,
+                  completion_executor* completions = nullptr);
+
+  // The shard that a request sent from this thread goes to.
+  inline cluster_type& pick();
+
+  void async_send(request_type request, handler_type handler,
+                  size_t priority = use_default_priority) {
+    pick().async_send(std::move(request), std::move(handler), priority);
+  }
+
+  bool try_async_send(request_type request, handler_type handler,
+                      size_t priority = use_default_priority) {
+    return pick().try_async_send(std::move(request), std::move(handler),
+                                  priority);
+  }
+
+  void async_send_hedged(request_type request, handler_type handler,
+                         size_t priority = use_default_priority) {
+    pick().async_send_hedged(std::move(request), std::move(handler),
+                              priority);
+  }
+
+  bool try_async_send_hedged(request_type request, handler_type handler,
+                             size_t priority = use_default_priority) {
+    return pick().try_async_send_hedged(std::move(request),
+                                         std::move(handler), priority);
+  }
+
+  // Calls 'handler' once every shard is ready, with an error only if none is.
+  void async_wait_ready(ready_handler_type handler);
+
+  size_t num_shards() const { return shards_.size(); }
+  const cluster_type& shard(size_t index) const { return *shards_[index]; }
+
+  // The sums over every shard.
+  inline size_t buffered_bytes() const;
+  inline uint64_t num_ejections() const;
+  inline uint64_t num_readmissions() const;
+  inline uint64_t num_hedged_requests() const;
+
+  buffer_pool& buffers() { return *buffers_; }
+  const buffer_pool& buffers() const { return *buffers_; }
+
+ private:
+  static connection_options shard_options(const connection_options& options,
+                                          size_t i_shard, size_t num_shards);
+
+  const thread_pool* const threads_ = nullptr;
+  const std::shared_ptr<buffer_pool> buffers_;
+  std::vector<std::unique_ptr<cluster_type>> shards_;
+  std::atomic<size_t> next_shard_{0};
+};
+
+template <class Connection>
+template <class Nodes>
+sharded_cluster<Connection>::sharded_cluster(thread_pool& threads,
+                                             const Nodes& nodes,
+                                             const connection_options& options,
+                                             completion_executor* completions)
+    : threads_{&threads},
+      buffers_{std::make_shared<buffer_pool>(options.max_pooled_buffer_bytes(),
+                                             threads.num_shards())} {
+  auto num_shards = threads.num_shards();
+  shards_.resize(num_shards);
+  auto build = [&](size_t i_shard) {
+    shards_[i_shard].reset(new cluster_type{
+        threads.shard(i_shard), nodes,
+        shard_options(options, i_shard, num_shards), buffers_, completions,
+        i_shard});
+  };
+  // Waiting on the shards from one of their own threads would deadlock.
+  if (threads.runs_this_thread()) {
+    for (size_t i_shard = 0; i_shard < num_shards; ++i_shard) build(i_shard);
+    return;
+  }
+  std::vector<std::future<void>> built;
+  for (size_t i_shard = 0; i_shard < num_shards; ++i_shard) {
+    std::packaged_task<void()> task{std::bind(build, i_shard)};
+    built.emplace_back(task.get_future());
+    threads.shard(i_shard).post(make_move_on_copy(std::move(task)));
+  }
+  for (auto& shard : built) shard.get();
+}
+
+template <class Connection>
+template <class Nodes>
+sharded_cluster<Connection>::sharded_cluster(
+    boost::asio::io_service& io_service, const Nodes& nodes,
+    const connection_options& options, completion_executor* completions)
+    : buffers_{std::make_shared<buffer_pool>(
+          options.max_pooled_buffer_bytes())} {
+  shards_.emplace_back(
+      new cluster_type{io_service, nodes, options, buffers_, completions});
+}
+
+template <class Connection>
+connection_options sharded_cluster<Connection>::shard_options(
+    const connection_options& options, size_t i_shard, size_t num_shards) {
+  if (num_shards == 1) return options;
+  auto share = [=](size_t total) {
+    return std::max(options.reserved_connections() + 1,
+                    total / num_shards + (i_shard < total % num_shards));
+  };
+  connection_options divided{options};
+  divided.max_connections(share(options.max_connections()));
+  // A defaulted minimum keeps following the maximum; no minimum stays none.
+  if (!options.defaulted_min_connections() && options.min_connections() > 0) {
+    divided.min_connections(std::min(share(options.min_connections()),
+                                     divided.max_connections()));
+  }
+  return divided;
+}
+
+template <class Connection>
+void sharded_cluster<Connection>::async_wait_ready(
+    ready_handler_type handler) {
+  if (shards_.size() == 1) {
+    shards_[0]->async_wait_ready(std::move(handler));
+    return;
+  }
+  internal::any_ready<error_type, ready_handler_type> shard_ready{
+      shards_.size(), std::move(handler)};
+  for (auto& shard : shards_) shard->async_wait_ready(shard_ready);
+}
+
+template <class Connection>
+size_t sharded_cluster<Connection>::buffered_bytes() const {
+  size_t total = 0;
+  for (const auto& shard : shards_) total += shard->buffered_bytes();
+  return total;
+}
+
+template <class Connection>
+uint64_t sharded_cluster<Connection>::num_ejections() const {
+  uint64_t total = 0;
+  for (const auto& shard : shards_) total += shard->num_ejections();
+  return total;
+}
+
+template <class Connection>
+uint64_t sharded_cluster<Connection>::num_readmissions() const {
+  uint64_t total = 0;
+  for (const auto& shard : shards_) total += shard->num_readmissions();
+  return total;
+}
+
+template <class Connection>
+uint64_t sharded_cluster<Connection>::num_hedged_requests() const {
+  uint64_t total = 0;
+  for (const auto& shard : shards_) total += shard->num_hedged_requests();
+  return total;
+}
+
+template <class Connection>
+auto sharded_cluster<Connection>::pick() -> cluster_type& {
+  if (shards_.size() == 1) return *shards_[0];
+  auto index = threads_->current_shard();
+  if (index >= shards_.size()) {
+    index = next_shard_.fetch_add(1, std::memory_order_relaxed) %
+            shards_.size();
+  }
+  return *shards_[index];
+}
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_SHARDED_CLUSTER_HPP_
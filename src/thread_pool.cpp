@@ -1,31 +1,192 @@
 #include "thread_pool.hpp"
 
 #include "check.hpp"
+#include "debug_log.hpp"
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace riak {
+namespace {
+// The pool and shard of the calling thread, if it runs a shard.
+thread_local const thread_pool* current_pool = nullptr;
+thread_local size_t current_pool_shard = thread_pool::no_shard;
+
+constexpr size_t no_cpu = static_cast<size_t>(-1);
+constexpr size_t max_thread_name_length = 15;
+
+std::string thread_name(const std::string& name, size_t index) {
+  if (name.empty()) return name;
+  auto suffix = "/" + std::to_string(index);
+  if (suffix.size() >= max_thread_name_length) return name;
+  return name.substr(0, max_thread_name_length - suffix.size()) + suffix;
+}
+
+void place_this_thread(size_t cpu, const std::string& name) {
+#ifdef __linux__
+  if (cpu != no_cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpus);
+    if (cpu >= CPU_SETSIZE ||
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      RIAKPP_DLOG << "Could not pin a worker thread to CPU " << cpu << ".";
+    }
+  }
+  if (!name.empty()) pthread_setname_np(pthread_self(), name.c_str());
+#else
+  (void)cpu;
+  (void)name;
+#endif
+}
+
+// Parses a kernel CPU list such as "0-3,8,10-11"; empty if it is malformed.
+std::vector<size_t> parse_cpu_list(const std::string& list) {
+  std::vector<size_t> cpus;
+  std::istringstream ranges{list};
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    std::istringstream bounds{range};
+    size_t first = 0, last = 0;
+    char dash = 0;
+    if (!(bounds >> first)) return {};
+    last = first;
+    if (bounds >> dash && (dash != '-' || !(bounds >> last) || last < first)) {
+      return {};
+    }
+    for (auto cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<size_t> read_cpu_list(const std::string& path) {
+  std::ifstream file{path};
+  std::string list;
+  std::getline(file, list);
+  return parse_cpu_list(list);
+}
+}  // namespace
+
+constexpr size_t thread_pool::use_hardware_threads;
+constexpr size_t thread_pool::no_shard;
+constexpr int thread_pool::any_numa_node;
 
 thread_pool::thread_pool(size_t num_threads,
-                         boost::asio::io_service* io_service)
-    : io_service_ptr_{io_service ? nullptr : new boost::asio::io_service{}},
-      io_service_(io_service_ptr_ ? *io_service_ptr_ : *io_service),
-      work_{io_service_} {
+                         boost::asio::io_service* io_service) {
+  if (!io_service) {
+    owned_.emplace_back(new boost::asio::io_service{});
+    io_service = owned_.back().get();
+  }
+  shards_.push_back(io_service);
+  start(num_threads, false, {});
+}
+
+thread_pool::thread_pool(size_t num_threads, sharding mode,
+                         thread_placement placement) {
+  if (mode == sharding::shared) {
+    owned_.emplace_back(new boost::asio::io_service{});
+    shards_.push_back(owned_.back().get());
+  }
+  start(num_threads, mode == sharding::per_thread, placement);
+}
+
+thread_pool::~thread_pool() noexcept {
+  if (!owned_.empty()) {
+    stop();
+  } else {
+    RIAKPP_CHECK(shards_[0]->stopped());
+  }
+  join();
+}
+
+size_t thread_pool::current_shard() const noexcept {
+  return current_pool == this ? current_pool_shard : no_shard;
+}
+
+bool thread_pool::runs_this_thread() const noexcept {
+  return current_pool == this;
+}
+
+size_t thread_pool::this_thread_shard() noexcept { return current_pool_shard; }
+
+std::vector<size_t> thread_pool::physical_cores(int numa_node) {
+#ifdef __linux__
+  const std::string sysfs = "/sys/devices/system/";
+  auto cpus = read_cpu_list(
+      numa_node == any_numa_node
+          ? sysfs + "cpu/online"
+          : sysfs + "node/node" + std::to_string(numa_node) + "/cpulist");
+
+  // Keep the first CPU seen of every core, skipping its hyperthreads.
+  std::vector<size_t> cores;
+  std::set<size_t> covered;
+  for (auto cpu : cpus) {
+    if (covered.count(cpu)) continue;
+    cores.push_back(cpu);
+    for (auto sibling :
+         read_cpu_list(sysfs + "cpu/cpu" + std::to_string(cpu) +
+                       "/topology/thread_siblings_list")) {
+      covered.insert(sibling);
+    }
+  }
+  return cores;
+#else
+  (void)numa_node;
+  return {};
+#endif
+}
+
+void thread_pool::stop() noexcept {
+  for (auto& io_service : owned_) io_service->stop();
+}
+
+void thread_pool::join() noexcept {
+  for (auto& thread : threads_) {
+    if (thread.joinable()) thread.join();
+  }
+}
+
+void thread_pool::start(size_t num_threads, bool sharded,
+                        const thread_placement& placement) {
   num_threads = num_threads == use_hardware_threads
                     ? std::thread::hardware_concurrency()
                     : num_threads;
   RIAKPP_CHECK_GT(num_threads, 0u);
-  threads_.reserve(num_threads);
-  for (size_t i = 0; i < num_threads; ++i) {
-    threads_.emplace_back([&] { io_service_.run(); });
+  if (sharded) {
+    // A concurrency hint of one tunes Asio's scheduler for a single thread.
+    for (size_t i = 0; i < num_threads; ++i) {
+      owned_.emplace_back(new boost::asio::io_service{1});
+      shards_.push_back(owned_.back().get());
+    }
+  }
+  for (auto io_service : shards_) {
+    work_.emplace_back(new boost::asio::io_service::work{*io_service});
   }
-}
 
-thread_pool::~thread_pool() noexcept {
-  if (io_service_ptr_) {
-    io_service_.stop();
-  } else {
-    RIAKPP_CHECK(io_service_.stopped());
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    auto cpu = placement.cpus.empty()
+                   ? no_cpu
+                   : placement.cpus[i % placement.cpus.size()];
+    auto name = thread_name(placement.name, i);
+    threads_.emplace_back([this, i, sharded, cpu, name] {
+      place_this_thread(cpu, name);
+      current_pool = this;
+      if (!sharded) {
+        shards_[0]->run();
+        return;
+      }
+      current_pool_shard = i;
+      shards_[i]->run();
+    });
   }
-  for (auto& thread : threads_) thread.join();
 }
 
 }  // namespace riak
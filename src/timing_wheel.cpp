@@ -0,0 +1,190 @@
+#include "timing_wheel.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "check.hpp"
+
+namespace riak {
+
+constexpr size_t timing_wheel::default_num_slots;
+constexpr uint64_t timing_wheel::no_tick;
+constexpr size_t timing_wheel::bits_per_word;
+
+timing_wheel::timing_wheel(boost::asio::io_service& io_service,
+                           size_t num_slots)
+    : start_{clock_type::now()},
+      slot_mask_{num_slots - 1},
+      slots_(num_slots, nullptr),
+      occupied_((num_slots + bits_per_word - 1) / bits_per_word, 0),
+      timer_{io_service},
+      transient_{*this} {
+  RIAKPP_CHECK(num_slots > 0 && (num_slots & slot_mask_) == 0)
+      << "The number of slots must be a power of two.";
+}
+
+timing_wheel::~timing_wheel() {
+  transient_.reset();
+  RIAKPP_CHECK_EQ(num_scheduled_, 0)
+      << "Deadlines must be cancelled before the wheel is destroyed.";
+}
+
+void timing_wheel::schedule(deadline& entry, time_point expires_at,
+                            callback_type callback) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (entry.scheduled_) unlink(entry);
+
+  // Nothing expires before the armed tick, so the wheel may skip ahead to it;
+  // while the wheel is idle, it skips ahead to now.
+  auto now_tick = tick_at(clock_type::now(), false);
+  processed_tick_ =
+      std::max(processed_tick_, std::min(now_tick, armed_tick_ - 1));
+  entry.expiry_tick_ =
+      std::max(tick_at(expires_at, true), processed_tick_ + 1);
+  entry.callback_ = std::move(callback);
+  link(entry);
+  if (entry.expiry_tick_ < armed_tick_) arm_timer(entry.expiry_tick_);
+}
+
+void timing_wheel::cancel(deadline& entry) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (entry.scheduled_) {
+    unlink(entry);
+    entry.callback_.reset();
+  }
+  // An idle wheel holds no pending wait, which would keep the io_service busy.
+  if (num_scheduled_ == 0 && armed_tick_ != no_tick) {
+    armed_tick_ = no_tick;
+    timer_.cancel();
+  }
+}
+
+size_t timing_wheel::num_scheduled() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return num_scheduled_;
+}
+
+uint64_t timing_wheel::tick_at(time_point when, bool round_up) const {
+  if (when <= start_) return 0;
+  auto elapsed = when - start_;
+  auto ticks = std::chrono::duration_cast<tick_duration>(elapsed);
+  if (round_up && ticks < elapsed) ++ticks;
+  return static_cast<uint64_t>(ticks.count());
+}
+
+uint64_t timing_wheel::next_slot_tick() const {
+  auto num_slots = slots_.size();
+  for (size_t offset = 1; offset <= num_slots;) {
+    auto slot = (processed_tick_ + offset) & slot_mask_;
+    auto bit = slot % bits_per_word;
+    auto word = occupied_[slot / bits_per_word] >> bit;
+    if (word != 0) {
+      offset += __builtin_ctzll(word);
+      return offset <= num_slots ? processed_tick_ + offset : no_tick;
+    }
+    // Skip to the next word, or wrap around to the first slot.
+    offset += std::min<size_t>(bits_per_word - bit, num_slots - slot);
+  }
+  return no_tick;
+}
+
+void timing_wheel::link(deadline& entry) {
+  deadline** head;
+  entry.overflow_ = entry.expiry_tick_ > processed_tick_ + slots_.size();
+  if (entry.overflow_) {
+    head = &overflow_;
+    overflow_tick_ = std::min(overflow_tick_, entry.expiry_tick_);
+  } else {
+    auto slot = entry.expiry_tick_ & slot_mask_;
+    head = &slots_[slot];
+    occupied_[slot / bits_per_word] |= uint64_t{1} << (slot % bits_per_word);
+  }
+  entry.previous_ = nullptr;
+  entry.next_ = *head;
+  if (*head) (*head)->previous_ = &entry;
+  *head = &entry;
+  entry.scheduled_ = true;
+  ++num_scheduled_;
+}
+
+void timing_wheel::unlink(deadline& entry) {
+  if (entry.previous_) {
+    entry.previous_->next_ = entry.next_;
+  } else if (entry.overflow_) {
+    overflow_ = entry.next_;
+    if (!overflow_) overflow_tick_ = no_tick;
+  } else {
+    auto slot = entry.expiry_tick_ & slot_mask_;
+    slots_[slot] = entry.next_;
+    if (!entry.next_) {
+      occupied_[slot / bits_per_word] &=
+          ~(uint64_t{1} << (slot % bits_per_word));
+    }
+  }
+  if (entry.next_) entry.next_->previous_ = entry.previous_;
+  entry.previous_ = entry.next_ = nullptr;
+  entry.scheduled_ = false;
+  --num_scheduled_;
+}
+
+void timing_wheel::advance_overflow(uint64_t now_tick,
+                                    std::vector<callback_type>& expired) {
+  // Moves the deadlines which are now within a revolution into the slots, or
+  // fires them if the timer fell behind, and recomputes the lower bound.
+  if (overflow_tick_ > processed_tick_ + slots_.size()) return;
+  auto* entry = overflow_;
+  overflow_tick_ = no_tick;
+  while (entry) {
+    auto* next = entry->next_;
+    if (entry->expiry_tick_ <= now_tick) {
+      unlink(*entry);
+      expired.emplace_back(std::move(entry->callback_));
+    } else if (entry->expiry_tick_ <= processed_tick_ + slots_.size()) {
+      unlink(*entry);
+      link(*entry);
+    } else {
+      overflow_tick_ = std::min(overflow_tick_, entry->expiry_tick_);
+    }
+    entry = next;
+  }
+}
+
+void timing_wheel::arm_timer(uint64_t tick) {
+  // Re-arming cancels any earlier wait, whose handler then does nothing.
+  armed_tick_ = tick;
+  timer_.expires_at(start_ + tick_duration(tick));
+  timer_.async_wait(transient_.wrap([this](boost::system::error_code ec) {
+    if (!ec) on_tick();
+  }));
+}
+
+void timing_wheel::on_tick() {
+  std::vector<callback_type> expired;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto now_tick = tick_at(clock_type::now(), false);
+
+    // Each slot holds a single tick, so every deadline in a due slot fires.
+    for (auto tick = next_slot_tick(); tick <= now_tick;
+         tick = next_slot_tick()) {
+      auto& head = slots_[tick & slot_mask_];
+      while (head) {
+        auto* entry = head;
+        unlink(*entry);
+        expired.emplace_back(std::move(entry->callback_));
+      }
+    }
+    processed_tick_ = std::max(processed_tick_, now_tick);
+    advance_overflow(now_tick, expired);
+
+    if (num_scheduled_ > 0) {
+      arm_timer(std::min(next_slot_tick(), overflow_tick_));
+    } else {
+      armed_tick_ = no_tick;
+    }
+  }
+
+  for (auto& callback : expired) callback();
+}
+
+}  // namespace riak
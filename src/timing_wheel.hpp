@@ -0,0 +1,115 @@
+#ifndef RIAKPP_TIMING_WHEEL_HPP_
+#define RIAKPP_TIMING_WHEEL_HPP_
+
+#include <boost/asio/basic_waitable_timer.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "transient.hpp"
+#include "unique_function.hpp"
+
+namespace boost {
+namespace asio {
+class io_service;
+}  // namespace asio
+}  // namespace boost
+
+namespace riak {
+
+// A hashed timing wheel with millisecond ticks, shared by many connections and
+// driven by a single Asio timer. The timer is armed for the earliest pending
+// deadline only, so a wheel holding nothing but far-off deadlines stays asleep
+// until they are due. Deadlines are intrusive, so scheduling and cancelling
+// one is O(1) and never allocates.
+//
+// The slots cover one revolution ahead of the last processed tick, so each
+// holds the deadlines of a single tick; later deadlines wait in an overflow
+// list and move into the slots as the wheel advances.
+//
+// All methods are thread-safe. Callbacks run on the io_service, outside of the
+// wheel's lock; a callback which was already firing when its deadline was
+// cancelled or rescheduled still runs, so owners should recheck the time.
+class timing_wheel {
+ public:
+  using clock_type = std::chrono::steady_clock;
+  using time_point = clock_type::time_point;
+  using callback_type = unique_function<void()>;
+
+  static constexpr size_t default_num_slots = 1024;
+
+  class deadline {
+   public:
+    deadline() = default;
+    deadline(const deadline&) = delete;
+    deadline& operator=(const deadline&) = delete;
+
+   private:
+    friend class timing_wheel;
+
+    uint64_t expiry_tick_ = 0;
+    deadline* previous_ = nullptr;
+    deadline* next_ = nullptr;
+    bool scheduled_ = false;
+    bool overflow_ = false;
+    callback_type callback_;
+  };
+
+  // 'num_slots' must be a power of two.
+  explicit timing_wheel(boost::asio::io_service& io_service,
+                        size_t num_slots = default_num_slots);
+  ~timing_wheel();
+
+  // Schedules 'entry' to call 'callback' once 'expires_at' has passed
+  // (rounded up to the next tick), replacing any previous schedule. The
+  // deadline must be cancelled or have fired before it is destroyed.
+  void schedule(deadline& entry, time_point expires_at,
+                callback_type callback);
+  void cancel(deadline& entry);
+
+  size_t num_scheduled() const;
+
+ private:
+  using tick_duration = std::chrono::milliseconds;
+
+  static constexpr uint64_t no_tick = UINT64_MAX;
+  static constexpr size_t bits_per_word = 64;
+
+  uint64_t tick_at(time_point when, bool round_up) const;
+  uint64_t next_slot_tick() const;
+  void link(deadline& entry);
+  void unlink(deadline& entry);
+  void advance_overflow(uint64_t now_tick,
+                        std::vector<callback_type>& expired);
+  void arm_timer(uint64_t tick);
+  void on_tick();
+
+  const time_point start_;
+  const uint64_t slot_mask_;
+  std::vector<deadline*> slots_;
+  // One bit per slot, set while the slot is not empty.
+  std::vector<uint64_t> occupied_;
+
+  // Deadlines beyond the slots' revolution, unordered, and a lower bound on
+  // their expiry ticks.
+  deadline* overflow_ = nullptr;
+  uint64_t overflow_tick_ = no_tick;
+
+  // Every deadline expiring at or before this tick has fired.
+  uint64_t processed_tick_ = 0;
+  // The tick the timer is armed for, no later than any pending deadline, or
+  // 'no_tick' while the wheel is idle.
+  uint64_t armed_tick_ = no_tick;
+  size_t num_scheduled_ = 0;
+  mutable std::mutex mutex_;
+
+  boost::asio::basic_waitable_timer<clock_type> timer_;
+  transient<timing_wheel> transient_;
+};
+
+}  // namespace riak
+
+#endif  // #ifndef RIAKPP_TIMING_WHEEL_HPP_
@@ -0,0 +1,139 @@
+#include "async_priority_queue.hpp"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+struct record {
+  void operator()(int value) { values->push_back(value); }
+  std::vector<int>* values;
+};
+
+TEST(AsyncPriorityQueueTest, StrictPriority) {
+  async_priority_queue<int> queue{3, 8, 8};
+  queue.emplace(2, 20);
+  queue.emplace(1, 10);
+  queue.emplace(2, 21);
+  queue.emplace(0, 0);
+  queue.emplace(1, 11);
+
+  std::vector<int> values;
+  for (int i = 0; i < 5; ++i) queue.async_pop(record{&values});
+  EXPECT_EQ((std::vector<int>{0, 10, 11, 20, 21}), values);
+}
+
+TEST(AsyncPriorityQueueTest, WeightedRoundRobin) {
+  async_priority_queue<int> queue{2, 8, 8, 0, {2, 1}};
+  for (int i = 0; i < 4; ++i) queue.emplace(0, i);
+  for (int i = 0; i < 4; ++i) queue.emplace(1, 10 + i);
+
+  // Lane 0 is picked twice as often as lane 1 until it runs out.
+  std::vector<int> values;
+  for (int i = 0; i < 8; ++i) queue.async_pop(record{&values});
+  EXPECT_EQ((std::vector<int>{0, 10, 1, 2, 11, 3, 12, 13}), values);
+}
+
+TEST(AsyncPriorityQueueTest, WaitingHandlerTakesAnyLane) {
+  async_priority_queue<int> queue{2, 8, 8};
+  std::vector<int> values;
+  queue.async_pop(record{&values});
+  queue.emplace(1, 10);
+  EXPECT_EQ(std::vector<int>{10}, values);
+}
+
+TEST(AsyncPriorityQueueTest, ReservedHandlersOnlyTakeLaneZero) {
+  async_priority_queue<int> queue{2, 8, 8, 1};
+  std::vector<int> reserved, shared;
+  queue.async_pop_reserved(record{&reserved});
+  queue.emplace(1, 10);
+  EXPECT_TRUE(reserved.empty());
+
+  queue.emplace(0, 0);
+  EXPECT_EQ(std::vector<int>{0}, reserved);
+
+  // A re-armed reserved handler takes buffered lane 0 elements first.
+  queue.emplace(0, 1);
+  queue.async_pop_reserved(record{&reserved});
+  EXPECT_EQ((std::vector<int>{0, 1}), reserved);
+
+  queue.async_pop(record{&shared});
+  EXPECT_EQ(std::vector<int>{10}, shared);
+}
+
+TEST(AsyncPriorityQueueTest, LanesAreBoundedSeparately) {
+  async_priority_queue<int> queue{2, 2, 1};
+  EXPECT_TRUE(queue.try_emplace(1, 10));
+  EXPECT_TRUE(queue.try_emplace(1, 11));
+  EXPECT_FALSE(queue.try_emplace(1, 12));
+  EXPECT_TRUE(queue.try_emplace(0, 0));
+
+  std::vector<int> shed;
+  EXPECT_TRUE(queue.try_shed(1, record{&shed}));
+  EXPECT_EQ(std::vector<int>{10}, shed);
+  EXPECT_TRUE(queue.try_emplace(1, 12));
+
+  std::vector<int> values;
+  for (int i = 0; i < 3; ++i) queue.async_pop(record{&values});
+  EXPECT_EQ((std::vector<int>{0, 11, 12}), values);
+  EXPECT_FALSE(queue.try_shed(1, record{&shed}));
+}
+
+struct mark_consumed {
+  void operator()(int value) {
+    *sum += value;
+    ++*consumed;
+    *ready = true;
+  }
+  std::atomic<int64_t>* sum;
+  std::atomic<int>* consumed;
+  std::atomic<bool>* ready;
+};
+
+TEST(AsyncPriorityQueueTest, ConcurrentProducersAndConsumers) {
+  static const int num_lanes = 3, num_producers = 6, num_consumers = 4;
+  static const int per_producer = 10000;
+  static const int total = num_producers * per_producer;
+
+  std::atomic<int64_t> sum{0};
+  std::atomic<int> consumed{0};
+  std::unique_ptr<std::atomic<bool>[]> ready{
+      new std::atomic<bool>[num_consumers]};
+  async_priority_queue<int> queue{num_lanes, 16, num_consumers, 1, {4, 2, 1}};
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_consumers; ++i) {
+    threads.emplace_back([&, i] {
+      while (consumed < total) {
+        ready[i] = false;
+        if (i == 0) {
+          queue.async_pop_reserved(mark_consumed{&sum, &consumed, &ready[i]});
+        } else {
+          queue.async_pop(mark_consumed{&sum, &consumed, &ready[i]});
+        }
+        while (!ready[i] && consumed < total) std::this_thread::yield();
+      }
+    });
+  }
+  for (int i = 0; i < num_producers; ++i) {
+    threads.emplace_back([&, i] {
+      for (int value = 1; value <= per_producer; ++value) {
+        queue.emplace(i % num_lanes, value);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(total, consumed);
+  EXPECT_EQ(int64_t{num_producers} * per_producer * (per_producer + 1) / 2,
+            sum);
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -0,0 +1,190 @@
+#include "async_queue.hpp"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+using owned_int = std::unique_ptr<int>;
+
+struct record_owned {
+  void operator()(owned_int value) { values->push_back(*value); }
+  std::vector<int>* values;
+};
+
+struct record_with_id {
+  void operator()(int value) { calls->push_back({id, value}); }
+  std::vector<std::pair<int, int>>* calls;
+  int id;
+};
+
+TEST(AsyncQueueTest, ElementsAreFifo) {
+  async_queue<owned_int> queue{8, 8};
+  for (int i = 0; i < 5; ++i) queue.emplace(new int{i});
+
+  std::vector<int> values;
+  for (int i = 0; i < 5; ++i) queue.async_pop(record_owned{&values});
+  EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4}), values);
+}
+
+TEST(AsyncQueueTest, HandlersAreLifo) {
+  async_queue<int> queue{8, 8};
+  std::vector<std::pair<int, int>> calls;
+  for (int id = 0; id < 3; ++id) queue.async_pop(record_with_id{&calls, id});
+  for (int value = 0; value < 3; ++value) queue.emplace(value);
+
+  std::vector<std::pair<int, int>> expected{{2, 0}, {1, 1}, {0, 2}};
+  EXPECT_EQ(expected, calls);
+}
+
+TEST(AsyncQueueTest, CancelRemovesTaggedHandlers) {
+  async_queue<int> queue{8, 8};
+  std::vector<std::pair<int, int>> calls;
+  for (int id = 0; id < 4; ++id) {
+    queue.async_pop(record_with_id{&calls, id}, id % 2);
+  }
+  EXPECT_EQ(2u, queue.cancel(1));
+  EXPECT_EQ(0u, queue.cancel(1));
+
+  // The handlers left keep their order; the last element is stored.
+  for (int value = 0; value < 3; ++value) queue.emplace(value);
+  std::vector<std::pair<int, int>> expected{{2, 0}, {0, 1}};
+  EXPECT_EQ(expected, calls);
+  EXPECT_EQ(1u, queue.size());
+}
+
+TEST(AsyncQueueTest, WrapsAround) {
+  async_queue<owned_int> queue{3, 1};
+  std::vector<int> values;
+  for (int i = 0; i < 20; ++i) {
+    queue.emplace(new int{i});
+    queue.emplace(new int{-i});
+    queue.async_pop(record_owned{&values});
+    queue.async_pop(record_owned{&values});
+  }
+  ASSERT_EQ(40u, values.size());
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(i, values[2 * i]);
+    EXPECT_EQ(-i, values[2 * i + 1]);
+  }
+}
+
+TEST(AsyncQueueTest, BlocksAtHighwatermark) {
+  async_queue<int> queue{2, 1};
+  queue.emplace(1);
+  queue.emplace(2);
+
+  std::atomic<bool> pushed{false};
+  std::thread producer{[&] {
+    queue.emplace(3);
+    pushed = true;
+  }};
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(pushed);
+
+  std::vector<std::pair<int, int>> calls;
+  queue.async_pop(record_with_id{&calls, 0});
+  producer.join();
+  EXPECT_TRUE(pushed);
+
+  queue.async_pop(record_with_id{&calls, 1});
+  queue.async_pop(record_with_id{&calls, 2});
+  std::vector<std::pair<int, int>> expected{{0, 1}, {1, 2}, {2, 3}};
+  EXPECT_EQ(expected, calls);
+}
+
+TEST(AsyncQueueTest, CloseUnblocksAndDrops) {
+  async_queue<int> queue{1, 1};
+  queue.emplace(1);
+
+  bool emplaced = true;
+  std::thread producer{[&] { emplaced = queue.emplace(2); }};
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  queue.close();
+  producer.join();
+  EXPECT_TRUE(queue.closed());
+  EXPECT_FALSE(emplaced);
+  EXPECT_FALSE(queue.emplace(3));
+
+  std::vector<std::pair<int, int>> calls;
+  queue.async_pop(record_with_id{&calls, 0});
+  EXPECT_TRUE(calls.empty());
+}
+
+TEST(AsyncQueueTest, TryEmplaceAndTryPop) {
+  async_queue<owned_int> queue{2, 1};
+  std::vector<int> values;
+  EXPECT_FALSE(queue.try_pop(record_owned{&values}));
+
+  owned_int value{new int{3}};
+  EXPECT_TRUE(queue.try_emplace(new int{1}));
+  EXPECT_TRUE(queue.try_emplace(new int{2}));
+  EXPECT_FALSE(queue.try_emplace(std::move(value)));
+  ASSERT_TRUE(value);
+
+  EXPECT_TRUE(queue.try_pop(record_owned{&values}));
+  EXPECT_TRUE(queue.try_emplace(std::move(value)));
+  EXPECT_TRUE(queue.try_pop(record_owned{&values}));
+  EXPECT_TRUE(queue.try_pop(record_owned{&values}));
+  EXPECT_FALSE(queue.try_pop(record_owned{&values}));
+  EXPECT_EQ((std::vector<int>{1, 2, 3}), values);
+
+  // A waiting handler takes the element even though nothing is buffered.
+  queue.async_pop(record_owned{&values});
+  EXPECT_TRUE(queue.try_emplace(new int{4}));
+  EXPECT_EQ(4, values.back());
+}
+
+struct mark_consumed {
+  void operator()(int value) {
+    *sum += value;
+    ++*consumed;
+    *ready = true;
+  }
+  std::atomic<int64_t>* sum;
+  std::atomic<int>* consumed;
+  std::atomic<bool>* ready;
+};
+
+TEST(AsyncQueueTest, ConcurrentProducersAndConsumers) {
+  static const int num_producers = 8, num_consumers = 4;
+  static const int per_producer = 20000;
+  static const int total = num_producers * per_producer;
+
+  std::atomic<int64_t> sum{0};
+  std::atomic<int> consumed{0};
+  std::unique_ptr<std::atomic<bool>[]> ready{
+      new std::atomic<bool>[num_consumers]};
+  async_queue<int> queue{64, num_consumers};
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_consumers; ++i) {
+    threads.emplace_back([&, i] {
+      while (consumed < total) {
+        ready[i] = false;
+        queue.async_pop(mark_consumed{&sum, &consumed, &ready[i]});
+        while (!ready[i] && consumed < total) std::this_thread::yield();
+      }
+    });
+  }
+  for (int i = 0; i < num_producers; ++i) {
+    threads.emplace_back([&] {
+      for (int value = 1; value <= per_producer; ++value) queue.emplace(value);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(total, consumed);
+  EXPECT_EQ(int64_t{num_producers} * per_producer * (per_producer + 1) / 2,
+            sum);
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
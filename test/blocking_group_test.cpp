@@ -4,6 +4,8 @@
 #include <atomic>
 #include <memory>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace riak {
 namespace testing {
@@ -80,6 +82,28 @@ TEST(BlockingGroupTest, MovableOnly) {
   async.join();
 }
 
+TEST(BlockingGroupTest, ManyThreads) {
+  constexpr int num_threads = 16;
+  blocking_group blocking;
+  for (int run = 0; run < 10; ++run) {
+    std::atomic<int> calls{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back(blocking.wrap([&] { ++calls; }));
+    }
+    blocking.wait();
+    EXPECT_EQ(num_threads, calls);
+    for (auto& thread : threads) thread.join();
+    blocking.reset();
+  }
+  blocking.wait();
+}
+
+// Wrapped functions point at the group's count.
+static_assert(!std::is_move_constructible<blocking_group>::value &&
+                  !std::is_move_assignable<blocking_group>::value,
+              "A blocking_group must not move.");
+
 }  // namespace
 }  // namespace testing
 }  // namespace riak
@@ -0,0 +1,103 @@
+#include "buffer_pool.hpp"
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+TEST(BufferPoolTest, ReusesReleasedBuffers) {
+  buffer_pool pool;
+  auto buffer = pool.acquire(100);
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_LE(100u, buffer.capacity());
+  EXPECT_EQ(0u, pool.hits());
+  EXPECT_EQ(1u, pool.misses());
+
+  buffer.assign(100, 'x');
+  auto data = buffer.data();
+  pool.release(std::move(buffer));
+
+  auto reused = pool.acquire(90);
+  EXPECT_TRUE(reused.empty());
+  EXPECT_EQ(data, reused.data());
+  EXPECT_EQ(1u, pool.hits());
+  EXPECT_EQ(1u, pool.misses());
+}
+
+TEST(BufferPoolTest, SizeClasses) {
+  buffer_pool pool;
+  auto small = pool.acquire(10);
+  EXPECT_LE(buffer_pool::min_class_size, small.capacity());
+  pool.release(std::move(small));
+
+  // A small buffer cannot be handed out for a larger request.
+  auto large = pool.acquire(1000);
+  EXPECT_LE(1000u, large.capacity());
+  EXPECT_EQ(0u, pool.hits());
+  EXPECT_EQ(2u, pool.misses());
+
+  // But a large buffer can be handed out for the class it was acquired for.
+  pool.release(std::move(large));
+  large = pool.acquire(600);
+  EXPECT_EQ(1u, pool.hits());
+}
+
+TEST(BufferPoolTest, RespectsBudget) {
+  buffer_pool pool{buffer_pool::num_classes * buffer_pool::min_class_size * 2};
+  std::vector<std::string> buffers;
+  for (int i = 0; i < 3; ++i) buffers.push_back(pool.acquire(1));
+  for (auto& buffer : buffers) pool.release(std::move(buffer));
+
+  // Only two buffers of the smallest class fit in the budget.
+  for (int i = 0; i < 3; ++i) pool.acquire(1);
+  EXPECT_EQ(2u, pool.hits());
+  EXPECT_EQ(4u, pool.misses());
+
+  // Buffers that are too large for any class are never pooled.
+  auto huge = pool.acquire(64 << 20);
+  pool.release(std::move(huge));
+  pool.acquire(64 << 20);
+  EXPECT_EQ(2u, pool.hits());
+}
+
+TEST(BufferPoolTest, ConcurrentUse) {
+  buffer_pool pool;
+  std::vector<std::thread> threads;
+  for (int i_thread = 0; i_thread < 4; ++i_thread) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; ++i) {
+        auto buffer = pool.acquire(i % 300);
+        buffer.assign(i % 300, 'a');
+        pool.release(std::move(buffer));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(4000u, pool.hits() + pool.misses());
+  EXPECT_LT(pool.misses(), 100u);
+}
+
+TEST(BufferPoolTest, SeparateArenas) {
+  buffer_pool pool{buffer_pool::default_max_pooled_bytes, 2};
+  EXPECT_EQ(2u, pool.num_arenas());
+
+  // A buffer released to one arena is only reused from that arena.
+  pool.release(pool.acquire(100, 0), 0);
+  pool.acquire(100, 1);
+  EXPECT_EQ(0u, pool.hits());
+  pool.acquire(100, 0);
+  EXPECT_EQ(1u, pool.hits());
+
+  // Arena indices wrap around.
+  pool.release(pool.acquire(100, 1), 1);
+  pool.acquire(100, 3);
+  EXPECT_EQ(2u, pool.hits());
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -0,0 +1,311 @@
+#include <boost/asio/io_service.hpp>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "cluster.hpp"
+#include "length_framed_connection.hpp"
+#include "sharded_cluster.hpp"
+#include "testing_util.hpp"
+#include "test_length_framed_server.hpp"
+#include "thread_pool.hpp"
+
+namespace riak {
+namespace testing {
+namespace {
+using cluster_type = cluster<length_framed_connection>;
+constexpr auto allow_errors = response::allow_errors_yes;
+
+TEST(ClusterTest, RoundRobinSpreadsRequests) {
+  constexpr uint32_t msgs_per_node = 50;
+  mock_server first, second;
+  thread_pool threads{4};
+  std::atomic<uint32_t> msgs_received{0};
+
+  std::unique_ptr<cluster_type> nodes{new cluster_type{
+      threads.io_service(),
+      std::vector<node_address>{{"localhost", first.port()},
+                                {"localhost", second.port()}},
+      connection_options{}.max_connections(2)}};
+  ASSERT_EQ(2, nodes->num_nodes());
+
+  for (auto server : {&first, &second}) {
+    EXPECT_CALL(*server, on_receive(Eq(asio_success), _))
+        .Times(msgs_per_node)
+        .WillRepeatedly(Invoke([](asio_error, std::string request) {
+          return response{request + "_reply"};
+        }));
+    server->expect_eof_and_close();
+  }
+  std::thread first_thread{[&] { first.run(2, 20000); }};
+  std::thread second_thread{[&] { second.run(2, 20000); }};
+
+  for (uint32_t i = 0; i < 2 * msgs_per_node; ++i) {
+    send_and_expect(*nodes, "okay" + std::to_string(i), 20000, errc_success,
+                    "okay" + std::to_string(i) + "_reply", [&] {
+      if (++msgs_received == 2 * msgs_per_node) {
+        nodes.reset();
+        threads.io_service().stop();
+      }
+    });
+  }
+  first_thread.join();
+  second_thread.join();
+}
+
+TEST(ClusterTest, CustomBalancer) {
+  struct always_last : load_balancer {
+    size_t pick(const std::vector<const node_load*>& nodes) override {
+      return nodes.size() - 1;
+    }
+  };
+  mock_server first, second;
+  thread_pool threads{2};
+
+  std::unique_ptr<cluster_type> nodes{new cluster_type{
+      threads.io_service(),
+      std::vector<node_address>{{"localhost", first.port()},
+                                {"localhost", second.port()}},
+      connection_options{}.max_connections(1).custom_balancer(
+          std::make_shared<always_last>())}};
+
+  send_and_expect(*nodes, "okay1", 1000, errc_success, "okay1_reply", [&] {
+    EXPECT_EQ(0, nodes->node(0).load().latency_ns());
+    EXPECT_GT(nodes->node(1).load().latency_ns(), 0);
+  });
+  EXPECT_CALL(second, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Invoke([&](asio_error, std::string) {
+        second.post([&] { nodes.reset(); });
+        return response{"okay1_reply"};
+      }));
+  second.expect_eof_and_close();
+  second.run(1);
+}
+
+TEST(ClusterTest, HedgesSlowRequests) {
+  struct always_first : load_balancer {
+    size_t pick(const std::vector<const node_load*>& nodes) override {
+      return 0;
+    }
+  };
+  mock_server slow, fast;
+  thread_pool threads{2};
+
+  std::unique_ptr<cluster_type> nodes{new cluster_type{
+      threads.io_service(),
+      std::vector<node_address>{{"localhost", slow.port()},
+                                {"localhost", fast.port()}},
+      connection_options{}
+          .max_connections(1)
+          .hedge_delay_ms(20)
+          .custom_balancer(std::make_shared<always_first>())}};
+
+  EXPECT_CALL(slow, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{500, "slow_reply", allow_errors}));
+  slow.expect_eof_and_close();
+  EXPECT_CALL(fast, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{"fast_reply"}));
+  fast.expect_eof_and_close();
+  std::thread slow_thread{[&] { slow.run(1); }};
+
+  nodes->async_send_hedged({"okay1", 1000}, [&](std::error_code ec,
+                                                 std::string& reply) {
+    EXPECT_FALSE(ec) << ec.message();
+    EXPECT_EQ("fast_reply", reply);
+    EXPECT_EQ(1, nodes->num_hedged_requests());
+    fast.post([&] { nodes.reset(); });
+  });
+  fast.run(1);
+  slow_thread.join();
+}
+
+TEST(ClusterTest, DoesNotHedgeFastRequests) {
+  mock_server server;
+  thread_pool threads{2};
+
+  std::unique_ptr<cluster_type> nodes{new cluster_type{
+      threads.io_service(),
+      std::vector<node_address>{{"localhost", server.port()}},
+      connection_options{}.max_connections(1).hedge_delay_ms(200)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{"okay1_reply"}));
+  server.expect_eof_and_close();
+
+  nodes->async_send_hedged({"okay1", 1000}, [&](std::error_code ec,
+                                                 std::string& reply) {
+    EXPECT_FALSE(ec) << ec.message();
+    EXPECT_EQ("okay1_reply", reply);
+    EXPECT_EQ(0, nodes->num_hedged_requests());
+    server.post([&] { nodes.reset(); });
+  });
+  server.run(1);
+}
+
+TEST(ClusterTest, RecyclesUnsentHedges) {
+  constexpr uint32_t num_msgs = 20;
+  mock_server server;
+  thread_pool threads{1};
+  auto buffers = std::make_shared<buffer_pool>();
+  const std::string request(100, 'r');
+
+  std::unique_ptr<cluster_type> nodes{new cluster_type{
+      threads.io_service(),
+      std::vector<node_address>{{"localhost", server.port()}},
+      connection_options{}.max_connections(1).hedge_delay_ms(200),
+      buffers}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(request)))
+      .Times(num_msgs)
+      .WillRepeatedly(Return(response{"reply"}));
+  server.expect_eof_and_close();
+
+  // Requests are sent one at a time, each once the previous one's state is
+  // gone: after the first, the duplicates kept for hedging never allocate.
+  uint32_t msgs_received = 0;
+  uint64_t first_misses = 0;
+  std::function<void()> send_next = [&] {
+    nodes->async_send_hedged({request, 1000}, [&](std::error_code ec,
+                                                   std::string& reply) {
+      EXPECT_FALSE(ec) << ec.message();
+      EXPECT_EQ("reply", reply);
+      if (++msgs_received == 1) first_misses = buffers->misses();
+      if (msgs_received < num_msgs) {
+        threads.io_service().post(send_next);
+        return;
+      }
+      EXPECT_EQ(0, nodes->num_hedged_requests());
+      EXPECT_EQ(first_misses, buffers->misses());
+      server.post([&] { nodes.reset(); });
+    });
+  };
+  send_next();
+  server.run(1);
+}
+
+TEST(ClusterTest, ShardsSplitConnections) {
+  constexpr uint32_t num_msgs = 40;
+  mock_server server;
+  thread_pool threads{2, thread_pool::sharding::per_thread};
+  std::atomic<uint32_t> msgs_received{0};
+
+  // One connection per shard, each run without a strand.
+  std::unique_ptr<sharded_cluster<length_framed_connection>> shards{
+      new sharded_cluster<length_framed_connection>{
+          threads,
+          std::vector<node_address>{{"localhost", server.port()}},
+          connection_options{}.max_connections(1).shard_per_thread(true)}};
+  ASSERT_EQ(2, shards->num_shards());
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), _))
+      .Times(num_msgs)
+      .WillRepeatedly(Invoke([](asio_error, std::string request) {
+        return response{request + "_reply"};
+      }));
+  server.expect_eof_and_close();
+
+  for (uint32_t i = 0; i < num_msgs; ++i) {
+    send_and_expect(*shards, "okay" + std::to_string(i), 20000, errc_success,
+                    "okay" + std::to_string(i) + "_reply", [&] {
+      if (++msgs_received == num_msgs) server.post([&] { shards.reset(); });
+    });
+  }
+  server.run(2, 20000);
+}
+
+TEST(ClusterTest, ShardsDivideConnectionLimits) {
+  // The server is never run: connections are accepted but never answered.
+  mock_server server;
+  thread_pool threads{2, thread_pool::sharding::per_thread};
+  auto make_shards = [&](connection_options options) {
+    return std::unique_ptr<sharded_cluster<length_framed_connection>>{
+        new sharded_cluster<length_framed_connection>{
+            threads, std::vector<endpoint_vector>{server.endpoints()},
+            options.shard_per_thread(true)}};
+  };
+
+  // The first shard takes the odd connection.
+  auto shards = make_shards(connection_options{}.max_connections(3));
+  EXPECT_EQ(2, shards->shard(0).node(0).num_active_connections());
+  EXPECT_EQ(1, shards->shard(1).node(0).num_active_connections());
+
+  // Every shard gets at least one.
+  shards = make_shards(
+      connection_options{}.min_connections(1).max_connections(4));
+  EXPECT_EQ(1, shards->shard(0).node(0).num_active_connections());
+  EXPECT_EQ(1, shards->shard(1).node(0).num_active_connections());
+  shards.reset();
+}
+
+TEST(ClusterTest, ShardsBuiltFromAShardThread) {
+  // Shards are normally built on their own threads; from one of them, they
+  // are built straight away instead of waiting on it.
+  mock_server server;
+  thread_pool threads{2, thread_pool::sharding::per_thread};
+  std::unique_ptr<sharded_cluster<length_framed_connection>> shards;
+  std::promise<void> built;
+  threads.shard(1).post([&] {
+    shards.reset(new sharded_cluster<length_framed_connection>{
+        threads, std::vector<endpoint_vector>{server.endpoints()},
+        connection_options{}.max_connections(2).shard_per_thread(true)});
+    built.set_value();
+  });
+  built.get_future().get();
+  EXPECT_EQ(2, shards->num_shards());
+  shards.reset();
+}
+
+TEST(ClusterTest, ShardsRecycleTheirOwnBuffers) {
+  constexpr uint32_t num_msgs = 20;
+  mock_server server;
+  thread_pool threads{2, thread_pool::sharding::per_thread};
+  const std::string request(100, 'r');
+
+  std::unique_ptr<sharded_cluster<length_framed_connection>> shards{
+      new sharded_cluster<length_framed_connection>{
+          threads,
+          std::vector<node_address>{{"localhost", server.port()}},
+          connection_options{}.max_connections(1).shard_per_thread(true)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(request)))
+      .Times(num_msgs)
+      .WillRepeatedly(Return(response{"reply"}));
+  server.expect_eof_and_close();
+  std::thread server_thread{[&] { server.run(2); }};
+
+  // Requests are sent from a thread outside the shards, taking turns between
+  // them. Each payload comes from the arena of the shard it is sent to, which
+  // releases it there, so once every shard is warm nothing is allocated.
+  auto& buffers = shards->buffers();
+  uint64_t warm_misses = 0;
+  for (uint32_t i = 0; i < num_msgs; ++i) {
+    if (i == 2 * shards->num_shards()) warm_misses = buffers.misses();
+    auto& shard = shards->pick();
+    auto payload = shard.buffers().acquire(request.size(),
+                                           shard.buffer_arena());
+    payload.assign(request);
+    std::promise<void> answered;
+    shard.async_send({std::move(payload), 1000},
+                     [&](std::error_code ec, std::string& reply) {
+      EXPECT_FALSE(ec) << ec.message();
+      EXPECT_EQ("reply", reply);
+      answered.set_value();
+    });
+    answered.get_future().wait();
+  }
+  EXPECT_EQ(warm_misses, buffers.misses());
+  shards.reset();
+  server_thread.join();
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
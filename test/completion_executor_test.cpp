@@ -0,0 +1,46 @@
+#include "completion_executor.hpp"
+#include <gtest/gtest.h>
+
+#include <boost/asio/io_service.hpp>
+
+#include <future>
+#include <thread>
+
+namespace riak {
+namespace testing {
+namespace {
+
+TEST(CompletionExecutorTest, RunsOnItsOwnThreads) {
+  completion_executor executor{1, "test-cb"};
+  std::promise<std::thread::id> ran_on;
+  executor.post([&] { ran_on.set_value(std::this_thread::get_id()); });
+  EXPECT_NE(std::this_thread::get_id(), ran_on.get_future().get());
+  executor.stop();
+}
+
+TEST(CompletionExecutorTest, CountsQueuedHandlers) {
+  boost::asio::io_service io_service;
+  completion_executor executor{io_service};
+  size_t num_run = 0;
+  for (int i = 0; i < 3; ++i) executor.post([&] { ++num_run; });
+  EXPECT_EQ(3u, executor.queue_depth());
+  EXPECT_EQ(3u, executor.max_queue_depth());
+
+  // Stopping leaves the user's io_service alone.
+  executor.stop();
+  EXPECT_FALSE(io_service.stopped());
+
+  io_service.run_one();
+  EXPECT_EQ(1u, num_run);
+  EXPECT_EQ(2u, executor.queue_depth());
+
+  executor.post([&] { ++num_run; });
+  io_service.run();
+  EXPECT_EQ(4u, num_run);
+  EXPECT_EQ(0u, executor.queue_depth());
+  EXPECT_EQ(3u, executor.max_queue_depth());
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -1,6 +1,8 @@
 #include "completion_group.hpp"
 #include <gtest/gtest.h>
 
+#include <functional>
+
 namespace riak {
 namespace testing {
 namespace {
@@ -89,6 +91,19 @@ TEST(CompletionGroupTest, MovableOnly) {
   EXPECT_EQ(-1, h);
 }
 
+TEST(CompletionGroupTest, MoveAssignNotifiesPrevious) {
+  int first = 0, second = 0;
+  auto group = make_completion_group(std::function<void()>{[&] { ++first; }});
+  auto wrapped = group.wrap([] {});
+  group = make_completion_group(std::function<void()>{[&] { ++second; }});
+  EXPECT_EQ(0, first);
+  { auto done = std::move(wrapped); }
+  EXPECT_EQ(1, first);
+  EXPECT_EQ(0, second);
+  group.notify();
+  EXPECT_EQ(1, second);
+}
+
 }  // namespace
 }  // namespace testing
 }  // namespace riak
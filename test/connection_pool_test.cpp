@@ -3,10 +3,18 @@
 #include <gtest/gtest.h>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
 #include <system_error>
 #include <thread>
 #include <utility>
 
+#include "completion_executor.hpp"
 #include "connection_pool.hpp"
 #include "length_framed_connection.hpp"
 #include "testing_util.hpp"
@@ -17,6 +25,35 @@ namespace riak {
 namespace testing {
 namespace {
 constexpr auto allow_errors = response::allow_errors_yes;
+using pool_type = connection_pool<length_framed_connection>;
+
+// Records the error each named request completed with.
+class outcome_log {
+ public:
+  pool_type::handler_type handler(std::string name) {
+    return [this, name](std::error_code ec, std::string&) {
+      std::lock_guard<std::mutex> lock{mutex_};
+      outcomes_[name] = ec;
+      changed_.notify_all();
+    };
+  }
+
+  std::error_code wait_for(const std::string& name) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    changed_.wait(lock, [&] { return outcomes_.count(name) > 0; });
+    return outcomes_[name];
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return outcomes_.size();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::map<std::string, std::error_code> outcomes_;
+};
 
 TEST(ConnectionPoolTest, SequencedMessages) {
   InSequence sequence;
@@ -24,7 +61,8 @@ TEST(ConnectionPoolTest, SequencedMessages) {
   thread_pool threads{4};
   std::unique_ptr<connection_pool<length_framed_connection>> pool{
       new connection_pool<length_framed_connection>{
-          threads.io_service(), "localhost", server.port(), 2, 4096, 1000}};
+          threads.io_service(), "localhost", server.port(),
+          connection_options{}.max_connections(2).connection_timeout_ms(1000)}};
 
   send_and_expect(*pool, "okay1", 300, errc_success, "okay1_reply", [&] {
   send_and_expect(*pool, "okay2", 300, errc_success, "okay2_reply", [&] {
@@ -52,10 +90,17 @@ TEST(ConnectionPoolTest, ManyMessages) {
     std::atomic<uint32_t> msgs_received{0};
     constexpr uint32_t msgs_to_send = 1000;
 
+    // Requests are handed out one at a time, so that the counts below measure
+    // the balancing alone: a connection which takes the requests buffered
+    // behind its own (see GathersBufferedRequests) gets a share that follows
+    // how fast it answers.
     std::unique_ptr<connection_pool<length_framed_connection>> pool{
         new connection_pool<length_framed_connection>{
-            threads.io_service(), "localhost", server.port(), num_connections,
-            4096, 1000}};
+            threads.io_service(), "localhost", server.port(),
+            connection_options{}
+                .max_connections(num_connections)
+                .max_write_batch(1)
+                .connection_timeout_ms(1000)}};
 
     // Expect 'msgs_to_send' messages (in any order) and reply to 'msg' with
     // 'msg_reply'.
@@ -115,6 +160,195 @@ TEST(ConnectionPoolTest, ManyMessages) {
   }
 }
 
+TEST(ConnectionPoolTest, PipelinedMessages) {
+  mock_server server;
+  thread_pool threads{4};
+  std::atomic<uint32_t> msgs_received{0};
+  constexpr uint32_t msgs_to_send = 200;
+
+  std::unique_ptr<connection_pool<length_framed_connection>> pool{
+      new connection_pool<length_framed_connection>{
+          threads.io_service(), "localhost", server.port(),
+          connection_options{}.max_connections(1).pipeline_depth(8)}};
+
+  for (uint32_t i = 0; i < msgs_to_send; ++i) {
+    EXPECT_CALL(server, on_receive(Eq(asio_success), _))
+        .WillOnce(Invoke([&](asio_error, std::string request) {
+          return response{request + "_reply"};
+        }))
+        .RetiresOnSaturation();
+  }
+  server.expect_eof_and_close();
+  std::thread server_thread{[&] { server.run(1, 20000); }};
+
+  for (uint32_t i = 0; i < msgs_to_send; ++i) {
+    send_and_expect(*pool, "okay" + std::to_string(i), 20000, errc_success,
+                    "okay" + std::to_string(i) + "_reply", [&] {
+      if (++msgs_received == msgs_to_send) {
+        pool.reset();
+        threads.io_service().stop();
+      }
+    });
+  }
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, GathersBufferedRequests) {
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("a")))
+      .WillOnce(Return(response{30, "r"}));
+  for (auto name : {"b", "c", "d", "e"}) {
+    EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(name)))
+        .WillOnce(Return(response{"r"}));
+  }
+  EXPECT_CALL(server, on_receive(Ne(asio_success), Eq("")))
+      .Times(AnyNumber())
+      .WillRepeatedly(Return(response{}));
+  std::thread server_thread{[&] { server.run(); }};
+
+  // The requests buffered while the first one is answered all go out in a
+  // single write, even with the default pipeline depth of one.
+  for (auto name : {"a", "b", "c", "d", "e"}) {
+    pool->async_send({name, 20000}, log.handler(name));
+  }
+  for (auto name : {"a", "b", "c", "d", "e"}) EXPECT_FALSE(log.wait_for(name));
+  EXPECT_EQ(2u, pool->num_writes());
+
+  pool.reset();
+  server.post([&] { server.stop(); });
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, RecyclesResponsesOnCompletionThreads) {
+  mock_server server;
+  thread_pool threads{1};
+  completion_executor completions{1, "test-cb"};
+  constexpr uint32_t msgs_to_send = 20;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1), nullptr, &completions}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("ping")))
+      .Times(msgs_to_send)
+      .WillRepeatedly(Return(response{"pong"}));
+  server.expect_eof_and_close();
+  std::thread server_thread{[&] { server.run(1); }};
+
+  // Each request is sent once the previous handler returned and its response
+  // went back to the pool, so every response but the first reuses a buffer.
+  std::promise<void> done;
+  uint32_t msgs_received = 0;
+  std::function<void()> send_next = [&] {
+    send_and_expect(*pool, "ping", 1000, errc_success, "pong", [&] {
+      if (++msgs_received == msgs_to_send) {
+        done.set_value();
+      } else {
+        completions.post(send_next);
+      }
+    });
+  };
+  send_next();
+  done.get_future().wait();
+  completions.stop();
+  EXPECT_EQ(msgs_to_send - 1, pool->buffers().hits());
+
+  pool.reset();
+  threads.io_service().stop();
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, LocalSocket) {
+  InSequence sequence;
+  mock_server server{"/tmp/riakpp_test_" + std::to_string(random_port())};
+  thread_pool threads{2};
+  std::unique_ptr<connection_pool<length_framed_connection>> pool{
+      new connection_pool<length_framed_connection>{
+          threads.io_service(), server.endpoints(),
+          connection_options{}.max_connections(1)}};
+
+  send_and_expect(*pool, "okay1", 1000, errc_success, "okay1_reply", [&] {
+  send_and_expect(*pool, "okay2", 1000, errc_success, "okay2_reply");
+  });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{"okay1_reply"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay2")))
+      .WillOnce(Invoke([&](asio_error, std::string) {
+        server.post([&] { pool.reset(); });
+        return response{"okay2_reply"};
+      }));
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(ConnectionPoolTest, SkipsEjectedEndpoints) {
+  mock_server server;
+  thread_pool threads{2};
+  // Nothing listens on the first endpoint.
+  auto dead_port = random_port();
+  while (dead_port == server.port()) dead_port = random_port();
+  auto endpoints = server.endpoints();
+  endpoints.insert(endpoints.begin(),
+                   boost::asio::ip::tcp::endpoint{
+                       boost::asio::ip::address_v4::loopback(), dead_port});
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), endpoints,
+      connection_options{}.max_connections(1).eject_after_failures(1)}};
+
+  send_and_expect(*pool, "okay1", 1000, errc_success, "okay1_reply", [&] {
+  send_and_expect(*pool, "okay2", 1000, errc_success, "okay2_reply");
+  });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{"okay1_reply"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay2")))
+      .WillOnce(Invoke([&](asio_error, std::string) {
+        server.post([&] {
+          EXPECT_TRUE(pool->health().ejected(0));
+          EXPECT_EQ(1, pool->health().ejections());
+          pool.reset();
+        });
+        return response{"okay2_reply"};
+      }));
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(ConnectionPoolTest, EagerConnect) {
+  mock_server server;
+  thread_pool threads{2};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), "localhost", server.port(),
+      connection_options{}.max_connections(3).eager_connect(true)}};
+
+  // Every connection is open before any request is sent (although the server
+  // may not have accepted them all yet).
+  pool->async_wait_ready([&](std::error_code ec) {
+    EXPECT_FALSE(ec) << ec.message();
+    server.post([&] { pool.reset(); });
+  });
+  server.expect_eof_and_close();
+  server.run();
+}
+
+TEST(ConnectionPoolTest, EagerConnectRefused) {
+  thread_pool threads{2};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), "localhost", random_port(),
+      connection_options{}.max_connections(2).eager_connect(true)}};
+
+  std::promise<std::error_code> ready;
+  pool->async_wait_ready([&](std::error_code ec) { ready.set_value(ec); });
+  EXPECT_EQ(std::make_error_code(std::errc::connection_refused),
+            ready.get_future().get());
+}
+
 TEST(ConnectionPoolTest, ConnectionRefused) {
   for (int i_run = 0; i_run < 100; ++i_run) {
     constexpr uint32_t msgs_to_send = 20;
@@ -122,7 +356,10 @@ TEST(ConnectionPoolTest, ConnectionRefused) {
     thread_pool threads{4};
     std::unique_ptr<connection_pool<length_framed_connection>> pool{
         new connection_pool<length_framed_connection>{
-            threads.io_service(), "localhost", random_port(), 3, 4096, 1000}};
+            threads.io_service(), "localhost", random_port(),
+            connection_options{}
+                .max_connections(3)
+                .connection_timeout_ms(1000)}};
 
     for (size_t i_msg = 0; i_msg < msgs_to_send; ++i_msg) {
       send_and_expect(*pool, "a", 5000, std::errc::connection_refused, "", [&] {
@@ -136,6 +373,383 @@ TEST(ConnectionPoolTest, ConnectionRefused) {
   }
 }
 
+TEST(ConnectionPoolTest, OverflowFail) {
+  // The server is never run, so connections are accepted but never answered.
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1).highwatermark(2).on_overflow(
+          overflow_policy::fail)}};
+
+  // The first request goes straight to the connection, the next two are
+  // buffered.
+  for (auto name : {"sent", "first", "second", "rejected"}) {
+    pool->async_send({name, 20000}, log.handler(name));
+  }
+  EXPECT_EQ(std::make_error_code(std::errc::no_buffer_space),
+            log.wait_for("rejected"));
+  EXPECT_FALSE(
+      pool->try_async_send({"dropped", 20000}, log.handler("dropped")));
+  EXPECT_EQ(1u, log.size());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, OverflowShedOldest) {
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1).highwatermark(2).on_overflow(
+          overflow_policy::shed_oldest)}};
+
+  for (auto name : {"sent", "first", "second", "third"}) {
+    pool->async_send({name, 20000}, log.handler(name));
+  }
+  EXPECT_EQ(std::make_error_code(std::errc::no_buffer_space),
+            log.wait_for("first"));
+  EXPECT_EQ(1u, log.size());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, OverflowShedOldestWithNothingToShed) {
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1).highwatermark(0).on_overflow(
+          overflow_policy::shed_oldest)}};
+
+  // Without room for a single request there is never anything to shed, so
+  // the request fails instead of waiting for room.
+  pool->async_send({"rejected", 20000}, log.handler("rejected"));
+  EXPECT_EQ(std::make_error_code(std::errc::no_buffer_space),
+            log.wait_for("rejected"));
+  EXPECT_EQ(0u, pool->buffered_bytes());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, ByteBudget) {
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .max_connections(1)
+          .max_buffered_bytes(10)
+          .on_overflow(overflow_policy::fail)}};
+
+  // Requests count against the budget both in flight and buffered.
+  pool->async_send({"sent", 20000}, log.handler("sent"));
+  pool->async_send({"four", 20000}, log.handler("four"));
+  EXPECT_EQ(8u, pool->buffered_bytes());
+  pool->async_send({"three", 20000}, log.handler("three"));
+  EXPECT_EQ(std::make_error_code(std::errc::no_buffer_space),
+            log.wait_for("three"));
+  EXPECT_TRUE(pool->try_async_send({"to", 20000}, log.handler("to")));
+  EXPECT_EQ(10u, pool->buffered_bytes());
+  EXPECT_FALSE(pool->try_async_send({"a", 20000}, log.handler("a")));
+  EXPECT_EQ(1u, log.size());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, ByteBudgetReleasedOnResponse) {
+  mock_server server;
+  thread_pool threads{2};
+  std::atomic<uint32_t> msgs_received{0};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .max_connections(1)
+          .pipeline_depth(2)
+          .max_buffered_bytes(8)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{10, "okay1_reply"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay2")))
+      .WillOnce(Return(response{"okay2_reply"}));
+  server.expect_eof_and_close();
+  std::thread server_thread{[&] { server.run(1); }};
+
+  auto stop_when_done = [&] {
+    if (++msgs_received == 2) {
+      pool.reset();
+      threads.io_service().stop();
+    }
+  };
+  send_and_expect(*pool, "okay1", 1000, errc_success, "okay1_reply",
+                  stop_when_done);
+  // Over budget: blocks until the first response releases its bytes.
+  send_and_expect(*pool, "okay2", 1000, errc_success, "okay2_reply",
+                  stop_when_done);
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, ExpiredWhileBuffered) {
+  InSequence sequence;
+  mock_server server;
+  thread_pool threads{2};
+  std::atomic<uint32_t> msgs_received{0};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("sent")))
+      .WillOnce(Return(response{80, "sent_reply"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("kept")))
+      .WillOnce(Return(response{"kept_reply"}));
+  server.expect_eof_and_close();
+  std::thread server_thread{[&] { server.run(1); }};
+
+  auto stop_when_done = [&] {
+    if (++msgs_received == 3) {
+      pool.reset();
+      threads.io_service().stop();
+    }
+  };
+  // The deadline includes the time spent waiting for the connection, so the
+  // second request is failed without ever being sent.
+  send_and_expect(*pool, "sent", 1000, errc_success, "sent_reply",
+                  stop_when_done);
+  send_and_expect(*pool, "expired", 40, std::errc::timed_out, "",
+                  stop_when_done);
+  send_and_expect(*pool, "kept", 1000, errc_success, "kept_reply",
+                  stop_when_done);
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, GrowsWithQueueDepth) {
+  // The server is never run, so connections are accepted but never answered.
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .min_connections(1)
+          .max_connections(3)
+          .grow_queue_depth(1)}};
+  EXPECT_EQ(1u, pool->num_active_connections());
+
+  // The second request is buffered without reaching the threshold, the third
+  // one crosses it and a new connection takes the second.
+  pool->async_send({"a", 20000}, log.handler("a"));
+  pool->async_send({"b", 20000}, log.handler("b"));
+  EXPECT_EQ(1u, pool->num_active_connections());
+  pool->async_send({"c", 20000}, log.handler("c"));
+  EXPECT_EQ(2u, pool->num_active_connections());
+  for (auto name : {"d", "e", "f"}) {
+    pool->async_send({name, 20000}, log.handler(name));
+  }
+  EXPECT_EQ(3u, pool->num_active_connections());
+  EXPECT_EQ(0u, log.size());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, GrowsWithWaitTime) {
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .min_connections(1)
+          .max_connections(3)
+          .pipeline_depth(2)
+          .grow_queue_depth(100)
+          .grow_wait_ms(10)}};
+
+  // Both requests go straight to the first connection's pipeline slots.
+  pool->async_send({"a", 20000}, log.handler("a"));
+  pool->async_send({"b", 20000}, log.handler("b"));
+  EXPECT_EQ(1u, pool->num_active_connections());
+
+  // No connection takes this one, so the next request activates a connection.
+  pool->async_send({"c", 20000}, log.handler("c"));
+  EXPECT_EQ(1u, pool->num_active_connections());
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  pool->async_send({"d", 20000}, log.handler("d"));
+  EXPECT_EQ(2u, pool->num_active_connections());
+  EXPECT_EQ(0u, log.size());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, NoMinimumConnections) {
+  mock_server server;
+  thread_pool threads{1};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .min_connections(0)
+          .max_connections(2)
+          .eager_connect(true)}};
+  EXPECT_EQ(0u, pool->num_active_connections());
+
+  // There is nothing to connect eagerly, so the pool is ready straight away.
+  std::promise<std::error_code> ready;
+  pool->async_wait_ready([&](std::error_code ec) { ready.set_value(ec); });
+  EXPECT_FALSE(ready.get_future().get());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, FirstRequestOpensConnection) {
+  mock_server server;
+  thread_pool threads{1};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.min_connections(0).max_connections(2)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{"okay1_reply"}));
+  server.expect_eof_and_close();
+
+  // Nothing was waiting for the request, so sending it activates the first
+  // connection even though nothing else is buffered.
+  send_and_expect(*pool, "okay1", 1000, errc_success, "okay1_reply",
+                  [&] { server.post([&] { pool.reset(); }); });
+  EXPECT_EQ(1u, pool->num_active_connections());
+  server.run(1);
+}
+
+TEST(ConnectionPoolTest, ShrinksWhenIdle) {
+  mock_server server;
+  thread_pool threads{1};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .min_connections(0)
+          .max_connections(1)
+          .idle_timeout_ms(30)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay1")))
+      .WillOnce(Return(response{"okay1_reply"}));
+  server.expect_eof_and_close();
+
+  send_and_expect(*pool, "okay1", 1000, errc_success, "okay1_reply");
+  EXPECT_EQ(1u, pool->num_active_connections());
+
+  // The server stops once the idle connection closes its socket, which takes
+  // the connection out of the active count.
+  server.run(1);
+  for (int i = 0; i < 1000 && pool->num_active_connections() > 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(0u, pool->num_active_connections());
+  pool.reset();
+}
+
+TEST(ConnectionPoolTest, ShrinksBackToMinimum) {
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .min_connections(1)
+          .max_connections(3)
+          .grow_queue_depth(1)
+          .idle_timeout_ms(30)}};
+
+  for (auto name : {"a", "b", "c", "d", "e", "f"}) {
+    EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(name)))
+        .WillOnce(Return(response{10, "r"}));
+  }
+  EXPECT_CALL(server, on_receive(Ne(asio_success), Eq("")))
+      .Times(AnyNumber())
+      .WillRepeatedly(Return(response{}));
+  std::thread server_thread{[&] { server.run(); }};
+
+  // As in GrowsWithQueueDepth, the burst activates every connection.
+  for (auto name : {"a", "b", "c", "d"}) {
+    pool->async_send({name, 20000}, log.handler(name));
+  }
+  EXPECT_EQ(3u, pool->num_active_connections());
+  for (auto name : {"a", "b", "c", "d"}) EXPECT_FALSE(log.wait_for(name));
+
+  // The two connections above the minimum go idle and stop listening.
+  for (int i = 0; i < 1000 && pool->num_active_connections() > 1; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(1u, pool->num_active_connections());
+
+  // Without enough requests buffered to grow, the second one waits for the
+  // remaining connection rather than waking up an idle one.
+  pool->async_send({"e", 20000}, log.handler("e"));
+  pool->async_send({"f", 20000}, log.handler("f"));
+  EXPECT_FALSE(log.wait_for("e"));
+  EXPECT_FALSE(log.wait_for("f"));
+  EXPECT_EQ(1u, pool->num_active_connections());
+  EXPECT_EQ(3u, server.reply_counts().size());
+
+  pool.reset();
+  server.post([&] { server.stop(); });
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, HigherPriorityServedFirst) {
+  InSequence sequence;
+  mock_server server;
+  thread_pool threads{2};
+  std::atomic<uint32_t> msgs_received{0};
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}.max_connections(1).num_priorities(2)}};
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("sent")))
+      .WillOnce(Return(response{50, "sent_reply"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("high")))
+      .WillOnce(Return(response{"high_reply"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("low")))
+      .WillOnce(Return(response{"low_reply"}));
+  server.expect_eof_and_close();
+  std::thread server_thread{[&] { server.run(1); }};
+
+  auto stop_when_done = [&](std::error_code ec, std::string&) {
+    EXPECT_FALSE(ec) << ec.message();
+    if (++msgs_received == 3) {
+      pool.reset();
+      threads.io_service().stop();
+    }
+  };
+  // While the first request is in flight, the other two are buffered and the
+  // high priority one is sent next.
+  pool->async_send({"sent", 1000}, stop_when_done, 1);
+  pool->async_send({"low", 1000}, stop_when_done, 1);
+  pool->async_send({"high", 1000}, stop_when_done, 0);
+  server_thread.join();
+}
+
+TEST(ConnectionPoolTest, ReservedConnectionsServeHighestPriority) {
+  // The server is never run, so connections are accepted but never answered.
+  mock_server server;
+  thread_pool threads{1};
+  outcome_log log;
+  std::unique_ptr<pool_type> pool{new pool_type{
+      threads.io_service(), server.endpoints(),
+      connection_options{}
+          .max_connections(2)
+          .reserved_connections(1)
+          .num_priorities(2)
+          .default_priority(1)
+          .highwatermark(1)
+          .on_overflow(overflow_policy::fail)}};
+
+  // The shared connection takes the first request and the second is buffered;
+  // the reserved connection stays free for the highest priority.
+  EXPECT_TRUE(pool->try_async_send({"sent", 20000}, log.handler("sent")));
+  EXPECT_TRUE(pool->try_async_send({"low", 20000}, log.handler("low")));
+  EXPECT_FALSE(pool->try_async_send({"full", 20000}, log.handler("full")));
+  EXPECT_TRUE(pool->try_async_send({"high", 20000}, log.handler("high"), 0));
+  EXPECT_TRUE(
+      pool->try_async_send({"buffered", 20000}, log.handler("buffered"), 0));
+  EXPECT_EQ(0u, log.size());
+  pool.reset();
+}
+
 }  // namespace
 }  // namespace testing
 }  // namespace riak
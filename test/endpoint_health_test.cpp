@@ -0,0 +1,102 @@
+#include "endpoint_health.hpp"
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+using std::chrono::milliseconds;
+
+class EndpointHealthTest : public ::testing::Test {
+ protected:
+  EndpointHealthTest() : now{timing_wheel::clock_type::now()} {}
+
+  std::vector<size_t> order(endpoint_health& health) {
+    std::vector<size_t> indices;
+    health.connect_order(now, indices);
+    return indices;
+  }
+
+  timing_wheel::time_point now;
+};
+
+TEST_F(EndpointHealthTest, EjectsAfterConsecutiveFailures) {
+  endpoint_health health{connection_options{}.eject_after_failures(2)};
+  health.set_num_endpoints(3);
+  EXPECT_EQ((std::vector<size_t>{0, 1, 2}), order(health));
+
+  // A response resets the count.
+  health.report_failure(1, now);
+  health.report_response(1, milliseconds{1}, now);
+  health.report_failure(1, now);
+  EXPECT_FALSE(health.ejected(1));
+
+  health.report_failure(1, now);
+  EXPECT_TRUE(health.ejected(1));
+  EXPECT_EQ(1, health.ejections());
+  EXPECT_EQ((std::vector<size_t>{0, 2}), order(health));
+  EXPECT_TRUE(health.available(now));
+}
+
+TEST_F(EndpointHealthTest, BacksOffThenReadmits) {
+  endpoint_health health{connection_options{}
+                             .eject_after_failures(1)
+                             .backoff_base_ms(100)
+                             .backoff_max_ms(1000)
+                             .connection_timeout_ms(50)};
+  health.set_num_endpoints(2);
+  health.report_failure(0, now);
+  health.report_failure(1, now);
+  EXPECT_EQ(2, health.ejections());
+
+  // Connecting fails straight away while every endpoint backs off.
+  EXPECT_TRUE(order(health).empty());
+  EXPECT_FALSE(health.available(now));
+
+  // The jitter keeps the retry within the second half of the backoff.
+  now += milliseconds{100};
+  EXPECT_TRUE(health.available(now));
+  EXPECT_EQ((std::vector<size_t>{0, 1}), order(health));
+  // The probed endpoints are held back while being connected to.
+  EXPECT_TRUE(order(health).empty());
+
+  // A failed probe doubles the backoff, a successful one readmits.
+  health.report_failure(0, now);
+  health.report_connected(1, now);
+  EXPECT_FALSE(health.ejected(1));
+  EXPECT_EQ(1, health.readmissions());
+
+  // Healthy endpoints come first.
+  now += milliseconds{99};
+  EXPECT_EQ(std::vector<size_t>{1}, order(health));
+  now += milliseconds{101};
+  EXPECT_EQ((std::vector<size_t>{1, 0}), order(health));
+}
+
+TEST_F(EndpointHealthTest, EjectsLatencyOutliers) {
+  endpoint_health health{connection_options{}.outlier_latency_factor(6)};
+  health.set_num_endpoints(3);
+  health.report_response(0, milliseconds{10}, now);
+  health.report_response(1, milliseconds{30}, now);
+  health.report_response(2, milliseconds{50}, now);
+  EXPECT_FALSE(health.ejected(2));
+
+  health.report_response(2, milliseconds{200}, now);
+  EXPECT_TRUE(health.ejected(2));
+  EXPECT_EQ(1, health.ejections());
+
+  health.report_response(1, milliseconds{400}, now);
+  EXPECT_TRUE(health.ejected(1));
+
+  // The last healthy endpoint is never ejected as an outlier.
+  health.report_response(0, milliseconds{900}, now);
+  EXPECT_FALSE(health.ejected(0));
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
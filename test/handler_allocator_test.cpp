@@ -0,0 +1,73 @@
+#include "handler_allocator.hpp"
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+TEST(HandlerAllocatorTest, ReusesSlots) {
+  handler_memory memory;
+  void* first = memory.allocate(100);
+  memory.deallocate(first);
+  void* second = memory.allocate(200);
+  EXPECT_EQ(first, second);
+  memory.deallocate(second);
+}
+
+TEST(HandlerAllocatorTest, FallsBackToHeap) {
+  handler_memory memory;
+  std::vector<void*> pointers;
+  for (size_t i = 0; i < handler_memory::num_slots + 2; ++i) {
+    pointers.push_back(memory.allocate(16));
+  }
+  void* large = memory.allocate(handler_memory::slot_size + 1);
+  for (auto pointer : pointers) memory.deallocate(pointer);
+  memory.deallocate(large);
+
+  // All the slots are free again.
+  for (size_t i = 0; i < handler_memory::num_slots; ++i) {
+    EXPECT_EQ(pointers[i], memory.allocate(16));
+  }
+}
+
+// Records being invoked through its hook.
+struct hooked_handler {
+  void operator()() {}
+
+  template <class Function>
+  friend void asio_handler_invoke(Function&& function,
+                                  hooked_handler* this_handler) {
+    *this_handler->invoked = true;
+    function();
+  }
+
+  bool* invoked;
+};
+
+TEST(HandlerAllocatorTest, ForwardsInvoke) {
+  bool invoked = false, called = false;
+  auto handler = make_custom_alloc_handler(std::make_shared<handler_memory>(),
+                                           hooked_handler{&invoked});
+  asio_handler_invoke([&] { called = true; }, &handler);
+  EXPECT_TRUE(invoked);
+  EXPECT_TRUE(called);
+}
+
+TEST(HandlerAllocatorTest, HandlerKeepsMemoryAlive) {
+  auto memory = std::make_shared<handler_memory>();
+  bool called = false;
+  auto handler = make_custom_alloc_handler(memory, [&] { called = true; });
+  memory.reset();
+
+  void* pointer = asio_handler_allocate(64, &handler);
+  asio_handler_deallocate(pointer, 64, &handler);
+  handler();
+  EXPECT_TRUE(called);
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -0,0 +1,86 @@
+#include "hedge_policy.hpp"
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+
+namespace riak {
+namespace testing {
+namespace {
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+TEST(HedgePolicyTest, DisabledByDefault) {
+  hedge_policy policy{connection_options{}};
+  EXPECT_FALSE(policy.enabled());
+}
+
+TEST(HedgePolicyTest, FixedDelay) {
+  hedge_policy policy{connection_options{}.hedge_delay_ms(15)};
+  EXPECT_TRUE(policy.enabled());
+  EXPECT_EQ(milliseconds{15}, policy.delay());
+
+  // Latencies only matter with a percentile.
+  for (uint64_t i = 0; i < hedge_policy::samples_per_update; ++i) {
+    policy.record_latency(milliseconds{100});
+  }
+  EXPECT_EQ(milliseconds{15}, policy.delay());
+}
+
+TEST(HedgePolicyTest, PercentileDelay) {
+  hedge_policy policy{connection_options{}.hedge_percentile(90)};
+  EXPECT_TRUE(policy.enabled());
+  EXPECT_EQ(hedge_policy::duration::max(), policy.delay());
+
+  // A twentieth of the requests are slow; the delay lands just above the fast
+  // ones, within a bucket's width.
+  for (uint64_t i = 0; i < hedge_policy::samples_per_update; ++i) {
+    policy.record_latency(i % 20 == 0 ? milliseconds{50} : milliseconds{2});
+  }
+  EXPECT_GT(policy.delay(), milliseconds{2});
+  EXPECT_LE(policy.delay(), microseconds{2560});
+
+  // Once the fast requests slow down, so does the delay.
+  for (uint64_t i = 0; i < 4 * hedge_policy::samples_per_update; ++i) {
+    policy.record_latency(milliseconds{20});
+  }
+  EXPECT_GT(policy.delay(), milliseconds{20});
+  EXPECT_LE(policy.delay(), milliseconds{25});
+}
+
+TEST(HedgePolicyTest, PercentileDelayIsAtLeastTheFixedOne) {
+  hedge_policy policy{
+      connection_options{}.hedge_percentile(50).hedge_delay_ms(10)};
+  for (uint64_t i = 0; i < hedge_policy::samples_per_update; ++i) {
+    policy.record_latency(milliseconds{1});
+  }
+  EXPECT_EQ(milliseconds{10}, policy.delay());
+}
+
+TEST(HedgePolicyTest, BudgetLimitsHedges) {
+  hedge_policy policy{
+      connection_options{}.hedge_delay_ms(1).hedge_budget_percent(10)};
+
+  // A burst is allowed up front.
+  for (int64_t i = 0; i < hedge_policy::max_burst; ++i) {
+    EXPECT_TRUE(policy.try_spend());
+  }
+  EXPECT_FALSE(policy.try_spend());
+  EXPECT_EQ(hedge_policy::max_burst, policy.num_hedges());
+
+  // Then one hedge per ten requests.
+  for (int i = 0; i < 9; ++i) policy.on_request();
+  EXPECT_FALSE(policy.try_spend());
+  policy.on_request();
+  EXPECT_TRUE(policy.try_spend());
+  EXPECT_FALSE(policy.try_spend());
+
+  policy.refund();
+  EXPECT_EQ(hedge_policy::max_burst, policy.num_hedges());
+  EXPECT_TRUE(policy.try_spend());
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -2,15 +2,53 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <new>
 #include <system_error>
 #include <thread>
 #include <utility>
 
+#include "buffer_pool.hpp"
 #include "debug_log.hpp"
 #include "length_framed_connection.hpp"
 #include "test_length_framed_server.hpp"
 #include "testing_util.hpp"
 
+namespace {
+// Counts the heap allocations of whichever thread turns counting on.
+thread_local bool count_allocations = false;
+thread_local size_t num_allocations = 0;
+}  // namespace
+
+void* operator new(size_t size) {
+  if (count_allocations) ++num_allocations;
+  if (void* pointer = std::malloc(size > 0 ? size : 1)) return pointer;
+  throw std::bad_alloc{};
+}
+
+// Every other form is replaced too, so that all of them pair up.
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  if (count_allocations) ++num_allocations;
+  return std::malloc(size > 0 ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t& nothrow) noexcept {
+  return operator new(size, nothrow);
+}
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+
 namespace riak {
 namespace testing {
 namespace {
@@ -21,12 +59,20 @@ constexpr auto no_deadline = length_framed_connection::no_deadline;
 
 class threaded_connection {
  public:
-  threaded_connection(mock_server& server, endpoint_vector endpoints)
-      : endpoints_{std::move(endpoints)}, server_(server) { run(); }
+  threaded_connection(
+      mock_server& server, endpoint_vector endpoints,
+      connection_options options =
+          connection_options{}.connection_timeout_ms(connect_timeout_ms),
+      buffer_pool* buffers = nullptr)
+      : endpoints_(std::move(endpoints)),
+        options_(std::move(options)),
+        buffers_(buffers),
+        server_(server) {
+    run();
+  }
 
   threaded_connection(mock_server& server)
-      : threaded_connection{
-            server, {{ip::address_v4{{{127, 0, 0, 1}}}, server.port()}}} {}
+      : threaded_connection{server, server.endpoints()} {}
 
   ~threaded_connection() { stop(); }
 
@@ -34,7 +80,8 @@ class threaded_connection {
     if (!running_) {
       work_.reset(new io::io_service::work{service_});
       conn_.reset(new length_framed_connection{
-          service_, endpoints_.begin(), endpoints_.end(), connect_timeout_ms});
+          service_, endpoints_.begin(), endpoints_.end(), options_,
+          buffers_});
       thread_ = std::thread{[&] {
         service_.run();
         service_.reset();
@@ -70,6 +117,8 @@ class threaded_connection {
 
  private:
   endpoint_vector endpoints_;
+  connection_options options_;
+  buffer_pool* buffers_;
   io::io_service service_;
   std::unique_ptr<io::io_service::work> work_;
   mock_server& server_;
@@ -149,6 +198,425 @@ TEST(LengthFramedConnectionTest, Timeouts) {
   server.run(1);
 }
 
+TEST(LengthFramedConnectionTest, Pipelined) {
+  mock_server server;
+  threaded_connection conn{server};
+  InSequence sequence;
+
+  // All three requests are written before any reply arrives; the replies must
+  // be matched to them in order.
+  send_and_expect(*conn, "first", 1000, errc_success, "r1");
+  send_and_expect(*conn, "second", 1000, errc_success, "r2");
+  send_and_expect(*conn, "third", 1000, errc_success, "r3", [&] {
+  conn.defer_stop();
+  });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("first")))
+      .WillOnce(Return(response{20, "r1"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("second")))
+      .WillOnce(Return(response{"r2"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("third")))
+      .WillOnce(Return(response{10, "r3"}));
+
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, PipelinedTimeoutFailsOutstanding) {
+  mock_server server;
+  threaded_connection conn{server};
+
+  std::atomic<int> num_failed{0};
+  auto stop_when_failed = [&] {
+    if (++num_failed == 2) server.post([&] { server.stop(); });
+  };
+  send_and_expect(*conn, "slow", 50, std::errc::timed_out, "",
+                  stop_when_failed);
+  send_and_expect(*conn, "queued", 1000, std::errc::timed_out, "",
+                  stop_when_failed);
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("slow")))
+      .WillOnce(Return(response{100, "slow_reply", allow_errors}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("queued")))
+      .Times(AtMost(1))
+      .WillRepeatedly(Return(response{}));
+  EXPECT_CALL(server, on_receive(Ne(asio_success), Eq("")))
+      .Times(AnyNumber())
+      .WillRepeatedly(Return(response{}));
+
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, ExpiredRequestsAreNotWritten) {
+  mock_server server;
+  threaded_connection conn{server};
+  InSequence sequence;
+
+  // The deadline counts from when the request is made, so one which expired
+  // before the connection got to it is failed without being written.
+  length_framed_connection::request_type expired{"expired", 20};
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  conn->async_send(std::move(expired), [&](std::error_code ec, std::string&) {
+    EXPECT_EQ(std::make_error_code(std::errc::timed_out), ec);
+    send_and_expect(*conn, "okay", 1000, errc_success, "okay_reply", [&] {
+    conn.defer_stop();
+    });
+  });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("okay")))
+      .WillOnce(Return(response{"okay_reply"}));
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, UnsentRequestsExpireBehindLongWrite) {
+  io::io_service conn_service;
+  // The peer never reads, so the first request's write never completes.
+  tcp::acceptor acceptor{conn_service,
+                         tcp::endpoint{ip::address_v4{{{127, 0, 0, 1}}}, 0}};
+  auto endpoints = endpoint_vector{acceptor.local_endpoint()};
+  length_framed_connection conn{
+      conn_service, endpoints.begin(), endpoints.end(),
+      connection_options{}.connection_timeout_ms(1000).send_buffer_bytes(
+          4096)};
+
+  conn.async_send(length_framed_connection::request_type{
+                      std::string(32 << 20, 'x')},
+                  [](std::error_code, std::string&) {});
+  auto start = timing_wheel::clock_type::now();
+  send_and_expect(conn, "queued", 50, std::errc::timed_out, "", [&] {
+    EXPECT_GT(start + std::chrono::seconds(1),
+              timing_wheel::clock_type::now());
+    conn_service.stop();
+  });
+  conn_service.run();
+}
+
+TEST(LengthFramedConnectionTest, PingDoesNotHideRequestDeadline) {
+  mock_server server;
+  threaded_connection conn{
+      server, server.endpoints(),
+      connection_options{}.connection_timeout_ms(2000).ping_interval_ms(20)};
+  const std::string ping(1, length_framed_connection::ping_request_code);
+
+  // The request is written behind an unanswered ping, whose own deadline is
+  // much later.
+  auto start = timing_wheel::clock_type::now();
+  conn->async_connect([](std::error_code ec) { EXPECT_FALSE(ec); });
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(ping)))
+      .WillOnce(InvokeWithoutArgs([&] {
+        send_and_expect(*conn, "slow", 50, std::errc::timed_out, "", [&] {
+          EXPECT_GT(start + std::chrono::seconds(1),
+                    timing_wheel::clock_type::now());
+          server.post([&] { server.stop(); });
+        });
+        return response{1500, "\x02", allow_errors};
+      }));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("slow")))
+      .Times(AtMost(1))
+      .WillRepeatedly(Return(response{1500, "r", allow_errors}));
+  EXPECT_CALL(server, on_receive(Ne(asio_success), Eq("")))
+      .Times(AnyNumber())
+      .WillRepeatedly(Return(response{}));
+
+  server.run();
+}
+
+TEST(LengthFramedConnectionTest, TimeoutFieldCountsAgainstBatchBytes) {
+  mock_server server;
+  threaded_connection conn{
+      server, server.endpoints(),
+      connection_options{}.connection_timeout_ms(connect_timeout_ms)
+          .max_write_batch_bytes(12)};
+  InSequence sequence;
+
+  // Framed, each payload takes six bytes; with its timeout field, nine. Two
+  // of them no longer fit one batch.
+  conn.io_service().post([&] {
+    for (int i = 0; i < 2; ++i) {
+      length_framed_connection::request_type request{"m" + std::to_string(i),
+                                                     1000};
+      request.timeout_field = 10;
+      conn->async_send(std::move(request),
+                       [&, i](std::error_code ec, std::string&) {
+        EXPECT_FALSE(ec) << ec.message();
+        if (i == 0) return;
+        EXPECT_EQ(2u, conn->num_writes());
+        conn.defer_stop();
+      });
+    }
+  });
+
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_CALL(server, on_receive(Eq(asio_success),
+                                   StartsWith("m" + std::to_string(i))))
+        .WillOnce(Return(response{"r"}));
+  }
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, TimeoutFieldCarriesRemainingBudget) {
+  mock_server server;
+  threaded_connection conn{server};
+
+  length_framed_connection::request_type request{"x", 1000};
+  request.timeout_field = 10;
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  conn->async_send(std::move(request), [&](std::error_code ec, std::string&) {
+    EXPECT_FALSE(ec) << ec.message();
+    conn.defer_stop();
+  });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), StartsWith("x\x50")))
+      .WillOnce(Invoke([](asio_error, std::string received) {
+        // Field 10 as a two-byte varint: at most the 800ms left.
+        EXPECT_EQ(4u, received.size());
+        uint32_t timeout_ms = (received[2] & 0x7f) | (received[3] << 7);
+        EXPECT_LE(timeout_ms, 800u);
+        EXPECT_GT(timeout_ms, 500u);
+        return response{"r"};
+      }));
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, IdleTimeoutClosesAndReconnects) {
+  mock_server server;
+  threaded_connection conn{
+      server, server.endpoints(),
+      connection_options{}.connection_timeout_ms(connect_timeout_ms)
+          .idle_timeout_ms(30)};
+  InSequence sequence;
+
+  send_and_expect(*conn, "first", 1000, errc_success, "r1");
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("first")))
+      .WillOnce(Return(response{"r1"}));
+
+  // The socket is closed once idle for long enough; the next request opens a
+  // new one.
+  server.expect_eof([&] {
+    send_and_expect(*conn, "second", 1000, errc_success, "r2", [&] {
+    conn.defer_stop();
+    });
+  });
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("second")))
+      .WillOnce(Return(response{"r2"}));
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, PingsIdleConnections) {
+  mock_server server;
+  threaded_connection conn{
+      server, server.endpoints(),
+      connection_options{}.connection_timeout_ms(connect_timeout_ms)
+          .ping_interval_ms(20)};
+  InSequence sequence;
+  const std::string ping(1, length_framed_connection::ping_request_code);
+
+  // Connects without a request, then pings once idle.
+  conn->async_connect([](std::error_code ec) { EXPECT_FALSE(ec); });
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(ping)))
+      .WillOnce(Return(response{"\x02"}));
+
+  // A ping which is not answered in time replaces the socket straight away.
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(ping)))
+      .WillOnce(Return(response{1000, "\x02", allow_errors}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(ping)))
+      .WillOnce(InvokeWithoutArgs([&]() -> response {
+        conn.defer_stop();
+        return response{"\x02"};
+      }));
+  server.expect_eof_and_close();
+  server.run(2);
+}
+
+TEST(LengthFramedConnectionTest, BatchedWrites) {
+  mock_server server;
+  threaded_connection conn{
+      server,
+      server.endpoints(),
+      connection_options{}.max_write_batch(2).max_write_batch_bytes(12)};
+  InSequence sequence;
+
+  // The byte limit is smaller than some of the requests; each batch must
+  // still contain at least one request.
+  const auto large = std::string(100, 'z');
+  for (int i = 0; i < 5; ++i) {
+    send_and_expect(*conn, "m" + std::to_string(i), 1000, errc_success,
+                    "r" + std::to_string(i));
+  }
+  send_and_expect(*conn, large, 1000, errc_success, "rlarge", [&] {
+  conn.defer_stop();
+  });
+
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_CALL(server,
+                on_receive(Eq(asio_success), Eq("m" + std::to_string(i))))
+        .WillOnce(Return(response{"r" + std::to_string(i)}));
+  }
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq(large)))
+      .WillOnce(Return(response{"rlarge"}));
+
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, BatchesWhileConnecting) {
+  mock_server server;
+  threaded_connection conn{server};
+  InSequence sequence;
+
+  // Requests sent while the connection connects go out in one write with the
+  // default batch limits.
+  const int num_requests = 5;
+  conn.io_service().post([&] {
+    for (int i = 0; i < num_requests; ++i) {
+      send_and_expect(*conn, "m" + std::to_string(i), 1000, errc_success,
+                      "r" + std::to_string(i), [&, i] {
+        if (i + 1 < num_requests) return;
+        EXPECT_EQ(1u, conn->num_writes());
+        conn.defer_stop();
+      });
+    }
+  });
+
+  for (int i = 0; i < num_requests; ++i) {
+    EXPECT_CALL(server,
+                on_receive(Eq(asio_success), Eq("m" + std::to_string(i))))
+        .WillOnce(Return(response{"r" + std::to_string(i)}));
+  }
+
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, SteadyStateDoesNotAllocate) {
+  mock_server server;
+  buffer_pool buffers;
+  threaded_connection conn{server, server.endpoints(),
+                           connection_options{}
+                               .connection_timeout_ms(connect_timeout_ms)
+                               .idle_timeout_ms(0),
+                           &buffers};
+
+  // Requests are sent one after the other from the connection's thread, with
+  // payloads recycled through the pool. Once warmed up, nothing it does per
+  // request, including the strand hops, may allocate.
+  const int num_warmup = 50, num_measured = 200;
+  int num_sent = 0;
+  std::function<void()> send_next = [&] {
+    if (num_sent == num_warmup) {
+      num_allocations = 0;
+      count_allocations = true;
+    } else if (num_sent == num_warmup + num_measured) {
+      count_allocations = false;
+      EXPECT_EQ(0u, num_allocations);
+      conn.defer_stop();
+      return;
+    }
+    ++num_sent;
+    auto payload = buffers.acquire(16);
+    payload = "ping";
+    conn->async_send(
+        length_framed_connection::request_type{std::move(payload)},
+        [&](std::error_code error, std::string& reply) {
+          if (error) ADD_FAILURE() << error.message();
+          buffers.release(std::move(reply));
+          send_next();
+        });
+  };
+  conn.io_service().post([&] { send_next(); });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("ping")))
+      .Times(num_warmup + num_measured)
+      .WillRepeatedly(Return(response{"pong"}));
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, LargeResponses) {
+  mock_server server;
+  threaded_connection conn{server};
+  InSequence sequence;
+
+  // Responses larger than the receive buffer, interleaved with small ones.
+  const auto large1 = std::string(
+      3 * length_framed_connection::receive_buffer_size + 17, 'x');
+  const auto large2 = std::string(
+      length_framed_connection::receive_buffer_size - 2, 'y');
+  send_and_expect(*conn, "large1", 1000, errc_success, large1);
+  send_and_expect(*conn, "small", 1000, errc_success, "s");
+  send_and_expect(*conn, "large2", 1000, errc_success, large2, [&] {
+  conn.defer_stop();
+  });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("large1")))
+      .WillOnce(Return(response{large1}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("small")))
+      .WillOnce(Return(response{"s"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("large2")))
+      .WillOnce(Return(response{large2}));
+
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, SocketOptions) {
+  mock_server server;
+  threaded_connection conn{
+      server,
+      server.endpoints(),
+      connection_options{}
+          .tcp_nodelay(true)
+          .keepalive(true)
+          .keepalive_idle_s(30)
+          .keepalive_interval_s(5)
+          .keepalive_count(3)
+          .send_buffer_bytes(65536)
+          .receive_buffer_bytes(65536)
+          .tcp_quickack(true)
+          .busy_poll_us(10)};
+  InSequence sequence;
+
+  // Options the system refuses are skipped, they must not break the socket.
+  send_and_expect(*conn, "hello", 1000, errc_success, "world", [&] {
+  send_and_expect(*conn, "again", 1000, errc_success, "world2", [&] {
+  conn.defer_stop();
+  }); });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("hello")))
+      .WillOnce(Return(response{"world"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("again")))
+      .WillOnce(Return(response{"world2"}));
+
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
+TEST(LengthFramedConnectionTest, LocalSocket) {
+  mock_server server{"/tmp/riakpp_test_" + std::to_string(random_port())};
+  threaded_connection conn{
+      server, server.endpoints(),
+      connection_options{}.tcp_nodelay(true).keepalive(true).tcp_quickack(
+          true)};
+  InSequence sequence;
+
+  send_and_expect(*conn, "hello", 1000, errc_success, "world", [&] {
+  send_and_expect(*conn, "hello again", 1000, errc_success, "hi there", [&] {
+  conn.defer_stop();
+  }); });
+
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("hello")))
+      .WillOnce(Return(response{"world"}));
+  EXPECT_CALL(server, on_receive(Eq(asio_success), Eq("hello again")))
+      .WillOnce(Return(response{"hi there"}));
+
+  server.expect_eof_and_close();
+  server.run(1);
+}
+
 TEST(LengthFramedConnectionTest, DisconnectReconnect) {
   mock_server server;
   threaded_connection conn{server};
@@ -221,10 +689,12 @@ TEST(LengthFramedConnectionTest, ConnectionRefused) {
     io::io_service conn_service;
     io::io_service::work work{conn_service};
     {
-      auto endpoints = endpoint_vector{{ip::address_v4{{{1, 2, 3, 4}}}, 60000}};
+      auto endpoints =
+          endpoint_vector{tcp::endpoint{ip::address_v4{{{1, 2, 3, 4}}}, 60000}};
       // This times out if we are connected to the internet.
-      length_framed_connection conn{conn_service, endpoints.begin(),
-                                    endpoints.end(), connect_timeout_ms};
+      length_framed_connection conn{
+          conn_service, endpoints.begin(), endpoints.end(),
+          connection_options{}.connection_timeout_ms(connect_timeout_ms)};
 
       send_and_expect(
           conn, "a", no_deadline, std::errc::connection_refused, "", [&] {
@@ -236,10 +706,11 @@ TEST(LengthFramedConnectionTest, ConnectionRefused) {
       conn_service.reset();
     }
     {
-      auto endpoints =
-          endpoint_vector{{ip::address_v4{{{127, 0, 0, 1}}}, 60000}};
-      length_framed_connection conn{conn_service, endpoints.begin(),
-                                    endpoints.end(), no_deadline};
+      auto endpoints = endpoint_vector{
+          tcp::endpoint{ip::address_v4{{{127, 0, 0, 1}}}, 60000}};
+      length_framed_connection conn{
+          conn_service, endpoints.begin(), endpoints.end(),
+          connection_options{}.connection_timeout_ms(no_deadline)};
 
       send_and_expect(
           conn, "a", no_deadline, std::errc::connection_refused, "", [&] {
@@ -254,9 +725,9 @@ TEST(LengthFramedConnectionTest, ConnectionRefused) {
       mock_server server;
       threaded_connection conn{
           server,
-          {{ip::address_v4{{{1, 2, 3, 4}}}, 60000},
-           {ip::address_v4{{{127, 0, 0, 1}}}, 60000},
-           {ip::address_v4{{{127, 0, 0, 1}}}, server.port()}}};
+          {tcp::endpoint{ip::address_v4{{{1, 2, 3, 4}}}, 60000},
+           tcp::endpoint{ip::address_v4{{{127, 0, 0, 1}}}, 60000},
+           tcp::endpoint{ip::address_v4{{{127, 0, 0, 1}}}, server.port()}}};
       InSequence sequence;
 
       send_and_expect(*conn, "hello", 1000, errc_success, "world", [&] {
@@ -270,6 +741,33 @@ TEST(LengthFramedConnectionTest, ConnectionRefused) {
     }
 }
 
+TEST(LengthFramedConnectionTest, FailedRequestsReturnPayloads) {
+  io::io_service conn_service;
+  buffer_pool buffers;
+  auto endpoints =
+      endpoint_vector{tcp::endpoint{ip::address_v4{{{127, 0, 0, 1}}}, 60000}};
+  length_framed_connection conn{
+      conn_service, endpoints.begin(), endpoints.end(),
+      connection_options{}.connection_timeout_ms(no_deadline), &buffers};
+
+  // Both requests are still unsent when the connect is refused.
+  for (int i = 0; i < 2; ++i) {
+    auto payload = buffers.acquire(100);
+    payload = "a";
+    conn.async_send(
+        length_framed_connection::request_type{std::move(payload)},
+        [](std::error_code ec, std::string&) {
+          EXPECT_EQ(std::make_error_code(std::errc::connection_refused), ec);
+        });
+  }
+  conn_service.run();
+
+  EXPECT_EQ(0u, buffers.hits());
+  buffers.acquire(100);
+  buffers.acquire(100);
+  EXPECT_EQ(2u, buffers.hits());
+}
+
 TEST(LengthFramedConnectionTest, DestroyScenarios) {
   {
     mock_server server;
@@ -278,7 +776,8 @@ TEST(LengthFramedConnectionTest, DestroyScenarios) {
   {
     io::io_service conn_service;
     {
-      auto endpoints = endpoint_vector{{ip::address_v4{{{1, 2, 3, 4}}}, 60000}};
+      auto endpoints =
+          endpoint_vector{tcp::endpoint{ip::address_v4{{{1, 2, 3, 4}}}, 60000}};
       length_framed_connection conn{conn_service, endpoints.begin(),
                                     endpoints.end()};
       send_and_expect(conn, "a", no_deadline, std::errc::connection_refused,
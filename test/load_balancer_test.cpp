@@ -0,0 +1,75 @@
+#include "load_balancer.hpp"
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+using std::chrono::milliseconds;
+
+class LoadBalancerTest : public ::testing::Test {
+ protected:
+  LoadBalancerTest() : loads(3) {
+    for (const auto& load : loads) nodes.push_back(&load);
+  }
+
+  std::vector<node_load> loads;
+  std::vector<const node_load*> nodes;
+};
+
+TEST_F(LoadBalancerTest, RecordLatency) {
+  auto& load = loads[0];
+  EXPECT_EQ(0, load.latency_ns());
+  load.record_latency(milliseconds{8});
+  EXPECT_EQ(8000000, load.latency_ns());
+  load.record_latency(milliseconds{16});
+  EXPECT_EQ(9000000, load.latency_ns());
+}
+
+TEST_F(LoadBalancerTest, RoundRobin) {
+  auto balancer = make_load_balancer(balancing_policy::round_robin);
+  loads[1].add_outstanding();
+  std::vector<size_t> picked;
+  for (int i = 0; i < 6; ++i) picked.push_back(balancer->pick(nodes));
+  EXPECT_EQ((std::vector<size_t>{0, 1, 2, 0, 1, 2}), picked);
+}
+
+TEST_F(LoadBalancerTest, LeastOutstanding) {
+  auto balancer = make_load_balancer(balancing_policy::least_outstanding);
+  loads[0].add_outstanding();
+  loads[0].add_outstanding();
+  loads[2].add_outstanding();
+  for (int i = 0; i < 6; ++i) EXPECT_EQ(1, balancer->pick(nodes));
+
+  // Ties are spread between the nodes.
+  loads[1].add_outstanding();
+  std::vector<size_t> counts(3);
+  for (int i = 0; i < 6; ++i) ++counts[balancer->pick(nodes)];
+  EXPECT_EQ(0, counts[0]);
+  EXPECT_GT(counts[1], 0);
+  EXPECT_GT(counts[2], 0);
+}
+
+TEST_F(LoadBalancerTest, PowerOfTwoLatency) {
+  auto balancer = make_load_balancer(balancing_policy::power_of_two_latency);
+  loads[0].record_latency(milliseconds{1});
+  loads[1].record_latency(milliseconds{10});
+  loads[2].record_latency(milliseconds{10});
+  loads[2].add_outstanding();
+
+  // The node of lowest cost wins whenever it is one of the two choices, the
+  // one of highest cost never wins.
+  std::vector<size_t> counts(3);
+  for (int i = 0; i < 3000; ++i) ++counts[balancer->pick(nodes)];
+  EXPECT_EQ(0, counts[2]);
+  EXPECT_GT(counts[0], counts[1]);
+  EXPECT_EQ(3000, counts[0] + counts[1]);
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
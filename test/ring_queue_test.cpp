@@ -0,0 +1,68 @@
+#include "ring_queue.hpp"
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace riak {
+namespace testing {
+namespace {
+
+using owned_int = std::unique_ptr<int>;
+
+TEST(RingQueueTest, FirstInFirstOut) {
+  ring_queue<owned_int> queue;
+  EXPECT_TRUE(queue.empty());
+  for (int i = 0; i < 10; ++i) queue.emplace_back(new int{i});
+  EXPECT_EQ(10u, queue.size());
+  EXPECT_EQ(9, *queue.back());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(i, *queue[0]);
+    EXPECT_EQ(i, *queue.front());
+    queue.pop_front();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(RingQueueTest, KeepsCapacityAcrossWrapAround) {
+  ring_queue<owned_int> queue;
+  queue.emplace_back(new int{0});
+  queue.emplace_back(new int{1});
+  auto capacity = queue.capacity();
+
+  // Pushing as many as are popped wraps around without growing.
+  for (int i = 2; i < 100; ++i) {
+    queue.emplace_back(new int{i});
+    EXPECT_EQ(i - 2, *queue.front());
+    queue.pop_front();
+    EXPECT_EQ(i, *queue[1]);
+  }
+  EXPECT_EQ(capacity, queue.capacity());
+}
+
+TEST(RingQueueTest, GrowsWhileWrappedAround) {
+  ring_queue<owned_int> queue;
+  for (int i = 0; i < 3; ++i) queue.emplace_back(new int{i});
+  queue.pop_front();
+  queue.pop_front();
+  for (int i = 3; i < 20; ++i) queue.emplace_back(new int{i});
+  ASSERT_EQ(18u, queue.size());
+  for (size_t i = 0; i < queue.size(); ++i) EXPECT_EQ(int(i) + 2, *queue[i]);
+}
+
+TEST(RingQueueTest, ClearDestroysElements) {
+  auto shared = std::make_shared<int>(1);
+  {
+    ring_queue<std::shared_ptr<int>> queue;
+    for (int i = 0; i < 5; ++i) queue.emplace_back(shared);
+    queue.pop_front();
+    EXPECT_EQ(5, shared.use_count());
+    queue.clear();
+    EXPECT_EQ(1, shared.use_count());
+    for (int i = 0; i < 3; ++i) queue.emplace_back(shared);
+  }
+  EXPECT_EQ(1, shared.use_count());
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -5,6 +5,7 @@
 #include <boost/asio/deadline_timer.hpp>
 
 #include <algorithm>
+#include <cstdio>
 #include <random>
 #include <gtest/gtest.h>
 
@@ -19,9 +20,19 @@ const asio_error asio_success{};
 
 test_length_framed_server::test_length_framed_server()
     : port_{random_port()},
-      acceptor_{io_service_, tcp::endpoint{tcp::v4(), port_}} {}
+      acceptor_{io_service_, endpoint_type{tcp::endpoint{tcp::v4(), port_}}} {}
+
+test_length_framed_server::test_length_framed_server(std::string local_path)
+    : port_{0}, local_path_{std::move(local_path)}, acceptor_{io_service_} {
+  std::remove(local_path_.c_str());
+  auto endpoint = local_endpoint(local_path_);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+}
 
 test_length_framed_server::~test_length_framed_server() {
+  if (!local_path_.empty()) std::remove(local_path_.c_str());
   if (expected_sessions_ != static_cast<decltype(expected_sessions_)>(-1)) {
     EXPECT_EQ(max_sessions_, expected_sessions_);
   }
@@ -34,9 +45,14 @@ test_length_framed_server::session::~session() {
   RIAKPP_DLOG << "Destroyed session " << this;
 }
 
+endpoint_vector test_length_framed_server::endpoints() const {
+  if (!local_path_.empty()) return {local_endpoint(local_path_)};
+  return {tcp::endpoint{ip::address_v4{{{127, 0, 0, 1}}}, port_}};
+}
+
 void test_length_framed_server::session::close_session() {
   boost::system::error_code ec;
-  socket_.shutdown(tcp::socket::shutdown_both, ec);
+  socket_.shutdown(io::socket_base::shutdown_both, ec);
   if (socket_.is_open()) socket_.close();
   server_.delete_session(this);
 }
@@ -1,14 +1,16 @@
 #ifndef RIAKPP_TEST_LENGTH_FRAMED_SERVER_HPP_
 #define RIAKPP_TEST_LENGTH_FRAMED_SERVER_HPP_
 
+#include <boost/asio/basic_socket_acceptor.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/io_service.hpp>
-#include <boost/asio/ip/tcp.hpp>
 
 #include <cstdint>
 #include <unordered_map>
 
 #include <gmock/gmock.h>
 
+#include "endpoint_vector.hpp"
 #include "testing_util.hpp"
 #include "transient.hpp"
 
@@ -47,7 +49,9 @@ struct response {
 
 class test_length_framed_server {
  public:
+  // Listens on a random TCP port, or on a Unix domain socket at 'local_path'.
   test_length_framed_server();
+  explicit test_length_framed_server(std::string local_path);
   virtual ~test_length_framed_server();
 
   boost::asio::io_service& io_service() { return io_service_; }
@@ -56,6 +60,7 @@ class test_length_framed_server {
                               const std::string& message) = 0;
 
   uint16_t port() const { return port_; }
+  endpoint_vector endpoints() const;
 
   template <class Handler>
   void post(Handler&& handler) {
@@ -88,13 +93,13 @@ class test_length_framed_server {
     void wait_for_request();
     void reply(response with);
 
-    boost::asio::ip::tcp::socket& socket() { return socket_; }
+    boost::asio::generic::stream_protocol::socket& socket() { return socket_; }
 
    private:
     void close_session();
 
     test_length_framed_server& server_;
-    boost::asio::ip::tcp::socket socket_;
+    boost::asio::generic::stream_protocol::socket socket_;
 
     bool processing_request_{false};
     std::string payload_buffer_;
@@ -105,7 +110,9 @@ class test_length_framed_server {
 
   boost::asio::io_service io_service_;
   uint16_t port_;
-  boost::asio::ip::tcp::acceptor acceptor_;
+  const std::string local_path_;
+  boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>
+      acceptor_;
 
   std::unordered_map<session*, uint32_t> reply_counts_;
   std::vector<std::unique_ptr<session>> sessions_;
@@ -115,6 +122,10 @@ class test_length_framed_server {
 
 class mock_server : public test_length_framed_server {
  public:
+  mock_server() = default;
+  explicit mock_server(std::string local_path)
+      : test_length_framed_server{std::move(local_path)} {}
+
   template <class Handler>
   void expect_eof(Handler&& handler) {
     EXPECT_CALL(*this, on_receive(AnyOf(Eq(io::error::eof),
@@ -0,0 +1,117 @@
+#include "thread_pool.hpp"
+#include <gtest/gtest.h>
+
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace riak {
+namespace testing {
+namespace {
+
+TEST(ThreadPoolTest, SharedPoolHasOneShard) {
+  thread_pool threads{2};
+  EXPECT_EQ(1, threads.num_shards());
+  EXPECT_EQ(&threads.io_service(), &threads.shard(0));
+
+  std::promise<size_t> shard;
+  threads.io_service().post([&] { shard.set_value(threads.current_shard()); });
+  EXPECT_EQ(thread_pool::no_shard, shard.get_future().get());
+
+  // The threads are still the pool's own.
+  EXPECT_FALSE(threads.runs_this_thread());
+  std::promise<bool> own;
+  threads.io_service().post([&] { own.set_value(threads.runs_this_thread()); });
+  EXPECT_TRUE(own.get_future().get());
+}
+
+TEST(ThreadPoolTest, ShardPerThread) {
+  constexpr size_t num_threads = 4;
+  thread_pool threads{num_threads, thread_pool::sharding::per_thread};
+  ASSERT_EQ(num_threads, threads.num_shards());
+  EXPECT_EQ(thread_pool::no_shard, threads.current_shard());
+
+  // Each shard reports its own index, from a thread of its own.
+  std::mutex mutex;
+  std::set<std::thread::id> thread_ids;
+  std::vector<std::promise<size_t>> shards(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.shard(i).post([&, i] {
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        thread_ids.insert(std::this_thread::get_id());
+      }
+      shards[i].set_value(threads.current_shard());
+    });
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    EXPECT_EQ(i, shards[i].get_future().get());
+  }
+  EXPECT_EQ(num_threads, thread_ids.size());
+
+  // Another pool's threads are not this pool's shards.
+  thread_pool other{1, thread_pool::sharding::per_thread};
+  std::promise<size_t> foreign;
+  other.shard(0).post([&] { foreign.set_value(threads.current_shard()); });
+  EXPECT_EQ(thread_pool::no_shard, foreign.get_future().get());
+}
+
+TEST(ThreadPoolTest, StopAndJoin) {
+  thread_pool threads{2, thread_pool::sharding::per_thread};
+  threads.shard(1).post([&] { threads.stop(); });
+  threads.join();
+  EXPECT_TRUE(threads.shard(0).stopped());
+  EXPECT_TRUE(threads.shard(1).stopped());
+}
+
+TEST(ThreadPoolTest, PhysicalCores) {
+  auto cores = thread_pool::physical_cores();
+#ifdef __linux__
+  EXPECT_FALSE(cores.empty());
+#endif
+  EXPECT_LE(cores.size(), std::thread::hardware_concurrency());
+  EXPECT_EQ(cores.size(), std::set<size_t>(cores.begin(), cores.end()).size());
+  EXPECT_TRUE(thread_pool::physical_cores(1 << 20).empty());
+}
+
+TEST(ThreadPoolTest, PlacesThreads) {
+  thread_placement placement{thread_pool::physical_cores(), "placement-test"};
+  if (placement.cpus.size() > 1) placement.cpus.resize(1);
+  thread_pool threads{2, thread_pool::sharding::per_thread, placement};
+
+  for (size_t i = 0; i < threads.num_shards(); ++i) {
+    std::promise<std::pair<std::string, int>> placed;
+    threads.shard(i).post([&] {
+      std::string name;
+      int cpu = -1;
+#ifdef __linux__
+      char buffer[16] = {};
+      pthread_getname_np(pthread_self(), buffer, sizeof(buffer));
+      name = buffer;
+      cpu = sched_getcpu();
+#endif
+      placed.set_value({name, cpu});
+    });
+    auto name_and_cpu = placed.get_future().get();
+#ifdef __linux__
+    // Names are truncated to fit the index.
+    EXPECT_EQ("placement-tes/" + std::to_string(i), name_and_cpu.first);
+    if (!placement.cpus.empty()) {
+      EXPECT_EQ(static_cast<int>(placement.cpus[0]), name_and_cpu.second);
+    }
+#endif
+  }
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
@@ -0,0 +1,152 @@
+#include "timing_wheel.hpp"
+#include <gtest/gtest.h>
+
+#include <boost/asio/io_service.hpp>
+
+#include <chrono>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+using std::chrono::milliseconds;
+
+struct record_firing {
+  std::vector<int>* fired;
+  int id;
+  void operator()() { fired->push_back(id); }
+};
+
+TEST(TimingWheelTest, FiresAfterDeadline) {
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service};
+  timing_wheel::deadline entry;
+  std::vector<int> fired;
+
+  auto start = timing_wheel::clock_type::now();
+  timing_wheel::time_point fired_at;
+  wheel.schedule(entry, start + milliseconds(20), [&] {
+    fired_at = timing_wheel::clock_type::now();
+    fired.push_back(1);
+  });
+  EXPECT_EQ(1u, wheel.num_scheduled());
+  io_service.run();
+
+  ASSERT_EQ(std::vector<int>{1}, fired);
+  EXPECT_LE(start + milliseconds(20), fired_at);
+  EXPECT_EQ(0u, wheel.num_scheduled());
+}
+
+TEST(TimingWheelTest, CancelPreventsFiring) {
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service};
+  timing_wheel::deadline cancelled, kept;
+  std::vector<int> fired;
+
+  auto now = timing_wheel::clock_type::now();
+  wheel.schedule(cancelled, now + milliseconds(5), record_firing{&fired, 1});
+  wheel.schedule(kept, now + milliseconds(10), record_firing{&fired, 2});
+  wheel.cancel(cancelled);
+  wheel.cancel(cancelled);
+  EXPECT_EQ(1u, wheel.num_scheduled());
+  io_service.run();
+
+  EXPECT_EQ(std::vector<int>{2}, fired);
+}
+
+TEST(TimingWheelTest, RescheduleReplacesDeadline) {
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service};
+  timing_wheel::deadline entry, marker;
+  std::vector<int> fired;
+
+  auto now = timing_wheel::clock_type::now();
+  wheel.schedule(entry, now + milliseconds(5), record_firing{&fired, 1});
+  wheel.schedule(marker, now + milliseconds(15), record_firing{&fired, 2});
+  wheel.schedule(entry, now + milliseconds(30), record_firing{&fired, 3});
+  EXPECT_EQ(2u, wheel.num_scheduled());
+  io_service.run();
+
+  EXPECT_EQ((std::vector<int>{2, 3}), fired);
+}
+
+TEST(TimingWheelTest, DeadlinesBeyondOneRevolution) {
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service, 8};
+  timing_wheel::deadline near, far, farther;
+  std::vector<int> fired;
+
+  // With eight one-millisecond slots, these share slots with each other.
+  auto now = timing_wheel::clock_type::now();
+  wheel.schedule(farther, now + milliseconds(40), record_firing{&fired, 3});
+  wheel.schedule(far, now + milliseconds(20), record_firing{&fired, 2});
+  wheel.schedule(near, now + milliseconds(4), record_firing{&fired, 1});
+  io_service.run();
+
+  EXPECT_EQ((std::vector<int>{1, 2, 3}), fired);
+}
+
+TEST(TimingWheelTest, SleepsUntilTheEarliestDeadline) {
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service, 8};
+  timing_wheel::deadline cancelled, near, far;
+  std::vector<int> fired;
+
+  // Each wakeup is one handler run by the io_service. The cancelled deadline
+  // costs at most one more, and the far one moves out of the overflow list
+  // without waking the wheel.
+  auto now = timing_wheel::clock_type::now();
+  wheel.schedule(cancelled, now + milliseconds(10), record_firing{&fired, 1});
+  wheel.schedule(far, now + milliseconds(60), record_firing{&fired, 3});
+  wheel.schedule(near, now + milliseconds(30), record_firing{&fired, 2});
+  wheel.cancel(cancelled);
+  auto num_wakeups = io_service.run();
+
+  EXPECT_EQ((std::vector<int>{2, 3}), fired);
+  EXPECT_GE(3u, num_wakeups);
+}
+
+TEST(TimingWheelTest, EarlierDeadlineRearmsTimer) {
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service};
+  timing_wheel::deadline far, near;
+  timing_wheel::time_point fired_at;
+
+  auto start = timing_wheel::clock_type::now();
+  wheel.schedule(far, start + std::chrono::seconds(60), [] {});
+  wheel.schedule(near, start + milliseconds(10), [&] {
+    fired_at = timing_wheel::clock_type::now();
+    wheel.cancel(far);
+  });
+  io_service.run();
+
+  EXPECT_LE(start + milliseconds(10), fired_at);
+  EXPECT_GT(start + std::chrono::seconds(10), fired_at);
+  EXPECT_EQ(0u, wheel.num_scheduled());
+}
+
+TEST(TimingWheelTest, ManyDeadlines) {
+  static const int num_deadlines = 1000;
+  boost::asio::io_service io_service;
+  timing_wheel wheel{io_service, 64};
+  std::vector<timing_wheel::deadline> entries(num_deadlines);
+  std::vector<int> fired;
+
+  auto now = timing_wheel::clock_type::now();
+  for (int i = 0; i < num_deadlines; ++i) {
+    wheel.schedule(entries[i], now + milliseconds(i % 100),
+                   record_firing{&fired, i});
+  }
+  for (int i = 0; i < num_deadlines; i += 2) wheel.cancel(entries[i]);
+  EXPECT_EQ(size_t(num_deadlines / 2), wheel.num_scheduled());
+  io_service.run();
+
+  ASSERT_EQ(size_t(num_deadlines / 2), fired.size());
+  for (auto id : fired) EXPECT_EQ(1, id % 2);
+  EXPECT_EQ(0u, wheel.num_scheduled());
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
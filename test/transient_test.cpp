@@ -0,0 +1,80 @@
+#include "transient.hpp"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace riak {
+namespace testing {
+namespace {
+
+struct counted {
+  counted() : transient{*this} {}
+  std::atomic<uint64_t> calls{0};
+  riak::transient<counted> transient;
+};
+
+TEST(TransientTest, WrappedCallsStopAfterReset) {
+  counted target;
+  uint64_t calls = 0;
+  auto call = target.transient.wrap([&] { ++calls; });
+  call();
+  EXPECT_EQ(1, calls);
+
+  target.transient.reset();
+  call();
+  EXPECT_EQ(1, calls);
+  EXPECT_FALSE(target.transient.ref().lock());
+}
+
+TEST(TransientTest, ResetWaitsForLocks) {
+  counted target;
+  auto ref = target.transient.ref();
+  std::atomic<bool> reset{false};
+  std::thread resetter;
+  {
+    auto lock = ref.lock();
+    ASSERT_TRUE(lock);
+    resetter = std::thread{[&] {
+      target.transient.reset();
+      reset = true;
+    }};
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(reset);
+    EXPECT_FALSE(ref.lock());
+  }
+  resetter.join();
+  EXPECT_TRUE(reset);
+}
+
+TEST(TransientTest, ConcurrentLocksAndReset) {
+  constexpr size_t num_threads = 8;
+  for (int run = 0; run < 20; ++run) {
+    counted target;
+    std::atomic<bool> reset{false};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+      auto ref = target.transient.ref();
+      threads.emplace_back([&reset, ref] {
+        while (true) {
+          auto lock = ref.lock();
+          if (!lock) break;
+          // No lock is taken once reset returned.
+          EXPECT_FALSE(reset);
+          ++lock->calls;
+        }
+      });
+    }
+    while (target.calls < 1000) std::this_thread::yield();
+    target.transient.reset();
+    reset = true;
+    for (auto& thread : threads) thread.join();
+  }
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak
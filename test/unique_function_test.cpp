@@ -0,0 +1,99 @@
+#include "unique_function.hpp"
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace riak {
+namespace testing {
+namespace {
+
+class counted {
+ public:
+  explicit counted(int& live) : live_{&live} { ++*live_; }
+  counted(const counted& rhs) : live_{rhs.live_} { ++*live_; }
+  ~counted() { --*live_; }
+
+ private:
+  int* live_;
+};
+
+struct add_to_owned {
+  int operator()(int added) { return *value + added; }
+  std::unique_ptr<int> value;
+};
+
+struct holds_counted {
+  void operator()() {}
+  counted count;
+};
+
+TEST(UniqueFunctionTest, EmptyOk) {
+  unique_function<void()> function;
+  EXPECT_FALSE(function);
+  EXPECT_FALSE(function.stored_inline());
+
+  unique_function<void()> null{nullptr};
+  EXPECT_FALSE(null);
+}
+
+TEST(UniqueFunctionTest, MovableOnly) {
+  unique_function<int(int)> function{
+      add_to_owned{std::unique_ptr<int>{new int{42}}}};
+  ASSERT_TRUE(function);
+  EXPECT_TRUE(function.stored_inline());
+  EXPECT_EQ(43, function(1));
+
+  auto moved = std::move(function);
+  EXPECT_FALSE(function);
+  EXPECT_EQ(44, moved(2));
+}
+
+TEST(UniqueFunctionTest, ForwardsArguments) {
+  unique_function<std::string(std::string&, std::unique_ptr<int>)> function{
+      [](std::string& out, std::unique_ptr<int> value) {
+        out += std::to_string(*value);
+        return out;
+      }};
+  std::string out{"x"};
+  EXPECT_EQ("x5", function(out, std::unique_ptr<int>{new int{5}}));
+  EXPECT_EQ("x5", out);
+}
+
+TEST(UniqueFunctionTest, LargeCallablesOnHeap) {
+  int live = 0;
+  {
+    std::array<char, 512> large;
+    large.fill('a');
+    counted count{live};
+    unique_function<char()> function{[large, count] { return large[7]; }};
+    EXPECT_FALSE(function.stored_inline());
+    EXPECT_EQ('a', function());
+
+    unique_function<char()> other;
+    other = std::move(function);
+    EXPECT_EQ('a', other());
+    EXPECT_EQ(2, live);
+  }
+  EXPECT_EQ(0, live);
+}
+
+TEST(UniqueFunctionTest, DestroysCallables) {
+  int live = 0;
+  unique_function<void()> function{holds_counted{counted{live}}};
+  EXPECT_EQ(1, live);
+
+  function = holds_counted{counted{live}};
+  EXPECT_EQ(1, live);
+
+  unique_function<void()> other{std::move(function)};
+  EXPECT_EQ(1, live);
+  other.reset();
+  EXPECT_EQ(0, live);
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace riak